@@ -0,0 +1,10 @@
+#ifndef _HOST_ESP_CPU_H_
+#define _HOST_ESP_CPU_H_
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+
+#endif
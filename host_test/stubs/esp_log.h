@@ -0,0 +1,12 @@
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) printf("E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) printf("W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) printf("I (%s) " format "\n", tag, ##__VA_ARGS__)
+// compiled for the format check, never printed
+#define ESP_LOGD(tag, format, ...) do { if (0) printf("D (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _HOST_ESP_ROM_SYS_H_
+#define _HOST_ESP_ROM_SYS_H_
+
+#include <stdint.h>
+
+// advances the host clock instead of spinning, see host_stubs.h
+void esp_rom_delay_us(uint32_t us);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// FreeRTOS types and constants used by the portable driver modules, host build only
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#define tskIDLE_PRIORITY    0
+#define tskNO_AFFINITY      0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+
+#endif
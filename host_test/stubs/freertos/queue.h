@@ -0,0 +1,14 @@
+#ifndef _HOST_FREERTOS_QUEUE_H_
+#define _HOST_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HOST_QUEUE_s *QueueHandle_t;
+
+// FIFO of fixed-size items; send fails when full, receive when empty
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _HOST_FREERTOS_SEMPHR_H_
+#define _HOST_FREERTOS_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HOST_SEMAPHORE_s *SemaphoreHandle_t;
+
+// nothing blocks on the host: a take fails at once when the count is 0
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif
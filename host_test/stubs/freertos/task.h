@@ -0,0 +1,20 @@
+#ifndef _HOST_FREERTOS_TASK_H_
+#define _HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HOST_TASK_s *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+// tasks are created but never scheduled, a test runs their work itself
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, const uint32_t stack_size, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, const BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(const TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait);
+
+#endif
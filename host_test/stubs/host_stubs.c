@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "host_stubs.h"
+
+static int64_t host_now_us = 1000000;
+
+void HOST_advanceTime(const int64_t us)
+{
+    host_now_us += us;
+}
+
+void HOST_setTime(const int64_t us)
+{
+    if (us > host_now_us) {
+        host_now_us = us;
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    default:
+        return "ESP_FAIL";
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_now_us++;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    host_now_us += us;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    // 240 MHz
+    return (esp_cpu_cycle_count_t)(host_now_us * 240);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return calloc(n, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+// tasks
+
+struct HOST_TASK_s {
+    TaskFunction_t function;
+    void *arg;
+    uint32_t notifications;
+};
+
+static struct HOST_TASK_s host_main_task;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, const uint32_t stack_size, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, const BaseType_t core)
+{
+    TaskHandle_t task = (TaskHandle_t)calloc(1, sizeof(struct HOST_TASK_s));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->function = function;
+    task->arg = arg;
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != &host_main_task) {
+        free(task);
+    }
+}
+
+void vTaskDelay(const TickType_t ticks)
+{
+    host_now_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_now_us / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &host_main_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notifications++;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait)
+{
+    const uint32_t value = host_main_task.notifications;
+    if (value > 0) {
+        host_main_task.notifications = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+uint32_t HOST_taskNotifications(const TaskHandle_t task)
+{
+    return task->notifications;
+}
+
+// semaphores
+
+struct HOST_SEMAPHORE_s {
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    SemaphoreHandle_t semaphore = (SemaphoreHandle_t)malloc(sizeof(struct HOST_SEMAPHORE_s));
+    if (semaphore != NULL) {
+        semaphore->count = initial_count;
+        semaphore->max_count = max_count;
+    }
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    if (semaphore->count == 0) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->count >= semaphore->max_count) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    return pdTRUE;
+}
+
+// queues
+
+struct HOST_QUEUE_s {
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = (QueueHandle_t)calloc(1, sizeof(struct HOST_QUEUE_s));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = (uint8_t *)malloc((size_t)length * item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (queue->count == queue->length) {
+        return pdFALSE;
+    }
+    const UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+// timers
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t expire_us;
+    uint64_t period_us;         // 0 for one-shot
+    bool armed;
+    struct esp_timer *next;
+};
+
+static struct esp_timer *host_timers;
+static bool host_fail_create;
+static bool host_fail_start;
+
+void HOST_failTimer(const bool create, const bool start)
+{
+    host_fail_create = create;
+    host_fail_start = start;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    if (host_fail_create) {
+        host_fail_create = false;
+        return ESP_FAIL;
+    }
+    esp_timer_handle_t timer = (esp_timer_handle_t)calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->next = host_timers;
+    host_timers = timer;
+    *handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **link = &host_timers; *link != NULL; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+    free(timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (host_fail_start) {
+        host_fail_start = false;
+        return ESP_FAIL;
+    }
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expire_us = host_now_us + (int64_t)timeout_us;
+    timer->period_us = 0;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    if (host_fail_start) {
+        host_fail_start = false;
+        return ESP_FAIL;
+    }
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expire_us = host_now_us + (int64_t)period_us;
+    timer->period_us = period_us;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer->armed;
+}
+
+uint32_t HOST_runTimers(void)
+{
+    uint32_t fired = 0;
+    for (esp_timer_handle_t timer = host_timers; timer != NULL; timer = timer->next) {
+        if (!timer->armed || timer->expire_us > host_now_us) {
+            continue;
+        }
+        if (timer->period_us > 0) {
+            timer->expire_us += (int64_t)timer->period_us;
+        } else {
+            timer->armed = false;
+        }
+        timer->callback(timer->arg);
+        fired++;
+    }
+    return fired;
+}
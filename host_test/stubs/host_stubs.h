@@ -0,0 +1,26 @@
+#ifndef _HOST_STUBS_H_
+#define _HOST_STUBS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Controls of the stubbed platform for host tests. The esp_timer clock is
+ * virtual: it starts at one second, advances by 1 us on every read (so busy
+ * waits in the driver terminate) and by the full delay in esp_rom_delay_us()
+ * and vTaskDelay(). Timers fire only when a test calls HOST_runTimers().
+ */
+
+void HOST_advanceTime(const int64_t us);
+// move the clock forward to us, never back
+void HOST_setTime(const int64_t us);
+// make the next esp_timer_create() and/or esp_timer_start_*() call fail with ESP_FAIL
+void HOST_failTimer(const bool create, const bool start);
+// fire every armed timer that is due, returns how many fired
+uint32_t HOST_runTimers(void);
+// notifications given to task and not taken yet
+uint32_t HOST_taskNotifications(const TaskHandle_t task);
+
+#endif
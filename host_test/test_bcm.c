@@ -0,0 +1,232 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "can_bcm.h"
+#include "host_stubs.h"
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "mcp2515_txq.h"
+#include "test_host.h"
+
+// Broadcast manager: timer wheel schedule, catch-up and payload snapshots, driven by CAN_BCM_poll()
+
+#define BCM_TICK_US 1000
+#define BCM_BASE_ID 0x100
+#define BCM_END_TICK (2 * CAN_BCM_MAX_TICKS + 300)
+// ticks skipped every so often, each skip makes one catch-up pass
+#define BCM_SKIP_EVERY 97
+#define BCM_SKIP_TICKS 3
+
+typedef struct {
+	uint32_t period;            // ticks
+	uint32_t phase;
+} BCM_SCHEDULE_t;
+
+static const BCM_SCHEDULE_t schedule[] = {
+    {4, 0},
+    {255, 3},                                   // just under the first level
+    {256, 0},                                   // exactly one first-level wrap
+    {257, 255},                                 // first instance on the last slot before the wrap
+    {1000, 700},                                // cascades down from the second level
+    {CAN_BCM_MAX_TICKS, CAN_BCM_MAX_TICKS},     // the longest the wheel takes
+    {5, 1},                                     // payload rewritten by another thread
+};
+#define BCM_MSGS (sizeof(schedule) / sizeof(schedule[0]))
+#define BCM_SEQ_MSG 6
+
+static MCP2515_SIM sim;
+static CAN_BCM bcm;
+static uint32_t sent[BCM_MSGS];
+static uint32_t next_due[BCM_MSGS];
+static uint32_t off_schedule;
+static uint32_t torn;
+static uint32_t payload_changes;
+static uint8_t last_payload;
+static atomic_bool writer_stop;
+static atomic_uint writes;
+
+// every frame on the bus is checked against the schedule of its message
+static void bus_tx(void *arg, const CAN_FRAME frame)
+{
+    const uint32_t id = frame->can_id - BCM_BASE_ID;
+    if (id >= BCM_MSGS) {
+        off_schedule++;
+        return;
+    }
+    const uint32_t tick = (uint32_t)((bcm->msgs[id].due_us - bcm->start_us) / BCM_TICK_US);
+    if (tick != next_due[id]) {
+        off_schedule++;
+    }
+    next_due[id] = tick + schedule[id].period;
+    sent[id]++;
+    if (id == BCM_SEQ_MSG) {
+        for (int i = 1; i < frame->can_dlc; i++) {
+            torn += frame->data[i] != frame->data[0];
+        }
+        payload_changes += frame->data[0] != last_payload;
+        last_payload = frame->data[0];
+    }
+}
+
+// a payload is consistent when all eight bytes are equal
+static void *payload_writer(void *arg)
+{
+    uint8_t data[CAN_MAX_DLEN];
+    uint8_t value = 0;
+    while (!atomic_load(&writer_stop)) {
+        value++;
+        for (int i = 0; i < CAN_MAX_DLEN; i++) {
+            data[i] = value;
+        }
+        CAN_BCM_setData(bcm, BCM_SEQ_MSG, data, CAN_MAX_DLEN);
+        atomic_fetch_add(&writes, 1);
+    }
+    return NULL;
+}
+
+// completions free the mailboxes and the messages for their next instance
+static void service(void)
+{
+    const uint8_t tx = CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF;
+    uint8_t interrupts;
+    while ((interrupts = MCP2515_getInterrupts()) & tx) {
+        MCP2515_txCompleted(interrupts);
+    }
+}
+
+static void poll_at(const int64_t now_us)
+{
+    HOST_setTime(now_us);
+    CAN_BCM_poll(bcm, now_us);
+    service();
+}
+
+static MCP2515_TXQ bcm_start(void)
+{
+    MCP2515_SIM_reset(sim);
+    sim->auto_transmit = true;
+    MCP2515_SIM_setBusTxCallback(sim, bus_tx, NULL);
+    CHECK(MCP2515_reset() == ERROR_OK);
+    CHECK(MCP2515_setBitrate(CAN_500KBPS, MCP_8MHZ) == ERROR_OK);
+    CHECK(MCP2515_setNormalMode() == ERROR_OK);
+    MCP2515_TXQ txq = MCP2515_TXQ_create(16);
+    CHECK(txq != NULL);
+    CHECK(MCP2515_setTxQueue(txq) == NULL);
+
+    CAN_BCM_CONFIG_t config = CAN_BCM_DEFAULT_CONFIG(txq, BCM_MSGS);
+    config.tick_us = BCM_TICK_US;
+    bcm = CAN_BCM_create(&config);
+    CHECK(bcm != NULL);
+    return txq;
+}
+
+static void bcm_stop(MCP2515_TXQ txq)
+{
+    CAN_BCM_destroy(bcm);
+    bcm = NULL;
+    CHECK(MCP2515_setTxQueue(NULL) == txq);
+    MCP2515_TXQ_destroy(txq);
+}
+
+static void test_schedule(void)
+{
+    MCP2515_TXQ txq = bcm_start();
+    CAN_FRAME_t frame = {.can_dlc = CAN_MAX_DLEN};
+    for (uint32_t i = 0; i < BCM_MSGS; i++) {
+        frame.can_id = BCM_BASE_ID + i;
+        CHECK(CAN_BCM_add(bcm, &frame, schedule[i].period * BCM_TICK_US, schedule[i].phase * BCM_TICK_US,
+                          NULL, NULL) == i);
+        next_due[i] = schedule[i].phase;
+    }
+    // the wheel ends at CAN_BCM_MAX_TICKS
+    CAN_BCM bcm_full = bcm;
+    CHECK(CAN_BCM_add(bcm_full, &frame, (CAN_BCM_MAX_TICKS + 1) * BCM_TICK_US, 0, NULL, NULL) == CAN_BCM_NONE);
+    CHECK(CAN_BCM_add(bcm_full, &frame, BCM_TICK_US, (CAN_BCM_MAX_TICKS + 1) * BCM_TICK_US, NULL, NULL)
+          == CAN_BCM_NONE);
+
+    pthread_t writer;
+    atomic_store(&writer_stop, false);
+    CHECK(pthread_create(&writer, NULL, payload_writer, NULL) == 0);
+    // the first instance of the message then already carries a written payload
+    while (atomic_load(&writes) == 0) {
+        sched_yield();
+    }
+
+    // due times are exact: a pass one microsecond early leaves the tick for the next one
+    const int64_t start_us = esp_timer_get_time() + BCM_TICK_US;
+    poll_at(start_us);
+    CHECK(sent[0] == 1 && sent[2] == 1);
+    poll_at(start_us + 4 * BCM_TICK_US - 1);
+    CHECK(sent[0] == 1 && sent[1] == 1 && sent[BCM_SEQ_MSG] == 1);
+    poll_at(start_us + 4 * BCM_TICK_US);
+    CHECK(sent[0] == 2);
+
+    uint32_t tick = 4;
+    uint32_t skips = 0;
+    for (uint32_t step = 1; tick < BCM_END_TICK; step++) {
+        uint32_t advance = 1;
+        if (step % BCM_SKIP_EVERY == 0) {
+            advance = BCM_SKIP_TICKS;
+            skips++;
+        }
+        tick = (tick + advance < BCM_END_TICK) ? tick + advance : BCM_END_TICK;
+        poll_at(start_us + (int64_t)tick * BCM_TICK_US);
+    }
+    atomic_store(&writer_stop, true);
+    pthread_join(writer, NULL);
+
+    CHECK(off_schedule == 0);
+    for (uint32_t i = 0; i < BCM_MSGS; i++) {
+        const uint32_t expected = (BCM_END_TICK - schedule[i].phase) / schedule[i].period + 1;
+        if (sent[i] != expected) {
+            printf("message %u: %u sent, %u expected\n", i, sent[i], expected);
+        }
+        CHECK(sent[i] == expected);
+    }
+    CAN_BCM_STATS_t stats;
+    CAN_BCM_getStats(bcm, &stats);
+    printf("%u ticks, %u passes, %u catching up, %u payload changes seen\n",
+           stats.ticks, stats.wakeups, stats.catch_up, payload_changes);
+    CHECK(stats.ticks == BCM_END_TICK + 1);
+    CHECK(stats.catch_up == skips + 1);
+    CHECK(stats.overruns == 0 && stats.expired == 0 && stats.failed == 0 && stats.refused == 0);
+    CHECK(torn == 0);
+    CHECK(payload_changes > 0);
+    bcm_stop(txq);
+}
+
+// a failed start leaves nothing behind and can be retried
+static void test_start(void)
+{
+    MCP2515_TXQ txq = bcm_start();
+    HOST_failTimer(true, false);
+    CHECK(CAN_BCM_start(bcm) == ESP_ERR_NO_MEM);
+    CHECK(bcm->task == NULL && bcm->timer == NULL && !bcm->started);
+    HOST_failTimer(false, true);
+    CHECK(CAN_BCM_start(bcm) == ESP_FAIL);
+    CHECK(bcm->task == NULL && bcm->timer == NULL && !bcm->started);
+
+    CHECK(CAN_BCM_start(bcm) == ESP_OK);
+    CHECK(bcm->task != NULL && bcm->started);
+    CHECK(CAN_BCM_start(bcm) == ESP_ERR_INVALID_STATE);
+    // tick 0 right away, then one wake-up per tick
+    CHECK(HOST_taskNotifications(bcm->task) == 1);
+    HOST_advanceTime(BCM_TICK_US);
+    CHECK(HOST_runTimers() == 1);
+    CHECK(HOST_taskNotifications(bcm->task) == 2);
+    CAN_BCM_stop(bcm);
+    CHECK(bcm->task == NULL && bcm->timer == NULL);
+    bcm_stop(txq);
+}
+
+int main(void)
+{
+    sim = MCP2515_SIM_create();
+    CHECK(MCP2515_init() == ERROR_OK);
+    MCP2515_setTransport(MCP2515_SIM_transport(sim));
+    test_schedule();
+    test_start();
+    MCP2515_SIM_destroy(sim);
+    return TEST_RESULT("bcm");
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "can_filter.h"
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "test_host.h"
+
+// Software acceptance filter: lookups against a linear reference, lookup speed, and the drain stage
+
+#define FILTER_STD_IDS     150
+#define FILTER_EFF_RANGES  60
+#define FILTER_CHECKS      2000000
+#define FILTER_BENCH_IDS   (1 << 16)
+#define FILTER_BENCH_LOOKUPS 50000000
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    bool eff;
+} REF_RANGE_t;
+
+static REF_RANGE_t ref[FILTER_STD_IDS + FILTER_EFF_RANGES + 3];
+static int ref_count;
+
+// 32-bit xorshift, the same sequence on every host
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static bool ref_match(const canid_t can_id)
+{
+    const bool eff = (can_id & CAN_EFF_FLAG) != 0;
+    const uint32_t id = eff ? (can_id & CAN_EFF_MASK) : (can_id & CAN_SFF_MASK);
+    for (int i = 0; i < ref_count; i++) {
+        if (ref[i].eff == eff && id >= ref[i].first && id <= ref[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool add_range(CAN_FILTER filter, const uint32_t first, const uint32_t last, const bool eff)
+{
+    ref[ref_count++] = (REF_RANGE_t){first, last, eff};
+    const canid_t flag = eff ? CAN_EFF_FLAG : 0;
+    return (first == last) ? CAN_FILTER_addId(filter, first | flag)
+                           : CAN_FILTER_addRange(filter, first | flag, last | flag);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// random IDs, ends of the extended ranges and their neighbours
+static canid_t random_id(void)
+{
+    switch (rng() % 4) {
+    case 0:
+        return rng() & CAN_SFF_MASK;
+    case 1: {
+        const REF_RANGE_t *r = &ref[FILTER_STD_IDS + rng() % (ref_count - FILTER_STD_IDS)];
+        const uint32_t edge = (rng() & 1) ? r->last + 1 : r->first;
+        return ((edge + rng() % 3 - 1) & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    }
+    default:
+        return (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    }
+}
+
+static CAN_FILTER build_filter(void)
+{
+    CAN_FILTER filter = CAN_FILTER_create(FILTER_EFF_RANGES + 3);
+    CHECK(filter != NULL);
+    for (int i = 0; i < FILTER_STD_IDS; i++) {
+        const uint32_t id = rng() & CAN_SFF_MASK;
+        CHECK(add_range(filter, id, id, false));
+    }
+    for (int i = 0; i < FILTER_EFF_RANGES; i++) {
+        const uint32_t first = rng() & CAN_EFF_MASK;
+        uint32_t last = first + rng() % 5000;
+        if (last > CAN_EFF_MASK) {
+            last = CAN_EFF_MASK;
+        }
+        CHECK(add_range(filter, first, last, true));
+    }
+    // overlapping and adjacent ranges are merged by the seal
+    CHECK(add_range(filter, 0x100, 0x1FF, true));
+    CHECK(add_range(filter, 0x200, 0x2FF, true));
+    CHECK(add_range(filter, 0x150, 0x160, true));
+    CHECK(!CAN_FILTER_addRange(filter, 0x1, 0x2 | CAN_EFF_FLAG));
+    CAN_FILTER_seal(filter);
+    CHECK(!CAN_FILTER_addId(filter, 0x1));
+    return filter;
+}
+
+static void test_reference(CAN_FILTER filter)
+{
+    uint32_t mismatches = 0;
+    for (int i = 0; i < FILTER_CHECKS; i++) {
+        const canid_t id = random_id();
+        mismatches += (CAN_FILTER_match(filter, id) != ref_match(id));
+    }
+    printf("%d IDs against the linear reference: %u mismatches, %u extended ranges after merge\n",
+           FILTER_CHECKS, mismatches, filter->eff_count);
+    CHECK(mismatches == 0);
+}
+
+static void bench_lookup(CAN_FILTER filter)
+{
+    static canid_t ids[FILTER_BENCH_IDS];
+    for (int i = 0; i < FILTER_BENCH_IDS; i++) {
+        ids[i] = (i & 1) ? (rng() & CAN_SFF_MASK) : ((rng() & CAN_EFF_MASK) | CAN_EFF_FLAG);
+    }
+    volatile uint32_t hits = 0;
+    const double start = now_s();
+    for (int i = 0; i < FILTER_BENCH_LOOKUPS; i++) {
+        hits += CAN_FILTER_match(filter, ids[i & (FILTER_BENCH_IDS - 1)]);
+    }
+    const double rate = FILTER_BENCH_LOOKUPS / (now_s() - start);
+    printf("lookup: %.1fM lookups/s (%u hits)\n", rate / 1e6, hits);
+    CHECK(rate > 1e6);
+}
+
+// rejected frames leave the chip but never reach the ring
+static void test_drain(void)
+{
+    MCP2515_SIM sim = MCP2515_SIM_create();
+    CHECK(MCP2515_init() == ERROR_OK);
+    MCP2515_setTransport(MCP2515_SIM_transport(sim));
+    CHECK(MCP2515_reset() == ERROR_OK);
+    CHECK(MCP2515_setNormalMode() == ERROR_OK);
+
+    CAN_FILTER filter = CAN_FILTER_create(0);
+    CHECK(CAN_FILTER_addId(filter, 0x123));
+    CHECK(MCP2515_setSoftFilter(filter) == NULL);
+    CAN_RING ring = CAN_RING_create(16);
+    CAN_FRAME_TS_t out[16];
+    CAN_FRAME_t frame = {.can_id = 0x124, .can_dlc = 0};
+    MCP2515_SIM_inject(sim, &frame);
+    frame.can_id = 0x123;
+    MCP2515_SIM_inject(sim, &frame);
+    CHECK(MCP2515_drainRx(ring, 0, CAN_TS_NONE) == 1);
+    CHECK(CAN_RING_popBatch(ring, out, 16) == 1 && out[0].frame.can_id == 0x123);
+    MCP2515_RX_STATS_t stats;
+    MCP2515_getRxStats(&stats);
+    CHECK(stats.rejected == 1 && stats.frames == 1);
+    CHECK(MCP2515_getRxStatus() == 0);
+
+    // swapped out, everything passes again
+    CHECK(MCP2515_setSoftFilter(NULL) == filter);
+    CAN_FILTER_destroy(filter);
+    frame.can_id = 0x124;
+    MCP2515_SIM_inject(sim, &frame);
+    CHECK(MCP2515_drainRx(ring, 0, CAN_TS_NONE) == 1);
+
+    CAN_RING_destroy(ring);
+    MCP2515_SIM_destroy(sim);
+}
+
+int main(void)
+{
+    CAN_FILTER filter = build_filter();
+    test_reference(filter);
+    bench_lookup(filter);
+    CAN_FILTER_destroy(filter);
+    test_drain();
+    return TEST_RESULT("filter");
+}
@@ -0,0 +1,19 @@
+#ifndef _TEST_HOST_H_
+#define _TEST_HOST_H_
+
+#include <stdio.h>
+
+// failed checks are reported and counted, the test keeps going
+static int test_failures;
+
+#define CHECK(cond)                                                             \
+	do {                                                                        \
+		if (!(cond)) {                                                          \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+			test_failures++;                                                    \
+		}                                                                       \
+	} while (0)
+
+#define TEST_RESULT(name) (printf("%s: %s\n", name, test_failures ? "FAILED" : "PASSED"), test_failures != 0)
+
+#endif
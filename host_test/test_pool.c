@@ -0,0 +1,119 @@
+#include "can_pool.h"
+#include "test_host.h"
+
+// Reference-counted frame pool: slot bitmap across a word boundary and the usage counters
+
+#define POOL_CAPACITY 33
+#define POOL_CONSUMERS 3
+
+// every slot once, then none; slots come back one at a time, the one past the first word included
+static void test_exhaustion(void)
+{
+    CAN_POOL pool = CAN_POOL_create(POOL_CAPACITY);
+    CHECK(pool != NULL && pool->words == 2);
+    CAN_POOL_FRAME frames[POOL_CAPACITY];
+    bool seen[POOL_CAPACITY] = {false};
+    for (int i = 0; i < POOL_CAPACITY; i++) {
+        frames[i] = CAN_POOL_alloc(pool);
+        CHECK(frames[i] != NULL);
+        if (frames[i] != NULL) {
+            CHECK(frames[i]->index < POOL_CAPACITY && !seen[frames[i]->index]);
+            CHECK(frames[i]->refs == 1 && frames[i]->pool == pool);
+            seen[frames[i]->index] = true;
+        }
+    }
+    CHECK(CAN_POOL_alloc(pool) == NULL);
+    CHECK(CAN_POOL_alloc(pool) == NULL);
+
+    CAN_POOL_STATS_t stats;
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.capacity == POOL_CAPACITY && stats.in_use == POOL_CAPACITY);
+    CHECK(stats.allocs == POOL_CAPACITY && stats.exhausted == 2 && stats.high_water == POOL_CAPACITY);
+
+    // slot 32 is the only bit of the second word, slot 31 the last of the first
+    static const uint32_t refill[] = {32, 31, 0};
+    for (int r = 0; r < 3; r++) {
+        CAN_POOL_FRAME freed = NULL;
+        for (int i = 0; i < POOL_CAPACITY; i++) {
+            if (frames[i] != NULL && frames[i]->index == refill[r]) {
+                freed = frames[i];
+                frames[i] = NULL;
+            }
+        }
+        CHECK(freed != NULL);
+        CAN_POOL_release(freed);
+        CAN_POOL_FRAME again = CAN_POOL_alloc(pool);
+        CHECK(again == freed);
+        CHECK(CAN_POOL_alloc(pool) == NULL);
+        for (int i = 0; i < POOL_CAPACITY; i++) {
+            if (frames[i] == NULL) {
+                frames[i] = again;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < POOL_CAPACITY; i++) {
+        CAN_POOL_release(frames[i]);
+    }
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.in_use == 0 && stats.exhausted == 5);
+    // the bitmap is whole again
+    for (int i = 0; i < POOL_CAPACITY; i++) {
+        frames[i] = CAN_POOL_alloc(pool);
+        CHECK(frames[i] != NULL);
+    }
+    CHECK(CAN_POOL_alloc(pool) == NULL);
+    for (int i = 0; i < POOL_CAPACITY; i++) {
+        CAN_POOL_release(frames[i]);
+    }
+    CAN_POOL_destroy(pool);
+}
+
+// one frame handed to several consumers is freed by the last release only
+static void test_fan_out(void)
+{
+    CAN_POOL pool = CAN_POOL_create(POOL_CAPACITY);
+    CAN_POOL_FRAME frames[4];
+    for (int i = 0; i < 4; i++) {
+        frames[i] = CAN_POOL_alloc(pool);
+        for (int c = 1; c < POOL_CONSUMERS; c++) {
+            CAN_POOL_retain(frames[i]);
+        }
+        CHECK(frames[i]->refs == POOL_CONSUMERS);
+    }
+    CAN_POOL_STATS_t stats;
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.in_use == 4 && stats.high_water == 4 && stats.allocs == 4);
+
+    for (int c = 0; c < POOL_CONSUMERS - 1; c++) {
+        for (int i = 0; i < 4; i++) {
+            CAN_POOL_release(frames[i]);
+        }
+        CAN_POOL_getStats(pool, &stats);
+        CHECK(stats.in_use == 4);
+    }
+    CAN_POOL_release(frames[0]);
+    CAN_POOL_release(frames[1]);
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.in_use == 2 && stats.high_water == 4);
+
+    // high_water stays at the peak while use rises again below it
+    CAN_POOL_FRAME extra = CAN_POOL_alloc(pool);
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.in_use == 3 && stats.high_water == 4);
+    CAN_POOL_release(extra);
+    CAN_POOL_release(frames[2]);
+    CAN_POOL_release(frames[3]);
+    CAN_POOL_getStats(pool, &stats);
+    CHECK(stats.in_use == 0 && stats.high_water == 4 && stats.allocs == 5 && stats.exhausted == 0);
+    CAN_POOL_destroy(pool);
+}
+
+int main(void)
+{
+    CHECK(CAN_POOL_create(0) == NULL);
+    test_exhaustion();
+    test_fan_out();
+    return TEST_RESULT("pool");
+}
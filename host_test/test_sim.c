@@ -0,0 +1,273 @@
+#include <string.h>
+
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "test_host.h"
+
+// Simulator semantics and the SPI cost of the hot paths, in transactions per frame
+
+static MCP2515_SIM sim;
+static CAN_FRAME_t bus_last;
+static uint32_t bus_sent;
+
+static void bus_tx(void *arg, const CAN_FRAME frame)
+{
+    bus_last = *frame;
+    bus_sent++;
+}
+
+static void sim_start(const CANCTRL_REQOP_MODE_t mode)
+{
+    MCP2515_SIM_reset(sim);
+    CHECK(MCP2515_reset() == ERROR_OK);
+    CHECK(MCP2515_setBitrate(CAN_500KBPS, MCP_8MHZ) == ERROR_OK);
+    if (mode == CANCTRL_REQOP_LOOPBACK) {
+        CHECK(MCP2515_setLoopbackMode() == ERROR_OK);
+    } else {
+        CHECK(MCP2515_setNormalMode() == ERROR_OK);
+    }
+}
+
+static bool frame_equal(const CAN_FRAME a, const CAN_FRAME b)
+{
+    return a->can_id == b->can_id && a->can_dlc == b->can_dlc
+           && ((a->can_id & CAN_RTR_FLAG) || memcmp(a->data, b->data, a->can_dlc) == 0);
+}
+
+// standard, extended and remote frames survive LOAD TX / READ RX encoding
+static void test_loopback(void)
+{
+    sim_start(CANCTRL_REQOP_LOOPBACK);
+    const CAN_FRAME_t frames[] = {
+        {.can_id = 0x123, .can_dlc = 8, .data = {1, 2, 3, 4, 5, 6, 7, 8}},
+        {.can_id = 0x18FF1234 | CAN_EFF_FLAG, .can_dlc = 3, .data = {0xAA, 0xBB, 0xCC}},
+        {.can_id = 0x7F0 | CAN_RTR_FLAG, .can_dlc = 2},
+        {.can_id = 0x1ABCDEF0 | CAN_EFF_FLAG | CAN_RTR_FLAG, .can_dlc = 0},
+    };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        CAN_FRAME_t tx = frames[i];
+        CAN_FRAME_t rx = {0};
+        CHECK(MCP2515_sendMessage(TXB1, &tx) == ERROR_OK);
+        CHECK(MCP2515_readMessageAfterStatCheck(&rx) == ERROR_OK);
+        CHECK(frame_equal(&tx, &rx));
+    }
+    CHECK(!MCP2515_checkReceive());
+    CHECK(MCP2515_auditShadow() == ERROR_OK);
+}
+
+// acceptance filters, RXB0 -> RXB1 rollover and overflow
+static void test_receive_buffers(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configFilterMask(config, MASK0, false, 0x7FF);
+    MCP2515_configFilterMask(config, MASK1, false, 0x7FF);
+    MCP2515_configFilter(config, RXF0, false, 0x100);
+    MCP2515_configFilter(config, RXF1, false, 0x101);
+    MCP2515_configFilter(config, RXF2, false, 0x200);
+    CHECK(MCP2515_configApply(config) == ERROR_OK);
+
+    CAN_FRAME_t frame = {.can_id = 0x300, .can_dlc = 1};
+    CHECK(!MCP2515_SIM_inject(sim, &frame));
+    CHECK(sim->frames_rejected == 1);
+
+    // RXB0 full: a match of RXB0's filters rolls over into RXB1
+    frame.can_id = 0x100;
+    CHECK(MCP2515_SIM_inject(sim, &frame));
+    frame.can_id = 0x101;
+    CHECK(MCP2515_SIM_inject(sim, &frame));
+    CHECK((MCP2515_getInterrupts() & (CANINTF_RX0IF | CANINTF_RX1IF)) == (CANINTF_RX0IF | CANINTF_RX1IF));
+    CAN_FRAME_t rx;
+    CHECK(MCP2515_readMessage(RXB0, &rx) == ERROR_OK && rx.can_id == 0x100);
+    CHECK(MCP2515_readMessage(RXB1, &rx) == ERROR_OK && rx.can_id == 0x101);
+    CHECK((MCP2515_getInterrupts() & (CANINTF_RX0IF | CANINTF_RX1IF)) == 0);
+
+    // only RXB1 filters match: a second frame is lost while RXB1 is full, even with RXB0 empty
+    frame.can_id = 0x200;
+    CHECK(MCP2515_SIM_inject(sim, &frame));
+    CHECK(!MCP2515_SIM_inject(sim, &frame));
+    CHECK(sim->overruns == 1);
+    CHECK(MCP2515_getErrorFlags() & EFLG_RX1OVR);
+    CHECK(MCP2515_auditShadow() == ERROR_OK);
+}
+
+// READ STATUS + READ RX BUFFER per polled frame, the read clears RXnIF
+static void test_rx_cost(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    const uint32_t frames = 100;
+    CAN_FRAME_t frame = {.can_id = 0x321, .can_dlc = 8};
+    CAN_FRAME_t rx;
+    MCP2515_resetSpiTransactionCount();
+    for (uint32_t i = 0; i < frames; i++) {
+        frame.data[0] = (uint8_t)i;
+        MCP2515_SIM_inject(sim, &frame);
+        CHECK(MCP2515_readMessageAfterStatCheck(&rx) == ERROR_OK && rx.data[0] == (uint8_t)i);
+    }
+    const uint32_t count = MCP2515_getSpiTransactionCount();
+    printf("polled RX: %.2f transactions per frame\n", (double)count / frames);
+    CHECK(count == 2 * frames);
+    CHECK(MCP2515_getRxStatus() == 0);
+}
+
+// a burst filling both buffers costs one status read plus one READ RX BUFFER each
+static void test_drain_cost(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    CAN_RING ring = CAN_RING_create(64);
+    CHECK(ring != NULL);
+    const uint32_t bursts = 50;
+    CAN_FRAME_t frame = {.can_id = 0x222, .can_dlc = 8};
+    MCP2515_resetSpiTransactionCount();
+    uint32_t drained = 0;
+    for (uint32_t i = 0; i < bursts; i++) {
+        MCP2515_SIM_inject(sim, &frame);
+        MCP2515_SIM_inject(sim, &frame);
+        drained += MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        CAN_FRAME_TS_t out[2];
+        CAN_RING_popBatch(ring, out, 2);
+    }
+    const uint32_t count = MCP2515_getSpiTransactionCount();
+    printf("drained RX: %.2f transactions per frame\n", (double)count / drained);
+    CHECK(drained == 2 * bursts);
+    CHECK(count <= 2 * drained);
+    CAN_RING_destroy(ring);
+}
+
+// a full ring loses only frames that pass the software filter
+static void test_drain_drops(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    CAN_RING ring = CAN_RING_create(2);
+    CAN_FILTER filter = CAN_FILTER_create(0);
+    CHECK(ring != NULL && filter != NULL);
+    CHECK(CAN_FILTER_addId(filter, 0x100));
+    MCP2515_setSoftFilter(filter);
+    MCP2515_RX_STATS_t before;
+    MCP2515_getRxStats(&before);
+
+    CAN_FRAME_t frame = {.can_id = 0x100, .can_dlc = 1};
+    for (int i = 0; i < 2; i++) {
+        MCP2515_SIM_inject(sim, &frame);
+        CHECK(MCP2515_drainRx(ring, 0, CAN_TS_NONE) == 1);
+    }
+    frame.can_id = 0x300;
+    for (int i = 0; i < 4; i++) {
+        MCP2515_SIM_inject(sim, &frame);
+        CHECK(MCP2515_drainRx(ring, 0, CAN_TS_NONE) == 0);
+    }
+    frame.can_id = 0x100;
+    MCP2515_SIM_inject(sim, &frame);
+    CHECK(MCP2515_drainRx(ring, 0, CAN_TS_NONE) == 0);
+
+    CAN_RING_STATS_t ring_stats;
+    CAN_RING_getStats(ring, &ring_stats);
+    MCP2515_RX_STATS_t after;
+    MCP2515_getRxStats(&after);
+    CHECK(ring_stats.dropped == 1 && ring_stats.pushed == 2);
+    CHECK(after.dropped - before.dropped == 1);
+    CHECK(after.rejected - before.rejected == 4);
+    CHECK(MCP2515_getRxStatus() == 0);
+
+    MCP2515_setSoftFilter(NULL);
+    CAN_FILTER_destroy(filter);
+    CAN_RING_destroy(ring);
+}
+
+// the INT stamp dates the oldest frame only when RXnIF alone asserted INT
+static void test_rx_timestamps(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    CAN_RING ring = CAN_RING_create(8);
+    CHECK(ring != NULL);
+    CAN_FRAME_t frame = {.can_id = 0x10, .can_dlc = 1};
+    CAN_FRAME_TS_t out[2];
+
+    MCP2515_SIM_inject(sim, &frame);
+    MCP2515_SIM_inject(sim, &frame);
+    can_ts_source_t source = MCP2515_rxTimestampSource(MCP2515_getInterrupts(), CAN_TS_INT);
+    CHECK(source == CAN_TS_INT);
+    CHECK(MCP2515_drainRx(ring, 1234, source) == 2);
+    CHECK(CAN_RING_popBatch(ring, out, 2) == 2);
+    CHECK(out[0].timestamp_us == 1234 && out[0].ts_source == CAN_TS_INT);
+    CHECK(out[1].ts_source == CAN_TS_READ);
+
+    // a TX completion was pending too: it may have asserted INT before the frame arrived
+    MCP2515_SIM_inject(sim, &frame);
+    sim->regs[MCP_CANINTF] |= CANINTF_TX0IF;
+    source = MCP2515_rxTimestampSource(MCP2515_getInterrupts(), CAN_TS_SOF);
+    CHECK(source == CAN_TS_NONE);
+    CHECK(MCP2515_drainRx(ring, 1234, source) == 1);
+    CHECK(CAN_RING_popBatch(ring, out, 2) == 1);
+    CHECK(out[0].ts_source == CAN_TS_READ && out[0].timestamp_us != 1234);
+    MCP2515_clearInterruptFlags(CANINTF_TX0IF);
+
+    // the same flag masked does not drive INT
+    CHECK(MCP2515_setInterruptProfile(MCP2515_INT_PROFILE_RX_ONLY) == ERROR_OK);
+    MCP2515_SIM_inject(sim, &frame);
+    sim->regs[MCP_CANINTF] |= CANINTF_TX0IF;
+    CHECK(MCP2515_rxTimestampSource(MCP2515_getInterrupts(), CAN_TS_INT) == CAN_TS_INT);
+    CHECK(MCP2515_rxTimestampSource(CANINTF_TX0IF, CAN_TS_INT) == CAN_TS_NONE);
+    MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+    CAN_RING_destroy(ring);
+}
+
+// LOAD TX BUFFER + RTS per frame, one RTS for a batch
+static void test_tx_cost(void)
+{
+    sim_start(CANCTRL_REQOP_NORMAL);
+    MCP2515_SIM_setBusTxCallback(sim, bus_tx, NULL);
+    sim->auto_transmit = false;
+    CAN_FRAME_t frames[N_TXBUFFERS];
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        frames[i] = (CAN_FRAME_t){.can_id = 0x400 + i, .can_dlc = 8};
+    }
+
+    MCP2515_resetSpiTransactionCount();
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        CHECK(MCP2515_sendMessageAfterCtrlCheck(&frames[i]) == ERROR_OK);
+    }
+    uint32_t count = MCP2515_getSpiTransactionCount();
+    printf("single TX: %.2f transactions per frame\n", (double)count / N_TXBUFFERS);
+    CHECK(count == 2 * N_TXBUFFERS);
+    CHECK(MCP2515_sendMessageAfterCtrlCheck(&frames[0]) == ERROR_ALLTXBUSY);
+
+    bus_sent = 0;
+    while (MCP2515_SIM_transmitPending(sim)) {
+    }
+    CHECK(bus_sent == N_TXBUFFERS);
+    MCP2515_txCompleted(MCP2515_getInterrupts());
+
+    MCP2515_resetSpiTransactionCount();
+    CHECK(MCP2515_sendBatch(frames, N_TXBUFFERS) == N_TXBUFFERS);
+    count = MCP2515_getSpiTransactionCount();
+    printf("batched TX: %.2f transactions per frame\n", (double)count / N_TXBUFFERS);
+    CHECK(count == N_TXBUFFERS + 1);
+    while (MCP2515_SIM_transmitPending(sim)) {
+    }
+    // loaded from TXB2 down, the chip sends the highest buffer first at equal TXP
+    CHECK(bus_sent == 2 * N_TXBUFFERS && bus_last.can_id == 0x400 + N_TXBUFFERS - 1);
+    MCP2515_txCompleted(MCP2515_getInterrupts());
+    sim->auto_transmit = true;
+    MCP2515_SIM_setBusTxCallback(sim, NULL, NULL);
+    CHECK(MCP2515_auditShadow() == ERROR_OK);
+}
+
+int main(void)
+{
+    sim = MCP2515_SIM_create();
+    CHECK(MCP2515_init() == ERROR_OK);
+    MCP2515_setTransport(MCP2515_SIM_transport(sim));
+
+    test_loopback();
+    test_receive_buffers();
+    test_rx_cost();
+    test_drain_cost();
+    test_drain_drops();
+    test_rx_timestamps();
+    test_tx_cost();
+
+    MCP2515_SIM_destroy(sim);
+    return TEST_RESULT("sim");
+}
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "mcp2515_solver.h"
+#include "test_host.h"
+
+// Mask/filter solver: plans checked against the chip's acceptance rule, a brute-force sweep and the simulator
+
+#define SOLVER_MAX_CASE 200
+#define SOLVER_TIME_LIMIT_MS 1000.0
+
+static uint32_t rng_state = 3;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// the acceptance rule of the data sheet: a standard filter also compares EID15..0 with data bytes 0-1
+static bool chip_accepts(const MCP2515_FILTER_PLAN_t *plan, const canid_t can_id, const uint16_t data)
+{
+    for (int i = 0; i < 6; i++) {
+        const uint32_t mask = plan->mask[i < 2 ? 0 : 1];
+        if (can_id & CAN_EFF_FLAG) {
+            if (plan->filter_ext[i] && (((can_id & CAN_EFF_MASK) ^ plan->filter[i]) & mask) == 0) {
+                return true;
+            }
+        } else if (!plan->filter_ext[i] &&
+                   ((((can_id & CAN_SFF_MASK) ^ plan->filter[i]) << 18) & mask & 0x1FFC0000) == 0 &&
+                   (data & mask & 0xFFFF) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_wanted(const MCP2515_FILTER_ID_t ids[], const uint32_t count, const canid_t can_id)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i].wanted && ids[i].id == can_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// every wanted ID passes whatever its data, listed unwanted IDs stay out
+static void check_plan(const char *name, const MCP2515_FILTER_ID_t ids[], const uint32_t count,
+                       const MCP2515_FILTER_PLAN_t *plan)
+{
+    uint32_t missed = 0, leaked = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i].wanted) {
+            for (int d = 0; d < 4; d++) {
+                missed += !chip_accepts(plan, ids[i].id, rng());
+            }
+        } else if (plan->false_ids == 0) {
+            leaked += chip_accepts(plan, ids[i].id, 0);
+        }
+    }
+    printf("%s: RXM0=%08x RXM1=%08x, %u false IDs, %.1f false frames/s\n",
+           name, plan->mask[0], plan->mask[1], plan->false_ids, plan->false_rate);
+    CHECK(missed == 0);
+    CHECK(leaked == 0);
+}
+
+// standard-only plans: the reported false-accept count covers the whole 11-bit space
+static void sweep_plan(const MCP2515_FILTER_ID_t ids[], const uint32_t count, const MCP2515_FILTER_PLAN_t *plan)
+{
+    uint32_t false_ids = 0;
+    for (canid_t id = 0; id <= CAN_SFF_MASK; id++) {
+        false_ids += !is_wanted(ids, count, id) && chip_accepts(plan, id, 0x5A5A);
+    }
+    CHECK(false_ids == plan->false_ids);
+}
+
+static void test_small(void)
+{
+    MCP2515_FILTER_ID_t ids[16];
+    MCP2515_FILTER_PLAN_t plan;
+    uint32_t count = 0;
+
+    ids[count++] = (MCP2515_FILTER_ID_t){0x123, 10, true};
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    check_plan("one", ids, count, &plan);
+    sweep_plan(ids, count, &plan);
+    CHECK(plan.false_ids == 0);
+
+    // six IDs fit the six filters exactly
+    static const canid_t six[] = {0x100, 0x200, 0x300, 0x7FF, 0x001, 0x555};
+    count = 0;
+    for (int i = 0; i < 6; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){six[i], 1, true};
+    }
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    check_plan("six", ids, count, &plan);
+    sweep_plan(ids, count, &plan);
+    CHECK(plan.false_ids == 0);
+
+    // an aligned block shares one filter
+    count = 0;
+    for (int i = 0; i < 8; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){0x100 + i, 1, true};
+    }
+    ids[count++] = (MCP2515_FILTER_ID_t){0x200, 1, true};
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    check_plan("block", ids, count, &plan);
+    sweep_plan(ids, count, &plan);
+    CHECK(plan.false_ids == 0);
+
+    // listed heavy traffic steers the merge away from itself
+    count = 0;
+    ids[count++] = (MCP2515_FILTER_ID_t){0x10, 1, true};
+    ids[count++] = (MCP2515_FILTER_ID_t){0x11, 1, true};
+    for (int i = 0; i < 7; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){0x21 + i * 0x10, 1, true};
+    }
+    ids[count++] = (MCP2515_FILTER_ID_t){0x12, 1000, false};
+    CHECK(MCP2515_solveFilters(ids, count, 0.01f, &plan) == ERROR_OK);
+    check_plan("traffic", ids, count, &plan);
+    CHECK(!chip_accepts(&plan, 0x12, 0));
+
+    // wanted and unwanted at once
+    ids[count++] = (MCP2515_FILTER_ID_t){0x10, 1, false};
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_FAIL);
+    CHECK(MCP2515_solveFilters(ids, 0, 1, &plan) == ERROR_FAIL);
+}
+
+static void test_large(void)
+{
+    static MCP2515_FILTER_ID_t ids[SOLVER_MAX_CASE];
+    MCP2515_FILTER_PLAN_t plan;
+    uint32_t count = 0;
+
+    for (int i = 0; i < 150; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){rng() & CAN_SFF_MASK, (float)(rng() % 100), true};
+    }
+    double start = now_ms();
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    const double std_ms = now_ms() - start;
+    check_plan("150 std", ids, count, &plan);
+    sweep_plan(ids, count, &plan);
+
+    for (int i = 0; i < 40; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){(0x18FE0000 + (rng() & 0x3FF) * 0x10) | CAN_EFF_FLAG, 5, true};
+    }
+    start = now_ms();
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    const double mixed_ms = now_ms() - start;
+    check_plan("190 mixed", ids, count, &plan);
+    printf("solve time: 150 std %.1f ms, 190 mixed %.1f ms\n", std_ms, mixed_ms);
+    CHECK(mixed_ms < SOLVER_TIME_LIMIT_MS);
+}
+
+// the plan programmed through the config builder admits the same IDs on the simulated chip
+static void test_simulator(void)
+{
+    MCP2515_FILTER_ID_t ids[16];
+    MCP2515_FILTER_PLAN_t plan;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){0x100 + i, 10, true};
+    }
+    ids[count++] = (MCP2515_FILTER_ID_t){0x123, 100, true};
+    for (uint32_t i = 0; i < 4; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){(0x18FF1234 + i) | CAN_EFF_FLAG, 20, true};
+    }
+    ids[count++] = (MCP2515_FILTER_ID_t){0x456, 1000, false};
+    CHECK(MCP2515_solveFilters(ids, count, 1, &plan) == ERROR_OK);
+    check_plan("simulator", ids, count, &plan);
+
+    MCP2515_SIM sim = MCP2515_SIM_create();
+    CHECK(MCP2515_init() == ERROR_OK);
+    MCP2515_setTransport(MCP2515_SIM_transport(sim));
+    CHECK(MCP2515_reset() == ERROR_OK);
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    CHECK(MCP2515_configFilterPlan(config, &plan) == ERROR_OK);
+    CHECK(MCP2515_configApply(config) == ERROR_OK);
+
+    CAN_RING ring = CAN_RING_create(4);
+    CAN_FRAME_TS_t out[4];
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        CAN_FRAME_t frame = {.can_id = ids[i].id, .can_dlc = 2, .data = {0x12, 0x34}};
+        mismatches += MCP2515_SIM_inject(sim, &frame) != ids[i].wanted;
+        MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        CAN_RING_popBatch(ring, out, 4);
+    }
+    CHECK(mismatches == 0);
+
+    // the chip model and the simulator agree over the whole 11-bit space
+    for (canid_t id = 0; id <= CAN_SFF_MASK; id++) {
+        CAN_FRAME_t frame = {.can_id = id, .can_dlc = 2, .data = {0x12, 0x34}};
+        mismatches += MCP2515_SIM_inject(sim, &frame) != chip_accepts(&plan, id, 0x1234);
+        MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        CAN_RING_popBatch(ring, out, 4);
+    }
+    CHECK(mismatches == 0);
+
+    CAN_RING_destroy(ring);
+    MCP2515_SIM_destroy(sim);
+}
+
+int main(void)
+{
+    test_small();
+    test_large();
+    test_simulator();
+    return TEST_RESULT("solver");
+}
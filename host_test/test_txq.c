@@ -0,0 +1,233 @@
+#include <string.h>
+
+#include "host_stubs.h"
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "mcp2515_txq.h"
+#include "test_host.h"
+
+// Transmit queue: mailbox swaps, deadlines and their outcomes on the simulated chip
+
+static MCP2515_SIM sim;
+static MCP2515_TX_EVENT_t events[16];
+static uint32_t event_count;
+
+static void tx_done(const MCP2515_TX_EVENT_t *event)
+{
+    if (event_count < sizeof(events) / sizeof(events[0])) {
+        events[event_count] = *event;
+    }
+    event_count++;
+}
+
+static uint8_t *txb_ctrl(const int mb)
+{
+    return &sim->regs[MCP_TXB0CTRL + 0x10 * mb];
+}
+
+// frame loaded in mailbox mb, standard IDs only
+static canid_t txb_id(const int mb)
+{
+    const uint8_t *regs = &sim->regs[MCP_TXB0CTRL + 0x10 * mb];
+    return ((canid_t)regs[1] << 3) | (regs[2] >> 5);
+}
+
+// the frame in mailbox mb ends the way the chip ends it; the queue sees it on the next operation
+static void txb_end(const int mb, const uint8_t flags)
+{
+    sim->on_bus &= ~(1U << mb);
+    *txb_ctrl(mb) = (*txb_ctrl(mb) & ~TXB_TXREQ) | flags;
+}
+
+// three mailboxes busy with 0x300-0x302 on a bus that sends nothing by itself
+static MCP2515_TXQ txq_start(const CAN_SPEED_t speed, const int64_t deadline_us)
+{
+    MCP2515_SIM_reset(sim);
+    sim->auto_transmit = false;
+    sim->on_bus = 0;
+    CHECK(MCP2515_reset() == ERROR_OK);
+    CHECK(MCP2515_setBitrate(speed, MCP_8MHZ) == ERROR_OK);
+    CHECK(MCP2515_setNormalMode() == ERROR_OK);
+    MCP2515_TXQ txq = MCP2515_TXQ_create(16);
+    CHECK(txq != NULL);
+    CHECK(MCP2515_setTxQueue(txq) == NULL);
+    event_count = 0;
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        CAN_FRAME_t frame = {.can_id = 0x300 + i, .can_dlc = 1};
+        CHECK(MCP2515_TXQ_submitDeadline(txq, &frame, deadline_us, 0, tx_done, NULL) != 0);
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        CHECK(*txb_ctrl(i) & TXB_TXREQ);
+        CHECK(txb_id(i) == (canid_t)(0x300 + i));
+    }
+    return txq;
+}
+
+static void txq_stop(MCP2515_TXQ txq)
+{
+    CHECK(MCP2515_setTxQueue(NULL) == txq);
+    MCP2515_TXQ_destroy(txq);
+}
+
+// the timer only wakes the queue's task, which then does the work
+static bool txq_timer(MCP2515_TXQ txq)
+{
+    const uint32_t transfers = sim->transfers;
+    const uint32_t notified = HOST_taskNotifications(txq->task);
+    if (HOST_runTimers() != 1) {
+        return false;
+    }
+    CHECK(sim->transfers == transfers);
+    CHECK(HOST_taskNotifications(txq->task) == notified + 1);
+    MCP2515_TXQ_expire(txq);
+    return true;
+}
+
+// a frame the chip gave up on in one-shot mode is a failure, not a late swap
+static void test_swap_one_shot(void)
+{
+    MCP2515_TXQ txq = txq_start(CAN_500KBPS, 0);
+    txb_end(2, TXB_MLOA);
+    CAN_FRAME_t urgent = {.can_id = 0x100, .can_dlc = 1};
+    CHECK(MCP2515_TXQ_submitAsync(txq, &urgent, 0, tx_done, NULL) != 0);
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    CHECK(stats.swaps == 0 && stats.swap_late == 0 && stats.sent == 0 && stats.failed == 1);
+    CHECK(event_count == 1 && events[0].can_id == 0x302 && events[0].result == MCP2515_TX_LOST_ARBITRATION);
+    CHECK(txb_id(2) == 0x100 && (*txb_ctrl(2) & TXB_TXREQ));
+    txq_stop(txq);
+}
+
+// a swap still on the bus when the wait runs out is picked up again once the frame ends
+static void test_swap_pending(void)
+{
+    MCP2515_TXQ txq = txq_start(CAN_500KBPS, 0);
+    sim->on_bus = 1U << 2;
+    CAN_FRAME_t urgent = {.can_id = 0x100, .can_dlc = 1};
+    CHECK(MCP2515_TXQ_submitAsync(txq, &urgent, 0, tx_done, NULL) != 0);
+    CHECK(txq->aborting == (1U << 2));
+    CHECK(txb_id(2) == 0x302);
+
+    // lost arbitration after the TXREQ clear: ABTF, and no TXnIF to service
+    txb_end(2, TXB_ABTF);
+    HOST_advanceTime(MCP2515_TXQ_ABORT_WAIT_US);
+    CHECK(txq_timer(txq));
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    CHECK(txq->aborting == 0);
+    CHECK(stats.swaps == 1 && stats.swap_late == 0 && stats.queued == 1);
+    CHECK(event_count == 0);
+    CHECK(txb_id(2) == 0x100 && (*txb_ctrl(2) & TXB_TXREQ));
+
+    // the swapped frame follows once a mailbox frees up
+    CHECK(MCP2515_SIM_transmitPending(sim));
+    MCP2515_txCompleted(MCP2515_getInterrupts());
+    CHECK(event_count == 1 && events[0].can_id == 0x100 && events[0].result == MCP2515_TX_DONE);
+    MCP2515_TXQ_getStats(txq, &stats);
+    CHECK(stats.queued == 0 && MCP2515_TXQ_pending(txq) == 3);
+    txq_stop(txq);
+}
+
+// expiries still on the bus in every mailbox, e.g. retrying against a busy bus, must not stall the queue
+static void test_expire_pending(void)
+{
+    const int64_t deadline_us = esp_timer_get_time() + 10000;
+    MCP2515_TXQ txq = txq_start(CAN_1000KBPS, deadline_us);
+    CHECK(MCP2515_Object->bitrate == 1000000);
+    CAN_FRAME_t fresh = {.can_id = 0x400, .can_dlc = 1};
+    CHECK(MCP2515_TXQ_submitAsync(txq, &fresh, 0, tx_done, NULL) != 0);
+    sim->on_bus = (1U << N_TXBUFFERS) - 1;
+
+    HOST_advanceTime(10000);
+    CHECK(txq_timer(txq));
+    CHECK(txq->expiring == (1U << N_TXBUFFERS) - 1);
+    CHECK(event_count == 0);
+
+    // one frame at 1 Mbit/s is 160 us, the re-poll comes after that and not before
+    HOST_advanceTime(100);
+    CHECK(HOST_runTimers() == 0);
+    txb_end(0, TXB_ABTF);
+    txb_end(1, TXB_ABTF);
+    HOST_advanceTime(100);
+    CHECK(txq_timer(txq));
+    CHECK(txq->expiring == (1U << 2));
+    CHECK(event_count == 2 && events[0].result == MCP2515_TX_EXPIRED && events[1].result == MCP2515_TX_EXPIRED);
+    CHECK(txb_id(0) == 0x400 && (*txb_ctrl(0) & TXB_TXREQ));
+
+    // the last one made it onto the bus after all: sent late, reported by TXnIF service
+    txb_end(2, 0);
+    sim->regs[MCP_CANINTF] |= CANINTF_TX2IF;
+    MCP2515_txCompleted(MCP2515_getInterrupts());
+    CHECK(txq->expiring == 0);
+    CHECK(event_count == 3 && events[2].can_id == 0x302 && events[2].result == MCP2515_TX_DONE);
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    CHECK(stats.expired == 2 && stats.late == 1 && stats.misses[0].count == 1);
+    // nothing pending any more, the timer is off
+    HOST_advanceTime(1000000);
+    CHECK(HOST_runTimers() == 0);
+    txq_stop(txq);
+}
+
+// a queue that is not installed keeps its frames, and its deadlines, away from the mailboxes
+static void test_two_queues(void)
+{
+    MCP2515_TXQ app = txq_start(CAN_500KBPS, 0);
+    MCP2515_TXQ test = MCP2515_TXQ_create(16);
+    CHECK(test != NULL);
+
+    // the app's loaded frames go back into its heap
+    CHECK(MCP2515_setTxQueue(test) == app);
+    CHECK(MCP2515_TXQ_pending(app) == 3);
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        CHECK(app->mailbox[i] == MCP2515_TXQ_NONE);
+        CHECK(!(*txb_ctrl(i) & TXB_TXREQ));
+    }
+    CHECK(event_count == 0);
+
+    CAN_FRAME_t frame = {.can_id = 0x500, .can_dlc = 1};
+    CHECK(MCP2515_TXQ_submitAsync(test, &frame, 0, tx_done, NULL) != 0);
+    CHECK(txb_id(0) == 0x500 && (*txb_ctrl(0) & TXB_TXREQ));
+
+    // the app keeps submitting; its frame expires in the heap and never touches TXB0
+    frame.can_id = 0x050;
+    CHECK(MCP2515_TXQ_submitDeadline(app, &frame, esp_timer_get_time() + 1000, 0, tx_done, NULL) != 0);
+    CHECK(txb_id(0) == 0x500 && (*txb_ctrl(0) & TXB_TXREQ));
+    HOST_advanceTime(1000);
+    CHECK(txq_timer(app));
+    CHECK(event_count == 1 && events[0].can_id == 0x050 && events[0].result == MCP2515_TX_EXPIRED);
+    CHECK(txb_id(0) == 0x500 && (*txb_ctrl(0) & TXB_TXREQ));
+
+    // the test queue's completion is its own
+    CHECK(MCP2515_SIM_transmitPending(sim));
+    MCP2515_txCompleted(MCP2515_getInterrupts());
+    CHECK(event_count == 2 && events[1].can_id == 0x500 && events[1].result == MCP2515_TX_DONE);
+    CHECK(MCP2515_TXQ_pending(test) == 0);
+
+    // back to the app, which picks up where it was
+    CHECK(MCP2515_setTxQueue(app) == test);
+    MCP2515_TXQ_destroy(test);
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        CHECK(txb_id(i) == (canid_t)(0x300 + i) && (*txb_ctrl(i) & TXB_TXREQ));
+    }
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(app, &stats);
+    CHECK(stats.swaps == 3 && stats.sent == 0 && stats.expired == 1);
+    txq_stop(app);
+}
+
+int main(void)
+{
+    sim = MCP2515_SIM_create();
+    CHECK(MCP2515_init() == ERROR_OK);
+    MCP2515_setTransport(MCP2515_SIM_transport(sim));
+    test_swap_one_shot();
+    test_swap_pending();
+    test_expire_pending();
+    test_two_queues();
+    MCP2515_SIM_destroy(sim);
+    return TEST_RESULT("txq");
+}
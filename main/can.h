@@ -42,4 +42,22 @@ typedef struct can_frame {
     __u8    data[CAN_MAX_DLEN] __attribute__((aligned(8)));
 } CAN_FRAME_t, *CAN_FRAME;
 
+/* where the receive timestamp of a frame was taken, most precise first */
+typedef enum {
+    CAN_TS_NONE = 0,
+    CAN_TS_SOF,  /* start-of-frame pulse on the MCP2515 SOF pin */
+    CAN_TS_INT,  /* INT assertion: end of frame plus ISR entry */
+    CAN_TS_READ, /* read out behind another frame in the same service pass */
+} can_ts_source_t;
+
+#define CAN_FILHIT_UNKNOWN 0xFF
+
+/* received frame with its timestamp and the filter that accepted it */
+typedef struct can_frame_ts {
+    CAN_FRAME_t frame;
+    int64_t timestamp_us; /* microseconds since boot (esp_timer) */
+    __u8    ts_source;    /* can_ts_source_t */
+    __u8    filhit;       /* acceptance filter RXF0..RXF5 that matched, CAN_FILHIT_UNKNOWN if not known */
+} CAN_FRAME_TS_t, *CAN_FRAME_TS;
+
 #endif /* CAN_H_ */
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "can_bcm.h"
+
+#define TAG_CAN_BCM "CAN_BCM"
+
+static void CAN_BCM_insert(CAN_BCM bcm, const CAN_BCM_MSG_ID id)
+{
+    CAN_BCM_MSG_t *msg = &bcm->msgs[id];
+    uint16_t *slot;
+    if (msg->expire - bcm->next_tick < CAN_BCM_WHEEL_L0) {
+        slot = &bcm->wheel0[msg->expire % CAN_BCM_WHEEL_L0];
+    } else {
+        slot = &bcm->wheel1[(msg->expire / CAN_BCM_WHEEL_L0) % CAN_BCM_WHEEL_L1];
+    }
+    msg->next = *slot;
+    *slot = id;
+}
+
+static void CAN_BCM_txDone(const MCP2515_TX_EVENT_t *event)
+{
+    CAN_BCM_MSG_t *msg = (CAN_BCM_MSG_t *)event->user;
+    if (event->result == MCP2515_TX_DONE) {
+        const uint32_t latency_us = (uint32_t)(event->done_us - msg->due_us);
+        if (msg->stats.sent == 0 || latency_us < msg->stats.min_latency_us) {
+            msg->stats.min_latency_us = latency_us;
+        }
+        if (latency_us > msg->stats.max_latency_us) {
+            msg->stats.max_latency_us = latency_us;
+        }
+        msg->stats.sent++;
+    } else if (event->result == MCP2515_TX_EXPIRED) {
+        msg->stats.expired++;
+    } else {
+        msg->stats.failed++;
+    }
+    atomic_store_explicit(&msg->in_flight, false, memory_order_release);
+}
+
+// copy the payload, retrying while CAN_BCM_setData() is writing it
+static void CAN_BCM_snapshot(CAN_BCM_MSG_t *msg, CAN_FRAME frame)
+{
+    uint32_t seq;
+    do {
+        seq = atomic_load_explicit(&msg->data_seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        *frame = msg->frame;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&msg->data_seq, memory_order_relaxed) != seq);
+}
+
+static void CAN_BCM_fire(CAN_BCM bcm, const CAN_BCM_MSG_ID id, const int64_t due_us)
+{
+    CAN_BCM_MSG_t *msg = &bcm->msgs[id];
+    if (atomic_load_explicit(&msg->in_flight, memory_order_acquire)) {
+        // the previous instance missed its deadline, sending another would only queue behind it
+        msg->stats.overruns++;
+        return;
+    }
+    CAN_FRAME_t frame;
+    CAN_BCM_snapshot(msg, &frame);
+    if (msg->update != NULL) {
+        msg->update(msg->arg, &frame);
+    }
+    msg->due_us = due_us;
+    atomic_store_explicit(&msg->in_flight, true, memory_order_relaxed);
+    // stale by the next instance: expire half a tick before it so the next one finds the slot free
+    const int64_t deadline_us = due_us + (int64_t)msg->period * bcm->tick_us - bcm->tick_us / 2;
+    // never wait here, every other message due in this tick would slip as well
+    if (MCP2515_TXQ_submitDeadline(bcm->txq, &frame, deadline_us, 0, CAN_BCM_txDone, msg) == 0) {
+        atomic_store_explicit(&msg->in_flight, false, memory_order_relaxed);
+        msg->stats.refused++;
+    }
+}
+
+static void CAN_BCM_tick(CAN_BCM bcm, const uint32_t tick)
+{
+    // the first level wrapped: bring the next 256 ticks down from the second level
+    if (tick % CAN_BCM_WHEEL_L0 == 0) {
+        uint16_t *slot = &bcm->wheel1[(tick / CAN_BCM_WHEEL_L0) % CAN_BCM_WHEEL_L1];
+        uint16_t id = *slot;
+        *slot = CAN_BCM_NONE;
+        while (id != CAN_BCM_NONE) {
+            const uint16_t next = bcm->msgs[id].next;
+            CAN_BCM_insert(bcm, id);
+            id = next;
+        }
+    }
+
+    uint16_t *slot = &bcm->wheel0[tick % CAN_BCM_WHEEL_L0];
+    uint16_t id = *slot;
+    *slot = CAN_BCM_NONE;
+    bcm->next_tick = tick + 1;
+    const int64_t due_us = bcm->start_us + (int64_t)tick * bcm->tick_us;
+    while (id != CAN_BCM_NONE) {
+        CAN_BCM_MSG_t *msg = &bcm->msgs[id];
+        const uint16_t next = msg->next;
+        CAN_BCM_fire(bcm, id, due_us);
+        // the next due time follows the schedule, not the moment this one was sent
+        msg->expire = tick + msg->period;
+        CAN_BCM_insert(bcm, id);
+        id = next;
+    }
+    bcm->stats.ticks++;
+}
+
+static void CAN_BCM_timer(void *arg)
+{
+    CAN_BCM bcm = (CAN_BCM)arg;
+    xTaskNotifyGive(bcm->task);
+}
+
+static void CAN_BCM_task(void *arg)
+{
+    CAN_BCM bcm = (CAN_BCM)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        CAN_BCM_poll(bcm, esp_timer_get_time());
+    }
+}
+
+CAN_BCM CAN_BCM_create(const CAN_BCM_CONFIG_t *config)
+{
+    if (config->txq == NULL || config->max_msgs == 0 || config->max_msgs >= CAN_BCM_NONE
+        || config->tick_us == 0) {
+        return NULL;
+    }
+    CAN_BCM bcm = (CAN_BCM)calloc(1, sizeof(CAN_BCM_t));
+    if (bcm == NULL) {
+        ESP_LOGE(TAG_CAN_BCM, "Couldn't allocate the broadcast manager. (NULL pointer)");
+        return NULL;
+    }
+    bcm->msgs = (CAN_BCM_MSG_t *)calloc(config->max_msgs, sizeof(CAN_BCM_MSG_t));
+    if (bcm->msgs == NULL) {
+        ESP_LOGE(TAG_CAN_BCM, "Couldn't allocate %lu messages. (NULL pointer)", (unsigned long)config->max_msgs);
+        free(bcm);
+        return NULL;
+    }
+    bcm->capacity = config->max_msgs;
+    bcm->txq = config->txq;
+    bcm->tick_us = config->tick_us;
+    bcm->priority = config->priority;
+    bcm->core = config->core;
+    bcm->stack_size = config->stack_size;
+    for (int i = 0; i < CAN_BCM_WHEEL_L0; i++) {
+        bcm->wheel0[i] = CAN_BCM_NONE;
+    }
+    for (int i = 0; i < CAN_BCM_WHEEL_L1; i++) {
+        bcm->wheel1[i] = CAN_BCM_NONE;
+    }
+    bcm->stats.worst_msg = CAN_BCM_NONE;
+    return bcm;
+}
+
+void CAN_BCM_stop(CAN_BCM bcm)
+{
+    if (bcm->timer != NULL) {
+        esp_timer_stop(bcm->timer);
+        esp_timer_delete(bcm->timer);
+        bcm->timer = NULL;
+    }
+    if (bcm->task != NULL) {
+        // not in the middle of a submission: that holds the driver session
+        const bool locked = (MCP2515_beginSession() == ERROR_OK);
+        vTaskDelete(bcm->task);
+        bcm->task = NULL;
+        if (locked) {
+            MCP2515_endSession();
+        }
+    }
+}
+
+void CAN_BCM_destroy(CAN_BCM bcm)
+{
+    if (bcm == NULL) {
+        return;
+    }
+    CAN_BCM_stop(bcm);
+    free(bcm->msgs);
+    free(bcm);
+}
+
+CAN_BCM_MSG_ID CAN_BCM_add(CAN_BCM bcm, const CAN_FRAME frame, const uint32_t period_us, const uint32_t phase_us,
+                           CAN_BCM_UPDATE update, void *arg)
+{
+    uint32_t period = (period_us + bcm->tick_us / 2) / bcm->tick_us;
+    const uint32_t phase = (phase_us + bcm->tick_us / 2) / bcm->tick_us;
+    if (period == 0) {
+        period = 1;
+    }
+    if (bcm->started || bcm->count == bcm->capacity || frame->can_dlc > CAN_MAX_DLEN
+        || period > CAN_BCM_MAX_TICKS || phase > CAN_BCM_MAX_TICKS) {
+        return CAN_BCM_NONE;
+    }
+    const CAN_BCM_MSG_ID id = (CAN_BCM_MSG_ID)bcm->count++;
+    CAN_BCM_MSG_t *msg = &bcm->msgs[id];
+    msg->frame = *frame;
+    atomic_init(&msg->data_seq, 0);
+    atomic_init(&msg->in_flight, false);
+    msg->update = update;
+    msg->arg = arg;
+    msg->period = period;
+    msg->expire = phase;
+    CAN_BCM_insert(bcm, id);
+    return id;
+}
+
+void CAN_BCM_setData(CAN_BCM bcm, const CAN_BCM_MSG_ID id, const uint8_t *data, const uint8_t dlc)
+{
+    if (id >= bcm->count || dlc > CAN_MAX_DLEN) {
+        return;
+    }
+    CAN_BCM_MSG_t *msg = &bcm->msgs[id];
+    const uint32_t seq = atomic_load_explicit(&msg->data_seq, memory_order_relaxed);
+    atomic_store_explicit(&msg->data_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    msg->frame.can_dlc = dlc;
+    memcpy(msg->frame.data, data, dlc);
+    atomic_store_explicit(&msg->data_seq, seq + 2, memory_order_release);
+}
+
+esp_err_t CAN_BCM_start(CAN_BCM bcm)
+{
+    if (bcm->task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreatePinnedToCore(CAN_BCM_task, "can_bcm", bcm->stack_size, bcm,
+                                bcm->priority, &bcm->task, bcm->core) != pdPASS) {
+        ESP_LOGE(TAG_CAN_BCM, "Couldn't start the scheduler task.");
+        bcm->task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    const esp_timer_create_args_t timer_args = {
+        .callback = CAN_BCM_timer,
+        .arg = bcm,
+        .name = "can_bcm",
+        // a tick the timer task could not deliver is caught up by the next pass anyway
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&timer_args, &bcm->timer) != ESP_OK) {
+        ESP_LOGE(TAG_CAN_BCM, "Couldn't create the tick timer.");
+        bcm->timer = NULL;
+        // not notified yet, the task is still waiting for its first tick
+        vTaskDelete(bcm->task);
+        bcm->task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    bcm->start_us = esp_timer_get_time();
+    bcm->started = true;
+    const esp_err_t err = esp_timer_start_periodic(bcm->timer, bcm->tick_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CAN_BCM, "Couldn't start the tick timer: %s", esp_err_to_name(err));
+        CAN_BCM_stop(bcm);
+        bcm->started = false;
+        return err;
+    }
+    // tick 0 is due right away
+    xTaskNotifyGive(bcm->task);
+    return ESP_OK;
+}
+
+void CAN_BCM_poll(CAN_BCM bcm, const int64_t now_us)
+{
+    if (!bcm->started) {
+        bcm->start_us = now_us;
+        bcm->started = true;
+    }
+    if (now_us < bcm->start_us) {
+        return;
+    }
+    const uint32_t last = (uint32_t)((now_us - bcm->start_us) / bcm->tick_us);
+    if (last < bcm->next_tick) {
+        return;
+    }
+    const uint32_t lag_us = (uint32_t)(now_us - (bcm->start_us + (int64_t)last * bcm->tick_us));
+    if (lag_us > bcm->stats.max_lag_us) {
+        bcm->stats.max_lag_us = lag_us;
+    }
+    bcm->stats.wakeups++;
+    if (last > bcm->next_tick) {
+        bcm->stats.catch_up++;
+    }
+    while (bcm->next_tick <= last) {
+        CAN_BCM_tick(bcm, bcm->next_tick);
+    }
+}
+
+void CAN_BCM_getStats(CAN_BCM bcm, CAN_BCM_STATS_t *stats)
+{
+    *stats = bcm->stats;
+    stats->msgs = bcm->count;
+    stats->sent = 0;
+    stats->failed = 0;
+    stats->expired = 0;
+    stats->overruns = 0;
+    stats->refused = 0;
+    stats->max_jitter_us = 0;
+    stats->worst_msg = CAN_BCM_NONE;
+    for (uint32_t i = 0; i < bcm->count; i++) {
+        const CAN_BCM_MSG_STATS_t *msg = &bcm->msgs[i].stats;
+        stats->sent += msg->sent;
+        stats->failed += msg->failed;
+        stats->expired += msg->expired;
+        stats->overruns += msg->overruns;
+        stats->refused += msg->refused;
+        const uint32_t jitter_us = (msg->sent > 0) ? msg->max_latency_us - msg->min_latency_us : 0;
+        if (stats->worst_msg == CAN_BCM_NONE || jitter_us > stats->max_jitter_us) {
+            stats->max_jitter_us = jitter_us;
+            stats->worst_msg = (CAN_BCM_MSG_ID)i;
+        }
+    }
+}
+
+void CAN_BCM_getMsgStats(CAN_BCM bcm, const CAN_BCM_MSG_ID id, CAN_BCM_MSG_STATS_t *stats)
+{
+    if (id >= bcm->count) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = bcm->msgs[id].stats;
+}
+
+void CAN_BCM_logStats(CAN_BCM bcm, const char *tag)
+{
+    CAN_BCM_STATS_t stats;
+    CAN_BCM_getStats(bcm, &stats);
+    ESP_LOGI(tag, "BCM: %lu messages, %lu sent, %lu failed, %lu expired, %lu overruns, %lu refused",
+             (unsigned long)stats.msgs, (unsigned long)stats.sent, (unsigned long)stats.failed,
+             (unsigned long)stats.expired, (unsigned long)stats.overruns, (unsigned long)stats.refused);
+    ESP_LOGI(tag, "BCM scheduler: %lu ticks in %lu passes (%lu catching up), worst lag %lu us",
+             (unsigned long)stats.ticks, (unsigned long)stats.wakeups, (unsigned long)stats.catch_up,
+             (unsigned long)stats.max_lag_us);
+    if (stats.worst_msg != CAN_BCM_NONE) {
+        const CAN_BCM_MSG_t *msg = &bcm->msgs[stats.worst_msg];
+        ESP_LOGI(tag, "BCM worst jitter %lu us: ID 0x%08lX every %lu ticks, latency %lu..%lu us",
+                 (unsigned long)stats.max_jitter_us, (unsigned long)msg->frame.can_id,
+                 (unsigned long)msg->period, (unsigned long)msg->stats.min_latency_us,
+                 (unsigned long)msg->stats.max_latency_us);
+    }
+}
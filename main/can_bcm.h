@@ -0,0 +1,161 @@
+#ifndef _CAN_BCM_H_
+#define _CAN_BCM_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "can.h"
+#include "mcp2515_txq.h"
+
+/*
+ * Broadcast manager: sends registered frames cyclically through a TX queue.
+ * Each message has a period and a phase offset in scheduler ticks. Due times
+ * are kept in a two-level hierarchical timer wheel: 256 one-tick slots, then
+ * 64 slots of 256 ticks that are cascaded down as the first level wraps. Each
+ * tick costs O(frames due) however many messages are registered.
+ *
+ * An esp_timer wakes the scheduler task once per tick. The task works through
+ * every tick that has come due since the last pass, so a late wakeup delays
+ * frames but does not shift later due times. Due times are counted from
+ * CAN_BCM_start(), so periods do not drift.
+ *
+ * Each frame is submitted with a deadline half a tick before the next
+ * instance is due. A frame the bus could not take by then expires in the TX
+ * queue (dropped or its mailbox aborted), so a stale frame never queues
+ * behind a fresh one. If the previous frame is somehow still queued when its
+ * message comes due again, that instance is skipped and counted as an
+ * overrun. Latency is measured from the due time to the TX completion.
+ * Jitter is the spread of that latency.
+ *
+ * CAN_BCM_setData() changes a payload without locking. It uses a sequence
+ * counter per message: the scheduler retries its copy if a write was in
+ * progress. Each message must have a single writer. The optional update
+ * callback runs in the scheduler task on the copy just before it is queued,
+ * e.g. for counters and checksums.
+ *
+ * Messages are registered before CAN_BCM_start().
+ */
+
+#define CAN_BCM_WHEEL_L0 256
+#define CAN_BCM_WHEEL_L1 64
+// longest period or phase, in ticks: a message must fit in the second level
+#define CAN_BCM_MAX_TICKS ((CAN_BCM_WHEEL_L1 - 1) * CAN_BCM_WHEEL_L0)
+#define CAN_BCM_NONE 0xFFFF
+
+typedef uint16_t CAN_BCM_MSG_ID;
+
+typedef void (*CAN_BCM_UPDATE)(void *arg, CAN_FRAME frame);
+
+typedef struct CAN_BCM_CONFIG_s {
+	MCP2515_TXQ txq;            // queue the frames are submitted to
+	uint32_t max_msgs;          // below CAN_BCM_NONE
+	uint32_t tick_us;           // scheduler resolution
+	UBaseType_t priority;       // scheduler task
+	BaseType_t core;
+	uint32_t stack_size;
+} CAN_BCM_CONFIG_t;
+
+#define CAN_BCM_DEFAULT_CONFIG(queue, msgs) { \
+	.txq = (queue),                           \
+	.max_msgs = (msgs),                       \
+	.tick_us = 1000,                          \
+	.priority = tskIDLE_PRIORITY + 6,         \
+	.core = tskNO_AFFINITY,                   \
+	.stack_size = 4096,                       \
+}
+
+typedef struct CAN_BCM_MSG_STATS_s {
+	uint32_t sent;
+	uint32_t failed;            // completions other than MCP2515_TX_DONE and MCP2515_TX_EXPIRED
+	uint32_t expired;           // not sent before the next instance was due
+	uint32_t overruns;          // instances skipped, the previous frame was still queued
+	uint32_t refused;           // instances the TX queue had no room for
+	uint32_t min_latency_us;    // due time to completion
+	uint32_t max_latency_us;
+} CAN_BCM_MSG_STATS_t;
+
+typedef struct CAN_BCM_STATS_s {
+	uint32_t msgs;
+	uint32_t ticks;             // ticks processed
+	uint32_t wakeups;           // scheduler passes that had at least one tick due
+	uint32_t catch_up;          // passes that had to process more than one tick
+	uint32_t max_lag_us;        // worst delay of a pass behind its latest due tick
+	uint32_t sent;
+	uint32_t failed;
+	uint32_t expired;
+	uint32_t overruns;
+	uint32_t refused;
+	uint32_t max_jitter_us;     // worst max - min latency of any message
+	CAN_BCM_MSG_ID worst_msg;   // the message with that jitter
+} CAN_BCM_STATS_t;
+
+typedef struct CAN_BCM_MSG_s {
+	CAN_FRAME_t frame;          // ID and initial payload; the payload is guarded by data_seq
+	_Atomic uint32_t data_seq;  // odd while CAN_BCM_setData() is writing
+	CAN_BCM_UPDATE update;
+	void *arg;
+	uint32_t period;            // in ticks
+	uint32_t expire;            // tick of the next instance
+	uint16_t next;              // wheel slot chain
+	_Atomic bool in_flight;     // set by the scheduler, cleared by the TX completion
+	int64_t due_us;             // due time of the instance in flight
+	CAN_BCM_MSG_STATS_t stats;
+} CAN_BCM_MSG_t;
+
+typedef struct CAN_BCM_s {
+	CAN_BCM_MSG_t *msgs;
+	uint32_t count;
+	uint32_t capacity;
+	MCP2515_TXQ txq;
+	uint32_t tick_us;
+
+	uint16_t wheel0[CAN_BCM_WHEEL_L0];  // message chains by expire tick
+	uint16_t wheel1[CAN_BCM_WHEEL_L1];  // message chains by expire tick / 256
+	uint32_t next_tick;                 // first tick not processed yet
+	int64_t start_us;                   // due time of tick 0
+	bool started;
+
+	esp_timer_handle_t timer;
+	TaskHandle_t task;
+	UBaseType_t priority;
+	BaseType_t core;
+	uint32_t stack_size;
+
+	CAN_BCM_STATS_t stats;
+} CAN_BCM_t[1], *CAN_BCM;
+
+// returns NULL without a TX queue or when out of memory
+CAN_BCM CAN_BCM_create(const CAN_BCM_CONFIG_t *config);
+// the completions of queued frames still refer to the messages: wait for the TX queue to drain after stop
+void CAN_BCM_destroy(CAN_BCM bcm);
+
+/*
+ * Register frame to be sent every period_us, first phase_us after start. Both
+ * are rounded to ticks, the period to at least one. Returns CAN_BCM_NONE when
+ * the table is full, the scheduler runs or a time exceeds CAN_BCM_MAX_TICKS.
+ */
+CAN_BCM_MSG_ID CAN_BCM_add(CAN_BCM bcm, const CAN_FRAME frame, const uint32_t period_us, const uint32_t phase_us,
+                           CAN_BCM_UPDATE update, void *arg);
+// lock-free payload change, one writer per message
+void CAN_BCM_setData(CAN_BCM bcm, const CAN_BCM_MSG_ID id, const uint8_t *data, const uint8_t dlc);
+
+// starts the tick timer and the scheduler task
+esp_err_t CAN_BCM_start(CAN_BCM bcm);
+// no more frames are queued once it returns, statistics stay readable
+void CAN_BCM_stop(CAN_BCM bcm);
+/*
+ * One scheduler pass: queue every instance due by now_us. The scheduler task
+ * calls it on every tick; without CAN_BCM_start() a caller may drive the wheel
+ * itself, the first pass sets the time origin. now_us is on the esp_timer
+ * clock, latencies and TX deadlines are measured against it.
+ */
+void CAN_BCM_poll(CAN_BCM bcm, const int64_t now_us);
+
+void CAN_BCM_getStats(CAN_BCM bcm, CAN_BCM_STATS_t *stats);
+void CAN_BCM_getMsgStats(CAN_BCM bcm, const CAN_BCM_MSG_ID id, CAN_BCM_MSG_STATS_t *stats);
+void CAN_BCM_logStats(CAN_BCM bcm, const char *tag);
+
+#endif
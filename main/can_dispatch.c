@@ -0,0 +1,200 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "can_dispatch.h"
+
+#define TAG_CAN_DISPATCH "CAN_DISPATCH"
+
+// 2^32 / golden ratio, spreads consecutive IDs over the whole table
+#define CAN_DISPATCH_HASH_MULT 2654435769U
+
+typedef struct CAN_DISPATCH_JOB_s {
+	CAN_DISPATCH_HANDLER handler;
+	void *arg;
+	CAN_FRAME_TS_t rx;
+} CAN_DISPATCH_JOB_t;
+
+static inline canid_t CAN_DISPATCH_key(const canid_t id)
+{
+    return (id & CAN_EFF_FLAG) ? (id & (CAN_EFF_FLAG | CAN_EFF_MASK)) : (id & CAN_SFF_MASK);
+}
+
+static inline uint32_t CAN_DISPATCH_hash(const CAN_DISPATCH dispatch, const canid_t key)
+{
+    return (uint32_t)(key * CAN_DISPATCH_HASH_MULT) >> dispatch->id_shift;
+}
+
+static void CAN_DISPATCH_worker(void *arg)
+{
+    CAN_DISPATCH dispatch = (CAN_DISPATCH)arg;
+    CAN_DISPATCH_JOB_t job;
+    while (1) {
+        if (xQueueReceive(dispatch->queue, &job, portMAX_DELAY) == pdTRUE) {
+            job.handler(job.arg, &job.rx);
+        }
+    }
+}
+
+CAN_DISPATCH CAN_DISPATCH_create(const CAN_DISPATCH_CONFIG_t *config)
+{
+    CAN_DISPATCH dispatch = (CAN_DISPATCH)calloc(1, sizeof(CAN_DISPATCH_t));
+    if (dispatch == NULL) {
+        ESP_LOGE(TAG_CAN_DISPATCH, "Couldn't allocate the dispatch table. (NULL pointer)");
+        return NULL;
+    }
+
+    // at most half full, so an unsuccessful lookup ends after a probe or two
+    uint32_t size = 8;
+    uint8_t bits = 3;
+    while (size < 2 * config->max_ids) {
+        size <<= 1;
+        bits++;
+    }
+    dispatch->ids = (CAN_DISPATCH_SLOT_t *)malloc(size * sizeof(CAN_DISPATCH_SLOT_t));
+    if (dispatch->ids == NULL) {
+        ESP_LOGE(TAG_CAN_DISPATCH, "Couldn't allocate %lu ID slots. (NULL pointer)", (unsigned long)size);
+        free(dispatch);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        dispatch->ids[i].key = CAN_DISPATCH_KEY_EMPTY;
+    }
+    dispatch->id_mask = size - 1;
+    dispatch->id_shift = 32 - bits;
+    dispatch->id_capacity = config->max_ids;
+
+    if (config->queue_len > 0) {
+        dispatch->queue = xQueueCreate(config->queue_len, sizeof(CAN_DISPATCH_JOB_t));
+        if (dispatch->queue == NULL) {
+            ESP_LOGE(TAG_CAN_DISPATCH, "Couldn't create the deferred queue.");
+            CAN_DISPATCH_destroy(dispatch);
+            return NULL;
+        }
+        if (xTaskCreatePinnedToCore(CAN_DISPATCH_worker, "can_dispatch", config->stack_size, dispatch,
+                                    config->priority, &dispatch->worker, config->core) != pdPASS) {
+            ESP_LOGE(TAG_CAN_DISPATCH, "Couldn't start the worker task.");
+            dispatch->worker = NULL;
+            CAN_DISPATCH_destroy(dispatch);
+            return NULL;
+        }
+    }
+    return dispatch;
+}
+
+void CAN_DISPATCH_destroy(CAN_DISPATCH dispatch)
+{
+    if (dispatch == NULL) {
+        return;
+    }
+    if (dispatch->worker != NULL) {
+        vTaskDelete(dispatch->worker);
+    }
+    if (dispatch->queue != NULL) {
+        vQueueDelete(dispatch->queue);
+    }
+    free(dispatch->ids);
+    free(dispatch);
+}
+
+static bool CAN_DISPATCH_entry(const CAN_DISPATCH dispatch, CAN_DISPATCH_ENTRY_t *entry, const CAN_DISPATCH_MODE_t mode,
+                               CAN_DISPATCH_HANDLER handler, void *arg)
+{
+    if (handler == NULL || (mode == CAN_DISPATCH_DEFERRED && dispatch->queue == NULL)) {
+        return false;
+    }
+    entry->handler = handler;
+    entry->arg = arg;
+    entry->mode = mode;
+    return true;
+}
+
+bool CAN_DISPATCH_onId(CAN_DISPATCH dispatch, const canid_t id, const CAN_DISPATCH_MODE_t mode,
+                       CAN_DISPATCH_HANDLER handler, void *arg)
+{
+    if (dispatch->sealed) {
+        return false;
+    }
+    const canid_t key = CAN_DISPATCH_key(id);
+    uint32_t i = CAN_DISPATCH_hash(dispatch, key);
+    uint32_t probe = 1;
+    // registering an ID again replaces its handler
+    while (dispatch->ids[i].key != CAN_DISPATCH_KEY_EMPTY && dispatch->ids[i].key != key) {
+        i = (i + 1) & dispatch->id_mask;
+        probe++;
+    }
+    CAN_DISPATCH_SLOT_t *slot = &dispatch->ids[i];
+    if (slot->key == CAN_DISPATCH_KEY_EMPTY && dispatch->id_count == dispatch->id_capacity) {
+        return false;
+    }
+    if (!CAN_DISPATCH_entry(dispatch, &slot->entry, mode, handler, arg)) {
+        return false;
+    }
+    if (slot->key == CAN_DISPATCH_KEY_EMPTY) {
+        slot->key = key;
+        dispatch->id_count++;
+    }
+    if (probe > dispatch->stats.max_probe) {
+        dispatch->stats.max_probe = probe;
+    }
+    return true;
+}
+
+bool CAN_DISPATCH_onFilter(CAN_DISPATCH dispatch, const uint8_t filter, const CAN_DISPATCH_MODE_t mode,
+                           CAN_DISPATCH_HANDLER handler, void *arg)
+{
+    if (dispatch->sealed || filter >= CAN_DISPATCH_FILTERS) {
+        return false;
+    }
+    return CAN_DISPATCH_entry(dispatch, &dispatch->by_filter[filter], mode, handler, arg);
+}
+
+void CAN_DISPATCH_seal(CAN_DISPATCH dispatch)
+{
+    dispatch->sealed = true;
+}
+
+static bool CAN_DISPATCH_run(CAN_DISPATCH dispatch, const CAN_DISPATCH_ENTRY_t *entry, const CAN_FRAME_TS rx)
+{
+    if (entry->mode == CAN_DISPATCH_INLINE) {
+        entry->handler(entry->arg, rx);
+        return true;
+    }
+    CAN_DISPATCH_JOB_t job = {
+        .handler = entry->handler,
+        .arg = entry->arg,
+        .rx = *rx,
+    };
+    // the service task must not block on a slow worker
+    if (xQueueSend(dispatch->queue, &job, 0) == pdTRUE) {
+        dispatch->stats.deferred++;
+    } else {
+        dispatch->stats.deferred_dropped++;
+    }
+    return true;
+}
+
+bool CAN_DISPATCH_route(CAN_DISPATCH dispatch, const CAN_FRAME_TS rx)
+{
+    if (dispatch->id_count > 0) {
+        const canid_t key = CAN_DISPATCH_key(rx->frame.can_id);
+        uint32_t i = CAN_DISPATCH_hash(dispatch, key);
+        while (dispatch->ids[i].key != CAN_DISPATCH_KEY_EMPTY) {
+            if (dispatch->ids[i].key == key) {
+                dispatch->stats.by_id++;
+                return CAN_DISPATCH_run(dispatch, &dispatch->ids[i].entry, rx);
+            }
+            i = (i + 1) & dispatch->id_mask;
+        }
+    }
+    if (rx->filhit < CAN_DISPATCH_FILTERS && dispatch->by_filter[rx->filhit].handler != NULL) {
+        dispatch->stats.by_filter++;
+        return CAN_DISPATCH_run(dispatch, &dispatch->by_filter[rx->filhit], rx);
+    }
+    dispatch->stats.unhandled++;
+    return false;
+}
+
+void CAN_DISPATCH_getStats(const CAN_DISPATCH dispatch, CAN_DISPATCH_STATS_t *stats)
+{
+    *stats = dispatch->stats;
+}
@@ -0,0 +1,106 @@
+#ifndef _CAN_DISPATCH_H_
+#define _CAN_DISPATCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "can.h"
+
+/*
+ * Routes received frames to handlers without comparing IDs one by one. A
+ * frame is looked up first by ID in an open-addressing hash table (Fibonacci
+ * hashing, linear probing, kept at most half full), then by the hardware
+ * acceptance filter that matched it (CAN_FRAME_TS_t.filhit, RXF0..RXF5). Both
+ * lookups cost the same however many IDs are subscribed.
+ *
+ * An INLINE handler runs in the caller of CAN_DISPATCH_route(), i.e. the
+ * MCP2515 service task in the middle of a drain, and must be short. A DEFERRED
+ * handler gets a copy of the frame on the worker task. Frames no handler
+ * claims are left to the caller.
+ *
+ * Handlers are registered before the table is installed with
+ * MCP2515_setRxDispatch(), which seals it; a sealed table is only read.
+ */
+
+#define CAN_DISPATCH_FILTERS 6
+// no valid key has the RTR/ERR flags set
+#define CAN_DISPATCH_KEY_EMPTY ((canid_t)0xFFFFFFFFU)
+
+typedef void (*CAN_DISPATCH_HANDLER)(void *arg, const CAN_FRAME_TS rx);
+
+typedef enum {
+	CAN_DISPATCH_INLINE = 0,
+	CAN_DISPATCH_DEFERRED,
+} CAN_DISPATCH_MODE_t;
+
+typedef struct CAN_DISPATCH_ENTRY_s {
+	CAN_DISPATCH_HANDLER handler;
+	void *arg;
+	CAN_DISPATCH_MODE_t mode;
+} CAN_DISPATCH_ENTRY_t;
+
+typedef struct CAN_DISPATCH_SLOT_s {
+	canid_t key;                // CAN_DISPATCH_KEY_EMPTY when unused
+	CAN_DISPATCH_ENTRY_t entry;
+} CAN_DISPATCH_SLOT_t;
+
+typedef struct CAN_DISPATCH_CONFIG_s {
+	uint32_t max_ids;           // per-ID handlers that can be registered
+	uint32_t queue_len;         // deferred frames in flight, 0 for no worker
+	UBaseType_t priority;       // worker task
+	BaseType_t core;
+	uint32_t stack_size;
+} CAN_DISPATCH_CONFIG_t;
+
+#define CAN_DISPATCH_DEFAULT_CONFIG(ids) { \
+	.max_ids = (ids),                      \
+	.queue_len = 32,                       \
+	.priority = tskIDLE_PRIORITY + 2,      \
+	.core = tskNO_AFFINITY,                \
+	.stack_size = 4096,                    \
+}
+
+typedef struct CAN_DISPATCH_STATS_s {
+	uint32_t by_id;             // frames routed by the ID table
+	uint32_t by_filter;         // frames routed by filter hit
+	uint32_t unhandled;         // frames left to the caller
+	uint32_t deferred;          // frames queued for the worker
+	uint32_t deferred_dropped;  // deferred frames lost because the queue was full
+	uint32_t max_probe;         // longest probe sequence of any registered ID
+} CAN_DISPATCH_STATS_t;
+
+typedef struct CAN_DISPATCH_s {
+	CAN_DISPATCH_ENTRY_t by_filter[CAN_DISPATCH_FILTERS];
+	CAN_DISPATCH_SLOT_t *ids;
+	uint32_t id_mask;           // table size - 1, the size is a power of two
+	uint8_t id_shift;           // 32 - log2(table size)
+	uint32_t id_count;
+	uint32_t id_capacity;
+	bool sealed;
+
+	QueueHandle_t queue;
+	TaskHandle_t worker;
+
+	CAN_DISPATCH_STATS_t stats;
+} CAN_DISPATCH_t[1], *CAN_DISPATCH;
+
+// returns NULL when out of memory or the worker could not be started
+CAN_DISPATCH CAN_DISPATCH_create(const CAN_DISPATCH_CONFIG_t *config);
+// must not be installed in the driver any more
+void CAN_DISPATCH_destroy(CAN_DISPATCH dispatch);
+
+// CAN_EFF_FLAG in the ID selects an extended ID; false if the table is full or sealed
+bool CAN_DISPATCH_onId(CAN_DISPATCH dispatch, const canid_t id, const CAN_DISPATCH_MODE_t mode,
+                       CAN_DISPATCH_HANDLER handler, void *arg);
+// frames accepted by hardware filter RXFn and not claimed by an ID handler
+bool CAN_DISPATCH_onFilter(CAN_DISPATCH dispatch, const uint8_t filter, const CAN_DISPATCH_MODE_t mode,
+                           CAN_DISPATCH_HANDLER handler, void *arg);
+void CAN_DISPATCH_seal(CAN_DISPATCH dispatch);
+
+// runs or queues the handler of rx, false if none claims it
+bool CAN_DISPATCH_route(CAN_DISPATCH dispatch, const CAN_FRAME_TS rx);
+void CAN_DISPATCH_getStats(const CAN_DISPATCH dispatch, CAN_DISPATCH_STATS_t *stats);
+
+#endif
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "can_filter.h"
+
+#define TAG_CAN_FILTER "CAN_FILTER"
+
+CAN_FILTER CAN_FILTER_create(const uint32_t max_ranges)
+{
+    CAN_FILTER filter = (CAN_FILTER)calloc(1, sizeof(CAN_FILTER_t));
+    if (filter == NULL) {
+        ESP_LOGE(TAG_CAN_FILTER, "Couldn't allocate the filter. (NULL pointer)");
+        return NULL;
+    }
+    if (max_ranges > 0) {
+        filter->eff = (CAN_FILTER_RANGE_t *)calloc(max_ranges, sizeof(CAN_FILTER_RANGE_t));
+        if (filter->eff == NULL) {
+            ESP_LOGE(TAG_CAN_FILTER, "Couldn't allocate %lu ranges. (NULL pointer)", (unsigned long)max_ranges);
+            free(filter);
+            return NULL;
+        }
+    }
+    filter->eff_capacity = max_ranges;
+    return filter;
+}
+
+void CAN_FILTER_destroy(CAN_FILTER filter)
+{
+    if (filter == NULL) {
+        return;
+    }
+    free(filter->eff);
+    free(filter);
+}
+
+bool CAN_FILTER_addId(CAN_FILTER filter, const canid_t id)
+{
+    return CAN_FILTER_addRange(filter, id, id);
+}
+
+bool CAN_FILTER_addRange(CAN_FILTER filter, const canid_t first, const canid_t last)
+{
+    if (filter->sealed || (first & CAN_EFF_FLAG) != (last & CAN_EFF_FLAG)) {
+        return false;
+    }
+    if (first & CAN_EFF_FLAG) {
+        const uint32_t lo = first & CAN_EFF_MASK;
+        const uint32_t hi = last & CAN_EFF_MASK;
+        if (lo > hi || filter->eff_count == filter->eff_capacity) {
+            return false;
+        }
+        filter->eff[filter->eff_count].first = lo;
+        filter->eff[filter->eff_count].last = hi;
+        filter->eff_count++;
+        return true;
+    }
+    const uint32_t lo = first & CAN_SFF_MASK;
+    const uint32_t hi = last & CAN_SFF_MASK;
+    if (lo > hi) {
+        return false;
+    }
+    for (uint32_t id = lo; id <= hi; id++) {
+        filter->sff[id / 32] |= 1UL << (id % 32);
+    }
+    return true;
+}
+
+static int CAN_FILTER_compareRanges(const void *a, const void *b)
+{
+    const CAN_FILTER_RANGE_t *ra = (const CAN_FILTER_RANGE_t *)a;
+    const CAN_FILTER_RANGE_t *rb = (const CAN_FILTER_RANGE_t *)b;
+    return (ra->first > rb->first) - (ra->first < rb->first);
+}
+
+void CAN_FILTER_seal(CAN_FILTER filter)
+{
+    if (filter->sealed) {
+        return;
+    }
+    if (filter->eff_count > 1) {
+        qsort(filter->eff, filter->eff_count, sizeof(CAN_FILTER_RANGE_t), CAN_FILTER_compareRanges);
+        // merge overlapping and adjacent ranges so the search sees disjoint ones
+        uint32_t n = 0;
+        for (uint32_t i = 1; i < filter->eff_count; i++) {
+            if (filter->eff[i].first <= filter->eff[n].last + 1) {
+                if (filter->eff[i].last > filter->eff[n].last) {
+                    filter->eff[n].last = filter->eff[i].last;
+                }
+            } else {
+                filter->eff[++n] = filter->eff[i];
+            }
+        }
+        filter->eff_count = n + 1;
+    }
+    filter->sealed = true;
+}
+
+bool CAN_FILTER_match(const CAN_FILTER filter, const canid_t can_id)
+{
+    if (!(can_id & CAN_EFF_FLAG)) {
+        const uint32_t id = can_id & CAN_SFF_MASK;
+        return (filter->sff[id / 32] >> (id % 32)) & 1;
+    }
+    // last range starting at or below id
+    const uint32_t id = can_id & CAN_EFF_MASK;
+    uint32_t lo = 0;
+    uint32_t hi = filter->eff_count;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (filter->eff[mid].first <= id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 && id <= filter->eff[lo - 1].last;
+}
@@ -0,0 +1,47 @@
+#ifndef _CAN_FILTER_H_
+#define _CAN_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "can.h"
+
+/*
+ * Software acceptance filter, applied to received frames after the MCP2515's
+ * own masks and filters. Standard IDs are looked up in a 2048-bit bitmap,
+ * extended IDs by binary search over sorted, merged ranges (a single ID is a
+ * range of one), so a lookup costs O(1) or O(log n).
+ *
+ * A filter is built with addId/addRange, sealed, and then only read: the
+ * driver swaps whole filters with MCP2515_setSoftFilter() instead of editing
+ * the one in use.
+ */
+
+#define CAN_FILTER_SFF_WORDS ((CAN_SFF_MASK + 1) / 32)
+
+typedef struct CAN_FILTER_RANGE_s {
+	uint32_t first;
+	uint32_t last;
+} CAN_FILTER_RANGE_t;
+
+typedef struct CAN_FILTER_s {
+	uint32_t sff[CAN_FILTER_SFF_WORDS];
+	CAN_FILTER_RANGE_t *eff;
+	uint32_t eff_count;
+	uint32_t eff_capacity;
+	bool sealed;
+} CAN_FILTER_t[1], *CAN_FILTER;
+
+// max_ranges bounds the extended IDs/ranges that can be added, returns NULL when out of memory
+CAN_FILTER CAN_FILTER_create(const uint32_t max_ranges);
+void CAN_FILTER_destroy(CAN_FILTER filter);
+
+// CAN_EFF_FLAG in the ID selects the extended table; false if full or already sealed
+bool CAN_FILTER_addId(CAN_FILTER filter, const canid_t id);
+// inclusive range, first and last must both be standard or both extended
+bool CAN_FILTER_addRange(CAN_FILTER filter, const canid_t first, const canid_t last);
+// sorts and merges the extended ranges, required before the filter is used
+void CAN_FILTER_seal(CAN_FILTER filter);
+
+bool CAN_FILTER_match(const CAN_FILTER filter, const canid_t can_id);
+
+#endif
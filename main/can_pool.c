@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "can_pool.h"
+
+#define TAG_CAN_POOL "CAN_POOL"
+
+CAN_POOL CAN_POOL_create(const uint32_t capacity)
+{
+    if (capacity == 0) {
+        ESP_LOGE(TAG_CAN_POOL, "capacity must not be 0");
+        return NULL;
+    }
+    CAN_POOL pool = heap_caps_calloc(1, sizeof(CAN_POOL_t), MALLOC_CAP_DEFAULT);
+    if (pool == NULL) {
+        ESP_LOGE(TAG_CAN_POOL, "Couldn't allocate the pool. (NULL pointer)");
+        return NULL;
+    }
+    pool->capacity = capacity;
+    pool->words = (capacity + 31) / 32;
+    pool->free_bits = heap_caps_calloc(pool->words, sizeof(uint32_t), MALLOC_CAP_DEFAULT);
+    pool->frames = heap_caps_calloc(capacity, sizeof(CAN_POOL_FRAME_t), MALLOC_CAP_DEFAULT);
+    if (pool->free_bits == NULL || pool->frames == NULL) {
+        ESP_LOGE(TAG_CAN_POOL, "Couldn't allocate %lu frames. (NULL pointer)", (unsigned long)capacity);
+        heap_caps_free(pool->free_bits);
+        heap_caps_free(pool->frames);
+        heap_caps_free(pool);
+        return NULL;
+    }
+    for (uint32_t w = 0; w < pool->words; w++) {
+        const uint32_t left = capacity - w * 32;
+        atomic_init(&pool->free_bits[w], left >= 32 ? 0xFFFFFFFFu : (1u << left) - 1);
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        atomic_init(&pool->frames[i].refs, 0);
+        pool->frames[i].index = i;
+        pool->frames[i].pool = pool;
+    }
+    return pool;
+}
+
+void CAN_POOL_destroy(CAN_POOL pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    if (atomic_load(&pool->in_use) != 0) {
+        ESP_LOGW(TAG_CAN_POOL, "destroying a pool with %lu frames in use",
+                 (unsigned long)atomic_load(&pool->in_use));
+    }
+    heap_caps_free(pool->free_bits);
+    heap_caps_free(pool->frames);
+    heap_caps_free(pool);
+}
+
+static void CAN_POOL_recordAlloc(CAN_POOL pool, uint32_t cycles)
+{
+    atomic_fetch_add_explicit(&pool->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->alloc_cycles_total, cycles, memory_order_relaxed);
+    uint32_t max = atomic_load_explicit(&pool->alloc_cycles_max, memory_order_relaxed);
+    while (cycles > max && !atomic_compare_exchange_weak_explicit(&pool->alloc_cycles_max, &max, cycles,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+    }
+    const uint32_t used = atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed) + 1;
+    uint32_t high = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    while (used > high && !atomic_compare_exchange_weak_explicit(&pool->high_water, &high, used,
+                                                                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+CAN_POOL_FRAME CAN_POOL_alloc(CAN_POOL pool)
+{
+    const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    const uint32_t first = atomic_load_explicit(&pool->hint, memory_order_relaxed);
+    for (uint32_t n = 0; n < pool->words; n++) {
+        const uint32_t w = (first + n) % pool->words;
+        uint32_t bits = atomic_load_explicit(&pool->free_bits[w], memory_order_relaxed);
+        while (bits != 0) {
+            const uint32_t bit = __builtin_ctz(bits);
+            // acquire pairs with the release in CAN_POOL_release(): the previous owner is done with the slot
+            if (atomic_compare_exchange_weak_explicit(&pool->free_bits[w], &bits, bits & ~(1u << bit),
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                CAN_POOL_FRAME frame = &pool->frames[w * 32 + bit];
+                atomic_store_explicit(&frame->refs, 1, memory_order_relaxed);
+                if (bits == (1u << bit)) {
+                    // word now empty, start the next search further on
+                    atomic_store_explicit(&pool->hint, (w + 1) % pool->words, memory_order_relaxed);
+                }
+                CAN_POOL_recordAlloc(pool, esp_cpu_get_cycle_count() - start);
+                return frame;
+            }
+            // bits was reloaded by the failed exchange
+        }
+    }
+    atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+    return NULL;
+}
+
+void CAN_POOL_retain(CAN_POOL_FRAME frame)
+{
+    // the caller already holds a reference, so the count cannot reach 0 meanwhile
+    atomic_fetch_add_explicit(&frame->refs, 1, memory_order_relaxed);
+}
+
+void CAN_POOL_release(CAN_POOL_FRAME frame)
+{
+    // acq_rel: every reader's accesses happen before the slot is reused
+    if (atomic_fetch_sub_explicit(&frame->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    CAN_POOL pool = frame->pool;
+    atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+    atomic_fetch_or_explicit(&pool->free_bits[frame->index / 32], 1u << (frame->index % 32),
+                             memory_order_release);
+}
+
+void CAN_POOL_getStats(const CAN_POOL pool, CAN_POOL_STATS_t *stats)
+{
+    stats->capacity = pool->capacity;
+    stats->in_use = atomic_load_explicit(&pool->in_use, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    stats->allocs = atomic_load_explicit(&pool->allocs, memory_order_relaxed);
+    stats->exhausted = atomic_load_explicit(&pool->exhausted, memory_order_relaxed);
+    stats->alloc_cycles_max = atomic_load_explicit(&pool->alloc_cycles_max, memory_order_relaxed);
+    const uint32_t total = atomic_load_explicit(&pool->alloc_cycles_total, memory_order_relaxed);
+    stats->alloc_cycles_avg = stats->allocs ? total / stats->allocs : 0;
+}
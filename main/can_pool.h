@@ -0,0 +1,70 @@
+#ifndef _CAN_POOL_H_
+#define _CAN_POOL_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "can.h"
+
+/*
+ * Fixed-capacity pool of reference-counted frame descriptors. All slots are
+ * allocated by CAN_POOL_create(); afterwards alloc/retain/release touch no
+ * heap and take no lock. A received frame is written once into a slot and
+ * the same pointer is handed to every consumer: each one holds a reference
+ * and the slot goes back to the pool when the last of them releases it.
+ *
+ * Free slots are tracked in a bitmap of 32-bit words (1 = free) claimed with
+ * compare-and-swap, so any number of tasks may allocate and release
+ * concurrently without ABA problems. Releasing from an ISR is fine as well.
+ */
+
+typedef struct CAN_POOL_s *CAN_POOL;
+
+typedef struct CAN_POOL_FRAME_s {
+	CAN_FRAME_TS_t rx;
+	_Atomic uint32_t refs;
+	uint32_t index;             // slot number, fixed at create
+	CAN_POOL pool;
+} CAN_POOL_FRAME_t, *CAN_POOL_FRAME;
+
+typedef struct CAN_POOL_STATS_s {
+	uint32_t capacity;
+	uint32_t in_use;
+	uint32_t high_water;        // largest in_use seen by an allocation
+	uint32_t allocs;
+	uint32_t exhausted;         // allocations refused because every slot was taken
+	uint32_t alloc_cycles_max;  // CPU cycles spent in the slowest allocation
+	uint32_t alloc_cycles_avg;
+} CAN_POOL_STATS_t;
+
+typedef struct CAN_POOL_s {
+	uint32_t capacity;
+	uint32_t words;
+	_Atomic uint32_t *free_bits;
+	// word to start the next search from, only a hint
+	_Atomic uint32_t hint;
+	CAN_POOL_FRAME_t *frames;
+
+	_Atomic uint32_t in_use;
+	_Atomic uint32_t high_water;
+	_Atomic uint32_t allocs;
+	_Atomic uint32_t exhausted;
+	_Atomic uint32_t alloc_cycles_max;
+	_Atomic uint32_t alloc_cycles_total;
+} CAN_POOL_t[1];
+
+// returns NULL if capacity is 0 or out of memory
+CAN_POOL CAN_POOL_create(const uint32_t capacity);
+// every frame must have been released
+void CAN_POOL_destroy(CAN_POOL pool);
+
+// a frame with one reference owned by the caller, NULL if the pool is exhausted
+CAN_POOL_FRAME CAN_POOL_alloc(CAN_POOL pool);
+// one more reference, taken before the frame is handed to another consumer
+void CAN_POOL_retain(CAN_POOL_FRAME frame);
+// drops one reference, the slot returns to the pool with the last one
+void CAN_POOL_release(CAN_POOL_FRAME frame);
+
+void CAN_POOL_getStats(const CAN_POOL pool, CAN_POOL_STATS_t *stats);
+
+#endif
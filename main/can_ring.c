@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "can_ring.h"
+
+#define TAG_CAN_RING "CAN_RING"
+
+CAN_RING CAN_RING_create(const uint32_t capacity)
+{
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        ESP_LOGE(TAG_CAN_RING, "capacity %lu is not a power of two", (unsigned long)capacity);
+        return NULL;
+    }
+    CAN_RING ring = heap_caps_aligned_alloc(CAN_RING_CACHE_LINE, sizeof(CAN_RING_t), MALLOC_CAP_DEFAULT);
+    if (ring == NULL) {
+        ESP_LOGE(TAG_CAN_RING, "Couldn't allocate the ring. (NULL pointer)");
+        return NULL;
+    }
+    memset(ring, 0, sizeof(CAN_RING_t));
+    ring->frames = heap_caps_aligned_alloc(CAN_RING_CACHE_LINE, capacity * sizeof(CAN_FRAME_TS_t), MALLOC_CAP_DEFAULT);
+    if (ring->frames == NULL) {
+        ESP_LOGE(TAG_CAN_RING, "Couldn't allocate %lu frames. (NULL pointer)", (unsigned long)capacity);
+        heap_caps_free(ring);
+        return NULL;
+    }
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->pushed, 0);
+    atomic_init(&ring->high_water, 0);
+    return ring;
+}
+
+void CAN_RING_destroy(CAN_RING ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+    heap_caps_free(ring->frames);
+    heap_caps_free(ring);
+}
+
+CAN_FRAME_TS CAN_RING_reserve(CAN_RING ring)
+{
+    // head is ours, tail is published by the consumer after it has copied a slot out
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > ring->mask) {
+        return NULL;
+    }
+    return &ring->frames[head & ring->mask];
+}
+
+void CAN_RING_commit(CAN_RING ring)
+{
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+    // the release store makes the slot contents visible before the new head
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    atomic_store_explicit(&ring->pushed, atomic_load_explicit(&ring->pushed, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    const uint32_t used = head - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (used > atomic_load_explicit(&ring->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->high_water, used, memory_order_relaxed);
+    }
+}
+
+void CAN_RING_drop(CAN_RING ring)
+{
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+}
+
+bool CAN_RING_push(CAN_RING ring, const CAN_FRAME_TS frame)
+{
+    CAN_FRAME_TS slot = CAN_RING_reserve(ring);
+    if (slot == NULL) {
+        CAN_RING_drop(ring);
+        return false;
+    }
+    *slot = *frame;
+    CAN_RING_commit(ring);
+    return true;
+}
+
+uint32_t CAN_RING_popBatch(CAN_RING ring, CAN_FRAME_TS_t frames[], const uint32_t max)
+{
+    const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t n = head - tail;
+    if (n > max) {
+        n = max;
+    }
+    // at most two contiguous pieces: up to the end of the array, then from index 0
+    const uint32_t first = tail & ring->mask;
+    uint32_t run = ring->mask + 1 - first;
+    if (run > n) {
+        run = n;
+    }
+    memcpy(frames, &ring->frames[first], run * sizeof(CAN_FRAME_TS_t));
+    memcpy(&frames[run], &ring->frames[0], (n - run) * sizeof(CAN_FRAME_TS_t));
+    // hand the slots back only after they have been copied
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+uint32_t CAN_RING_count(const CAN_RING ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire)
+         - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+void CAN_RING_getStats(const CAN_RING ring, CAN_RING_STATS_t *stats)
+{
+    stats->capacity = ring->mask + 1;
+    stats->count = CAN_RING_count(ring);
+    stats->high_water = atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+    stats->pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#ifndef _CAN_RING_H_
+#define _CAN_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "can.h"
+
+/*
+ * Lock-free single-producer/single-consumer ring of timestamped CAN frames. The driver's
+ * drain context is the only producer and one application task the only
+ * consumer; neither side takes a lock or disables interrupts. The capacity is
+ * a power of two so indices wrap with a mask, and the producer and consumer
+ * indices live on separate cache lines so the two cores do not contend.
+ */
+
+#define CAN_RING_CACHE_LINE 64
+
+typedef struct CAN_RING_STATS_s {
+	uint32_t capacity;
+	uint32_t count;       // frames waiting for the consumer
+	uint32_t high_water;  // largest count seen by the producer
+	uint32_t pushed;
+	uint32_t dropped;     // frames refused because the ring was full
+} CAN_RING_STATS_t;
+
+typedef struct CAN_RING_s {
+	// written by the producer only
+	_Atomic uint32_t head __attribute__((aligned(CAN_RING_CACHE_LINE)));
+	// counters are atomic only so the consumer can read them while the producer runs
+	_Atomic uint32_t high_water;
+	_Atomic uint32_t pushed;
+	_Atomic uint32_t dropped;
+
+	// written by the consumer only
+	_Atomic uint32_t tail __attribute__((aligned(CAN_RING_CACHE_LINE)));
+
+	// read-only after create
+	uint32_t mask __attribute__((aligned(CAN_RING_CACHE_LINE)));
+	CAN_FRAME_TS_t *frames;
+} CAN_RING_t[1], *CAN_RING;
+
+// capacity must be a power of two, returns NULL otherwise or when out of memory
+CAN_RING CAN_RING_create(const uint32_t capacity);
+void CAN_RING_destroy(CAN_RING ring);
+
+/*
+ * Producer side. CAN_RING_reserve() returns the next free slot (NULL if the
+ * ring is full) so a frame can be decoded straight into it; CAN_RING_commit()
+ * publishes it. A producer that reserves before it knows whether the frame is
+ * wanted calls CAN_RING_drop() only for a wanted frame that found no slot, so
+ * dropped counts lost frames and nothing else. CAN_RING_push() copies a
+ * finished frame and counts the drop itself.
+ */
+CAN_FRAME_TS CAN_RING_reserve(CAN_RING ring);
+void CAN_RING_commit(CAN_RING ring);
+void CAN_RING_drop(CAN_RING ring);
+bool CAN_RING_push(CAN_RING ring, const CAN_FRAME_TS frame);
+
+// Consumer side: copy out up to max frames in arrival order, returns the number copied
+uint32_t CAN_RING_popBatch(CAN_RING ring, CAN_FRAME_TS_t frames[], const uint32_t max);
+uint32_t CAN_RING_count(const CAN_RING ring);
+
+void CAN_RING_getStats(const CAN_RING ring, CAN_RING_STATS_t *stats);
+
+#endif
@@ -1,7 +1,17 @@
 #include "can_test.h"
+#include "can_ring.h"
+#include "can_pool.h"
+#include "can_filter.h"
+#include "can_dispatch.h"
+#include "mcp2515_solver.h"
+#include "mcp2515_txq.h"
+#include "can_bcm.h"
+#include "mcp2515_esp_irq.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
 #include <string.h>
 
 #define TAG "CAN_TEST"
@@ -162,45 +172,82 @@ void can_error_test(void)
     ESP_LOGI(TAG, "Error counters - TEC: %d, REC: %d", tec, rec);
 }
 
-// 性能测试
+// 性能测试: 回环模式下经MCP2515_sendBatch()连续发送，批内各帧一次装入空闲邮箱并用一条RTS启动，
+// 其余帧在发送队列中等待邮箱完成后补装，测量实际帧率、每帧SPI事务数和总线占用率
+#define PERF_TEST_FRAMES  2000
+#define PERF_TEST_BURST   16
+// 与app_main中配置的波特率一致
+#define PERF_TEST_BITRATE 500000
+
 void can_performance_test(void)
 {
     ESP_LOGI(TAG, "Starting CAN performance test...");
-    
-    const uint32_t test_messages = 100;
-    TickType_t start_time = xTaskGetTickCount();
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    // 队列容纳的帧多于一个系统节拍内总线能发出的帧，生产者让出CPU期间邮箱不会断流
+    MCP2515_TXQ txq = MCP2515_TXQ_create(64);
+    if (txq == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX queue");
+        MCP2515_setNormalMode();
+        return;
+    }
+    MCP2515_TXQ previous = MCP2515_setTxQueue(txq);
+
+    CAN_FRAME_t frames[PERF_TEST_BURST];
+    for (int i = 0; i < PERF_TEST_BURST; i++) {
+        frames[i].can_id = 0x100;
+        frames[i].can_dlc = 8;
+    }
+
     uint32_t sent_count = 0;
-    uint32_t failed_count = 0;
-    
-    CAN_FRAME_t test_frame;
-    test_frame.can_id = 0x100;
-    test_frame.can_dlc = 8;
-    
-    for (uint32_t i = 0; i < test_messages; i++) {
-        // 更新数据
-        for (int j = 0; j < 8; j++) {
-            test_frame.data[j] = (i + j) & 0xFF;
+    uint32_t stalls = 0;
+    MCP2515_resetSpiTransactionCount();
+    const int64_t start_us = esp_timer_get_time();
+    while (sent_count < PERF_TEST_FRAMES) {
+        uint32_t n = PERF_TEST_FRAMES - sent_count;
+        if (n > PERF_TEST_BURST) {
+            n = PERF_TEST_BURST;
         }
-        
-        ERROR_t result = MCP2515_sendMessageAfterCtrlCheck(&test_frame);
-        if (result == ERROR_OK) {
-            sent_count++;
-        } else {
-            failed_count++;
+        for (uint32_t i = 0; i < n; i++) {
+            for (int j = 0; j < 8; j++) {
+                frames[i].data[j] = (sent_count + i + j) & 0xFF;
+            }
+        }
+        // 没有被接受的帧留到下一轮重新提交
+        const uint32_t accepted = MCP2515_sendBatch(frames, n);
+        sent_count += accepted;
+        if (accepted < n) {
+            stalls++;
+            vTaskDelay(1);
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(10)); // 10ms间隔
     }
-    
-    TickType_t end_time = xTaskGetTickCount();
-    uint32_t duration_ms = (end_time - start_time) * portTICK_PERIOD_MS;
-    
+    for (int wait = 0; wait < 1000 && MCP2515_TXQ_pending(txq) > 0; wait++) {
+        vTaskDelay(1);
+    }
+    const int64_t duration_us = esp_timer_get_time() - start_us;
+    const uint32_t transactions = MCP2515_getSpiTransactionCount();
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    MCP2515_setTxQueue(previous);
+    MCP2515_TXQ_destroy(txq);
+    MCP2515_setNormalMode();
+
+    // 8字节标准数据帧: 47 + 64位(含3位帧间隔，不计填充位)
+    const float frame_us = (47 + 64) * 1e6f / PERF_TEST_BITRATE;
+    const float per_frame_us = (float)duration_us / PERF_TEST_FRAMES;
     ESP_LOGI(TAG, "Performance test completed:");
-    ESP_LOGI(TAG, "  Duration: %lu ms", duration_ms);
-    ESP_LOGI(TAG, "  Messages sent: %lu", sent_count);
-    ESP_LOGI(TAG, "  Messages failed: %lu", failed_count);
-    ESP_LOGI(TAG, "  Success rate: %.1f%%", (float)sent_count / test_messages * 100);
-    ESP_LOGI(TAG, "  Messages per second: %.1f", (float)sent_count / duration_ms * 1000);
+    ESP_LOGI(TAG, "  Duration: %lld us, %lu producer stalls", duration_us, stalls);
+    ESP_LOGI(TAG, "  Messages sent: %lu, failed: %lu", stats.sent, stats.failed);
+    ESP_LOGI(TAG, "  Messages per second: %.1f", PERF_TEST_FRAMES * 1e6f / duration_us);
+    ESP_LOGI(TAG, "  Time per frame: %.1f us (bus minimum %.1f us, %.0f%% bus load)",
+             per_frame_us, frame_us, frame_us / per_frame_us * 100);
+    ESP_LOGI(TAG, "  SPI transactions per frame: %.2f", (float)transactions / PERF_TEST_FRAMES);
 }
 
 // 过滤器测试
@@ -208,21 +255,21 @@ void can_filter_test(void)
 {
     ESP_LOGI(TAG, "Starting CAN filter test...");
     
-    // 设置过滤器 - 只接收ID为0x123的消息
-    ERROR_t result = MCP2515_setFilter(RXF0, false, 0x123);
-    if (result != ERROR_OK) {
-        ESP_LOGE(TAG, "Failed to set filter: %d", result);
-        return;
-    }
-    
-    // 设置掩码 - 精确匹配
-    result = MCP2515_setFilterMask(MASK0, false, 0x7FF);
+    // 设置过滤器和掩码 - 只接收ID为0x123的消息(精确匹配)，一次进入配置模式后回到正常模式
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configFilter(config, RXF0, false, 0x123);
+    MCP2515_configFilterMask(config, MASK0, false, 0x7FF);
+
+    int64_t start = esp_timer_get_time();
+    ERROR_t result = MCP2515_configApply(config);
+    int64_t config_us = esp_timer_get_time() - start;
     if (result != ERROR_OK) {
-        ESP_LOGE(TAG, "Failed to set mask: %d", result);
+        ESP_LOGE(TAG, "Failed to configure filter: %d", result);
         return;
     }
     
-    ESP_LOGI(TAG, "Filter configured - only accepting messages with ID 0x123");
+    ESP_LOGI(TAG, "Filter configured in %lld us - only accepting messages with ID 0x123", config_us);
     
     // 发送应该被接收的消息
     CAN_FRAME_t accepted_frame;
@@ -268,6 +315,1382 @@ void can_filter_test(void)
     ESP_LOGI(TAG, "Filter test completed - Received %lu messages", received_count);
     
     // 清除过滤器
-    MCP2515_setFilter(RXF0, false, 0);
-    MCP2515_setFilterMask(MASK0, false, 0);
-} 
\ No newline at end of file
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configFilter(config, RXF0, false, 0);
+    MCP2515_configFilterMask(config, MASK0, false, 0);
+    MCP2515_configApply(config);
+}
+
+// 接收路径SPI事务计数测试
+void can_rx_transaction_test(void)
+{
+    ESP_LOGI(TAG, "Starting CAN RX SPI transaction test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    CAN_FRAME_t test_frame;
+    test_frame.can_id = TEST_MSG_ID_1;
+    test_frame.can_dlc = 8;
+    memset(test_frame.data, 0x5A, 8);
+
+    // 旧路径: SIDH..DLC, CTRL, DATA, CANINTF 四次事务
+    MCP2515_sendMessageAfterCtrlCheck(&test_frame);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    uint8_t header[5];
+    uint8_t payload[CAN_MAX_DLEN];
+    MCP2515_resetSpiTransactionCount();
+    MCP2515_readRegisters(MCP_RXB0SIDH, header, 5);
+    MCP2515_readRegister(MCP_RXB0CTRL);
+    MCP2515_readRegisters(MCP_RXB0DATA, payload, header[MCP_DLC] & DLC_MASK);
+    MCP2515_modifyRegister(MCP_CANINTF, CANINTF_RX0IF, 0);
+    uint32_t legacy_count = MCP2515_getSpiTransactionCount();
+
+    // 新路径: READ RX BUFFER 一次事务
+    MCP2515_sendMessageAfterCtrlCheck(&test_frame);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    CAN_FRAME_t received_frame;
+    MCP2515_resetSpiTransactionCount();
+    result = MCP2515_readMessage(RXB0, &received_frame);
+    uint32_t fast_count = MCP2515_getSpiTransactionCount();
+
+    if (result == ERROR_OK && received_frame.can_id == test_frame.can_id
+        && memcmp(received_frame.data, test_frame.data, 8) == 0) {
+        ESP_LOGI(TAG, "RX transaction test PASSED - per frame: legacy %lu, READ RX BUFFER %lu",
+                 legacy_count, fast_count);
+    } else {
+        ESP_LOGE(TAG, "RX transaction test FAILED - result: %d", result);
+    }
+
+    MCP2515_setNormalMode();
+}
+
+// 等待发送缓冲区空闲(不计入测量)
+static void can_test_wait_txb_idle(const REGISTER_t ctrl)
+{
+    for (int i = 0; i < 100; i++) {
+        if ((MCP2515_readRegister(ctrl) & TXB_TXREQ) == 0) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+
+// 发送路径SPI事务计数与耗时测试
+void can_tx_transaction_test(void)
+{
+    ESP_LOGI(TAG, "Starting CAN TX SPI transaction test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    const uint32_t test_messages = 50;
+    CAN_FRAME_t test_frame;
+    test_frame.can_id = TEST_MSG_ID_2;
+    test_frame.can_dlc = 8;
+    memset(test_frame.data, 0xA5, 8);
+
+    uint8_t data[13];
+    MCP2515_prepareId(data, false, test_frame.can_id);
+    data[MCP_DLC] = test_frame.can_dlc;
+    memcpy(&data[MCP_DATA], test_frame.data, test_frame.can_dlc);
+
+    // 旧路径: WRITE SIDH..DATA, BITMOD TXREQ, READ CTRL
+    uint32_t legacy_count = 0;
+    int64_t legacy_us = 0;
+    for (uint32_t i = 0; i < test_messages; i++) {
+        can_test_wait_txb_idle(MCP_TXB0CTRL);
+        MCP2515_resetSpiTransactionCount();
+        int64_t start = esp_timer_get_time();
+        MCP2515_setRegisters(MCP_TXB0SIDH, data, 5 + test_frame.can_dlc);
+        MCP2515_modifyRegister(MCP_TXB0CTRL, TXB_TXREQ, TXB_TXREQ);
+        MCP2515_readRegister(MCP_TXB0CTRL);
+        legacy_us += esp_timer_get_time() - start;
+        legacy_count += MCP2515_getSpiTransactionCount();
+    }
+
+    // 新路径: LOAD TX BUFFER + RTS
+    uint32_t fast_count = 0;
+    int64_t fast_us = 0;
+    uint32_t failed_count = 0;
+    for (uint32_t i = 0; i < test_messages; i++) {
+        can_test_wait_txb_idle(MCP_TXB0CTRL);
+        MCP2515_resetSpiTransactionCount();
+        int64_t start = esp_timer_get_time();
+        if (MCP2515_sendMessage(TXB0, &test_frame) != ERROR_OK) {
+            failed_count++;
+        }
+        fast_us += esp_timer_get_time() - start;
+        fast_count += MCP2515_getSpiTransactionCount();
+    }
+
+    ESP_LOGI(TAG, "TX transaction test completed (%lu frames each):", test_messages);
+    ESP_LOGI(TAG, "  WRITE+BITMOD+READ: %.1f transactions/frame, %.1f us/frame",
+             (float)legacy_count / test_messages, (float)legacy_us / test_messages);
+    ESP_LOGI(TAG, "  LOAD TX+RTS:       %.1f transactions/frame, %.1f us/frame",
+             (float)fast_count / test_messages, (float)fast_us / test_messages);
+    if (failed_count != 0) {
+        ESP_LOGE(TAG, "TX transaction test FAILED - %lu frames failed", failed_count);
+    }
+
+    MCP2515_setNormalMode();
+}
+
+// SPI缓冲区基准测试: 每次调用的CPU周期数和任务栈使用量
+void can_spi_buffer_benchmark(void)
+{
+    ESP_LOGI(TAG, "Starting SPI buffer benchmark...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    const uint32_t iterations = 100;
+    uint8_t regs[14];
+    CAN_FRAME_t frame;
+    frame.can_id = TEST_MSG_ID_1;
+    frame.can_dlc = 8;
+    memset(frame.data, 0x3C, 8);
+
+    UBaseType_t stack_before = uxTaskGetStackHighWaterMark(NULL);
+
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++) {
+        MCP2515_readRegisters(MCP_TXB0CTRL, regs, sizeof(regs));
+    }
+    uint32_t read_cycles = (esp_cpu_get_cycle_count() - start) / iterations;
+
+    start = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++) {
+        MCP2515_setRegisters(MCP_TXB2SIDH, regs, 13);
+    }
+    uint32_t write_cycles = (esp_cpu_get_cycle_count() - start) / iterations;
+
+    uint32_t send_cycles = 0;
+    uint32_t recv_cycles = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        can_test_wait_txb_idle(MCP_TXB0CTRL);
+        start = esp_cpu_get_cycle_count();
+        MCP2515_sendMessage(TXB0, &frame);
+        send_cycles += esp_cpu_get_cycle_count() - start;
+
+        can_test_wait_txb_idle(MCP_TXB0CTRL);
+        start = esp_cpu_get_cycle_count();
+        MCP2515_readMessage(RXB0, &frame);
+        recv_cycles += esp_cpu_get_cycle_count() - start;
+    }
+
+    UBaseType_t stack_after = uxTaskGetStackHighWaterMark(NULL);
+
+    ESP_LOGI(TAG, "SPI buffer benchmark completed (%lu iterations):", iterations);
+    ESP_LOGI(TAG, "  readRegisters(14): %lu cycles/call", read_cycles);
+    ESP_LOGI(TAG, "  setRegisters(13):  %lu cycles/call", write_cycles);
+    ESP_LOGI(TAG, "  sendMessage:       %lu cycles/call", send_cycles / iterations);
+    ESP_LOGI(TAG, "  readMessage:       %lu cycles/call", recv_cycles / iterations);
+    ESP_LOGI(TAG, "  Stack high water mark: %u -> %u bytes free",
+             (unsigned int)stack_before, (unsigned int)stack_after);
+
+    MCP2515_setNormalMode();
+}
+
+// 寄存器影子缓存测试: 统计配置和发送路径的SPI事务数，并与芯片核对影子
+void can_shadow_test(void)
+{
+    ESP_LOGI(TAG, "Starting register shadow test...");
+
+    // 重复的模式/单次发送/中断掩码操作应直接由影子响应
+    MCP2515_resetSpiTransactionCount();
+    MCP2515_setConfigMode();
+    MCP2515_setOneShotMode(false);
+    MCP2515_getInterruptMask();
+    MCP2515_setConfigMode();
+    MCP2515_setOneShotMode(false);
+    MCP2515_getInterruptMask();
+    uint32_t config_count = MCP2515_getSpiTransactionCount();
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    // 空闲邮箱由软件位图给出，不再读取状态
+    const uint32_t test_messages = 50;
+    CAN_FRAME_t test_frame;
+    test_frame.can_id = TEST_MSG_ID_1;
+    test_frame.can_dlc = 8;
+    memset(test_frame.data, 0x5A, 8);
+
+    uint32_t send_count = 0;
+    uint32_t busy_count = 0;
+    for (uint32_t i = 0; i < test_messages; i++) {
+        MCP2515_resetSpiTransactionCount();
+        if (MCP2515_sendMessageAfterCtrlCheck(&test_frame) == ERROR_ALLTXBUSY) {
+            busy_count++;
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+        send_count += MCP2515_getSpiTransactionCount();
+    }
+
+    ESP_LOGI(TAG, "Shadow test completed:");
+    ESP_LOGI(TAG, "  config calls (x2): %lu transactions", config_count);
+    ESP_LOGI(TAG, "  sendMessageAfterCtrlCheck: %.1f transactions/frame, %lu busy",
+             (float)send_count / test_messages, busy_count);
+
+    if (MCP2515_auditShadow() == ERROR_OK) {
+        ESP_LOGI(TAG, "Shadow audit PASSED");
+    } else {
+        ESP_LOGE(TAG, "Shadow audit FAILED");
+    }
+
+    MCP2515_setNormalMode();
+}
+
+// 启动时间基准测试: 复位、配置、首帧发送各阶段耗时(会重新复位并配置为500kbps正常模式)
+void can_boot_benchmark(void)
+{
+    ESP_LOGI(TAG, "Starting boot time benchmark...");
+
+    const uint32_t iterations = 10;
+    int64_t reset_sum = 0, config_sum = 0, frame_sum = 0;
+    int64_t reset_max = 0, config_max = 0, frame_max = 0;
+    uint32_t osc_sum = 0;
+    uint32_t failed_count = 0;
+
+    CAN_FRAME_t test_frame;
+    test_frame.can_id = TEST_MSG_ID_1;
+    test_frame.can_dlc = 8;
+    memset(test_frame.data, 0x11, 8);
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        // 阶段1: RESET指令到配置模式，并写入默认配置
+        int64_t t0 = esp_timer_get_time();
+        if (MCP2515_reset() != ERROR_OK) {
+            failed_count++;
+            continue;
+        }
+        int64_t t1 = esp_timer_get_time();
+
+        // 阶段2: 波特率和工作模式(回环模式，首帧无需总线上的应答)
+        MCP2515_CONFIG_t config;
+        MCP2515_configInit(config, CANCTRL_REQOP_LOOPBACK);
+        MCP2515_configBitrate(config, CAN_500KBPS, MCP_8MHZ);
+        if (MCP2515_configApply(config) != ERROR_OK) {
+            failed_count++;
+            continue;
+        }
+        int64_t t2 = esp_timer_get_time();
+
+        // 阶段3: 首帧发送完成(TXREQ清零)
+        bool sent = false;
+        if (MCP2515_sendMessageAfterCtrlCheck(&test_frame) == ERROR_OK) {
+            while (esp_timer_get_time() - t2 < 10000) {
+                if ((MCP2515_readRegister(MCP_TXB0CTRL) & TXB_TXREQ) == 0) {
+                    sent = true;
+                    break;
+                }
+            }
+        }
+        int64_t t3 = esp_timer_get_time();
+        if (!sent) {
+            failed_count++;
+            continue;
+        }
+
+        osc_sum += MCP2515_getResetTime();
+        reset_sum += t1 - t0;
+        config_sum += t2 - t1;
+        frame_sum += t3 - t2;
+        if (t1 - t0 > reset_max) reset_max = t1 - t0;
+        if (t2 - t1 > config_max) config_max = t2 - t1;
+        if (t3 - t2 > frame_max) frame_max = t3 - t2;
+    }
+
+    uint32_t ok_count = iterations - failed_count;
+    if (ok_count == 0) {
+        ESP_LOGE(TAG, "Boot benchmark FAILED - no successful iteration");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Boot time benchmark completed (%lu iterations):", ok_count);
+    ESP_LOGI(TAG, "  RESET -> config mode: %lu us avg", osc_sum / ok_count);
+    ESP_LOGI(TAG, "  reset():              %lld us avg, %lld us max", reset_sum / ok_count, reset_max);
+    ESP_LOGI(TAG, "  bitrate + mode:       %lld us avg, %lld us max", config_sum / ok_count, config_max);
+    ESP_LOGI(TAG, "  first frame sent:     %lld us avg, %lld us max", frame_sum / ok_count, frame_max);
+    ESP_LOGI(TAG, "  total time-to-ready:  %lld us avg",
+             (reset_sum + config_sum + frame_sum) / ok_count);
+    if (failed_count != 0) {
+        ESP_LOGE(TAG, "Boot benchmark: %lu iterations failed", failed_count);
+    }
+
+    // 恢复正常模式
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configBitrate(config, CAN_500KBPS, MCP_8MHZ);
+    MCP2515_configApply(config);
+}
+
+// 环形缓冲区测试: 生产者/消费者分别运行在两个核上，检查顺序、丢帧计数和单帧开销
+#define RING_TEST_FRAMES 100000
+
+static CAN_RING ring_test_ring;
+static volatile bool ring_test_producer_done;
+
+static void can_ring_test_producer(void *pvParameters)
+{
+    CAN_FRAME_TS_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.frame.can_id = TEST_MSG_ID_1;
+    frame.frame.can_dlc = 8;
+    for (uint32_t seq = 0; seq < RING_TEST_FRAMES; seq++) {
+        memcpy(frame.frame.data, &seq, sizeof(seq));
+        // 满时丢帧并计数，与接收任务的行为一致
+        CAN_RING_push(ring_test_ring, &frame);
+    }
+    ring_test_producer_done = true;
+    vTaskDelete(NULL);
+}
+
+void can_ring_test(void)
+{
+    ESP_LOGI(TAG, "Starting CAN ring test...");
+
+    ring_test_ring = CAN_RING_create(64);
+    if (ring_test_ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create ring");
+        return;
+    }
+
+    // 单线程开销
+    const uint32_t iterations = 1000;
+    CAN_FRAME_TS_t frames[8];
+    memset(frames, 0, sizeof(frames));
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++) {
+        CAN_RING_push(ring_test_ring, &frames[0]);
+    }
+    uint32_t push_cycles = (esp_cpu_get_cycle_count() - start) / iterations;
+    uint32_t popped = 0;
+    start = esp_cpu_get_cycle_count();
+    while (CAN_RING_popBatch(ring_test_ring, frames, 8) > 0) {
+        popped++;
+    }
+    uint32_t pop_cycles = (esp_cpu_get_cycle_count() - start) / (popped ? popped : 1);
+    CAN_RING_destroy(ring_test_ring);
+
+    // 双核并发: 序号必须严格递增，缺口数必须等于丢帧计数
+    ring_test_ring = CAN_RING_create(64);
+    if (ring_test_ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create ring");
+        return;
+    }
+    ring_test_producer_done = false;
+    // 生产者放在另一个核上
+    xTaskCreatePinnedToCore(can_ring_test_producer, "ring_producer", 4096, NULL, 5, NULL, 1 - xPortGetCoreID());
+
+    uint32_t received = 0;
+    uint32_t missing = 0;
+    uint32_t order_errors = 0;
+    uint32_t expected = 0;
+    while (!ring_test_producer_done || CAN_RING_count(ring_test_ring) > 0) {
+        uint32_t n = CAN_RING_popBatch(ring_test_ring, frames, 8);
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t seq;
+            memcpy(&seq, frames[i].frame.data, sizeof(seq));
+            if (seq < expected) {
+                order_errors++;
+            } else {
+                missing += seq - expected;
+                expected = seq + 1;
+            }
+            received++;
+        }
+        if (n == 0) {
+            taskYIELD();
+        }
+    }
+    missing += RING_TEST_FRAMES - expected;
+
+    CAN_RING_STATS_t stats;
+    CAN_RING_getStats(ring_test_ring, &stats);
+    CAN_RING_destroy(ring_test_ring);
+    ring_test_ring = NULL;
+
+    ESP_LOGI(TAG, "Ring test completed:");
+    ESP_LOGI(TAG, "  push: %lu cycles/frame, popBatch(8): %lu cycles/batch", push_cycles, pop_cycles);
+    ESP_LOGI(TAG, "  received %lu/%u, dropped %lu, high water %lu/%lu",
+             received, RING_TEST_FRAMES, stats.dropped, stats.high_water, stats.capacity);
+    if (order_errors == 0 && missing == stats.dropped && received + stats.dropped == RING_TEST_FRAMES) {
+        ESP_LOGI(TAG, "Ring test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Ring test FAILED - %lu order errors, %lu missing vs %lu dropped",
+                 order_errors, missing, stats.dropped);
+    }
+}
+
+// 连续接收测试: 回环模式下连续发送带序号的报文，边发边排空接收缓冲区，检查顺序和丢帧
+// (与接收任务同时运行时报文可能被接收任务读走，计为缺失)
+void can_rx_drain_test(void)
+{
+    ESP_LOGI(TAG, "Starting RX drain test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    CAN_RING ring = CAN_RING_create(32);
+    if (ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create ring");
+        return;
+    }
+
+    const uint32_t test_messages = 1000;
+    MCP2515_RX_STATS_t before, after;
+    MCP2515_getRxStats(&before);
+
+    CAN_FRAME_t frame;
+    frame.can_id = TEST_MSG_ID_2;
+    frame.can_dlc = 4;
+    memset(frame.data, 0, 8);
+
+    CAN_FRAME_TS_t frames[8];
+    uint32_t received = 0;
+    uint32_t missing = 0;
+    uint32_t order_errors = 0;
+    uint32_t timestamp_errors = 0;
+    int64_t last_timestamp_us = 0;
+    uint32_t expected = 0;
+    uint32_t seq = 0;
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + 2000000;
+
+    while ((seq < test_messages || expected < test_messages) && esp_timer_get_time() < deadline) {
+        if (seq < test_messages) {
+            memcpy(frame.data, &seq, sizeof(seq));
+            if (MCP2515_sendMessageAfterCtrlCheck(&frame) == ERROR_OK) {
+                seq++;
+            }
+        }
+        MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        uint32_t n;
+        while ((n = CAN_RING_popBatch(ring, frames, 8)) > 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t got;
+                memcpy(&got, frames[i].frame.data, sizeof(got));
+                // 时间戳必须随到达顺序单调不减
+                if (frames[i].timestamp_us < last_timestamp_us) {
+                    timestamp_errors++;
+                }
+                last_timestamp_us = frames[i].timestamp_us;
+                if (got < expected) {
+                    order_errors++;
+                } else {
+                    missing += got - expected;
+                    expected = got + 1;
+                }
+                received++;
+            }
+        }
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    missing += test_messages - expected;
+    MCP2515_getRxStats(&after);
+    CAN_RING_destroy(ring);
+
+    ESP_LOGI(TAG, "RX drain test completed in %lld us:", duration_us);
+    ESP_LOGI(TAG, "  sent %lu, received %lu, missing %lu, order errors %lu, timestamp errors %lu",
+             seq, received, missing, order_errors, timestamp_errors);
+    ESP_LOGI(TAG, "  overruns %lu, dropped %lu, reordered %lu",
+             after.overruns - before.overruns, after.dropped - before.dropped,
+             after.reordered - before.reordered);
+    if (missing == 0 && order_errors == 0 && timestamp_errors == 0) {
+        ESP_LOGI(TAG, "RX drain test PASSED");
+    } else {
+        ESP_LOGE(TAG, "RX drain test FAILED");
+    }
+
+    MCP2515_setNormalMode();
+}
+
+// 中断延迟测试: 回环模式下逐帧发送，统计INT拉低到中断服务任务开始处理的延迟分布
+// (需要先调用MCP2515_ESP_IRQ_start()启动中断服务任务)
+void can_irq_latency_test(void)
+{
+    ESP_LOGI(TAG, "Starting INT latency test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    const uint32_t test_messages = 500;
+    CAN_FRAME_t frame;
+    frame.can_id = TEST_MSG_ID_1;
+    frame.can_dlc = 2;
+    memset(frame.data, 0, 8);
+
+    MCP2515_ESP_IRQ_resetStats();
+    uint32_t sent = 0;
+    for (uint32_t i = 0; i < test_messages; i++) {
+        frame.data[0] = (i >> 8) & 0xFF;
+        frame.data[1] = i & 0xFF;
+        if (MCP2515_sendMessageAfterCtrlCheck(&frame) == ERROR_OK) {
+            sent++;
+        }
+        // 每帧间隔2ms，使每次中断单独计时
+        vTaskDelay(pdMS_TO_TICKS(2));
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    MCP2515_ESP_IRQ_STATS_t stats;
+    MCP2515_ESP_IRQ_getStats(&stats);
+    ESP_LOGI(TAG, "INT latency test: %lu frames sent", (unsigned long)sent);
+    MCP2515_ESP_IRQ_logStats(TAG);
+    if (stats.wakeups > 0 && stats.idle_hits == 0) {
+        ESP_LOGI(TAG, "INT latency test PASSED");
+    } else {
+        ESP_LOGE(TAG, "INT latency test FAILED");
+    }
+
+    MCP2515_setNormalMode();
+}
+
+// 帧池测试: 一个生产者把同一帧的指针分发给多个消费者(不拷贝)，最后一个消费者释放后帧回到池中
+#define POOL_TEST_FRAMES    20000
+#define POOL_TEST_CONSUMERS 3
+
+static QueueHandle_t pool_test_queues[POOL_TEST_CONSUMERS];
+static volatile uint32_t pool_test_sums[POOL_TEST_CONSUMERS];
+static volatile uint32_t pool_test_done;
+
+static void can_pool_test_consumer(void *pvParameters)
+{
+    const int index = (int)(intptr_t)pvParameters;
+    CAN_POOL_FRAME frame;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < POOL_TEST_FRAMES; i++) {
+        xQueueReceive(pool_test_queues[index], &frame, portMAX_DELAY);
+        sum += frame->rx.frame.can_id;
+        CAN_POOL_release(frame);
+    }
+    pool_test_sums[index] = sum;
+    pool_test_done++;
+    vTaskDelete(NULL);
+}
+
+void can_pool_test(void)
+{
+    ESP_LOGI(TAG, "Starting CAN frame pool test...");
+
+    CAN_POOL pool = CAN_POOL_create(32);
+    if (pool == NULL) {
+        ESP_LOGE(TAG, "Failed to create pool");
+        return;
+    }
+    for (int i = 0; i < POOL_TEST_CONSUMERS; i++) {
+        pool_test_queues[i] = xQueueCreate(16, sizeof(CAN_POOL_FRAME));
+        if (pool_test_queues[i] == NULL) {
+            ESP_LOGE(TAG, "Failed to create consumer queue");
+            return;
+        }
+    }
+    pool_test_done = 0;
+    for (int i = 0; i < POOL_TEST_CONSUMERS; i++) {
+        xTaskCreatePinnedToCore(can_pool_test_consumer, "pool_consumer", 4096, (void *)(intptr_t)i, 5, NULL, i % 2);
+    }
+
+    uint32_t expected = 0;
+    uint32_t waits = 0;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t seq = 0; seq < POOL_TEST_FRAMES; seq++) {
+        CAN_POOL_FRAME frame;
+        // 池耗尽时等待消费者释放
+        while ((frame = CAN_POOL_alloc(pool)) == NULL) {
+            waits++;
+            taskYIELD();
+        }
+        frame->rx.frame.can_id = seq & CAN_SFF_MASK;
+        frame->rx.frame.can_dlc = 0;
+        frame->rx.timestamp_us = esp_timer_get_time();
+        frame->rx.ts_source = CAN_TS_READ;
+        expected += seq & CAN_SFF_MASK;
+        // 每个消费者持有一个引用，生产者随后释放自己的引用
+        for (int i = 0; i < POOL_TEST_CONSUMERS; i++) {
+            CAN_POOL_retain(frame);
+            xQueueSend(pool_test_queues[i], &frame, portMAX_DELAY);
+        }
+        CAN_POOL_release(frame);
+    }
+    while (pool_test_done < POOL_TEST_CONSUMERS) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+
+    CAN_POOL_STATS_t stats;
+    CAN_POOL_getStats(pool, &stats);
+    bool sums_ok = true;
+    for (int i = 0; i < POOL_TEST_CONSUMERS; i++) {
+        sums_ok &= (pool_test_sums[i] == expected);
+        vQueueDelete(pool_test_queues[i]);
+    }
+    CAN_POOL_destroy(pool);
+
+    ESP_LOGI(TAG, "Frame pool test completed in %lld us:", duration_us);
+    ESP_LOGI(TAG, "  %u frames to %d consumers, in use %lu, high water %lu/%lu, exhausted %lu (producer waits %lu)",
+             POOL_TEST_FRAMES, POOL_TEST_CONSUMERS, stats.in_use, stats.high_water, stats.capacity,
+             stats.exhausted, waits);
+    ESP_LOGI(TAG, "  alloc: avg %lu cycles, max %lu cycles", stats.alloc_cycles_avg, stats.alloc_cycles_max);
+    if (sums_ok && stats.in_use == 0) {
+        ESP_LOGI(TAG, "Frame pool test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Frame pool test FAILED");
+    }
+}
+
+// 软件过滤器测试: 150个标准帧ID和48个扩展帧区间，检查匹配结果并测量查找速度
+void can_soft_filter_test(void)
+{
+    ESP_LOGI(TAG, "Starting software filter test...");
+
+    CAN_FILTER filter = CAN_FILTER_create(48);
+    if (filter == NULL) {
+        ESP_LOGE(TAG, "Failed to create filter");
+        return;
+    }
+    for (uint32_t i = 0; i < 150; i++) {
+        CAN_FILTER_addId(filter, (i * 13) & CAN_SFF_MASK);
+    }
+    for (uint32_t i = 0; i < 48; i++) {
+        const canid_t first = TEST_MSG_ID_EXT + i * 0x1000;
+        CAN_FILTER_addRange(filter, first | CAN_EFF_FLAG, (first + 0x7F) | CAN_EFF_FLAG);
+    }
+    CAN_FILTER_seal(filter);
+
+    uint32_t errors = 0;
+    errors += !CAN_FILTER_match(filter, 13 * 7);
+    errors += CAN_FILTER_match(filter, 13 * 7 + 1);
+    errors += !CAN_FILTER_match(filter, (TEST_MSG_ID_EXT + 0x7F) | CAN_EFF_FLAG);
+    errors += CAN_FILTER_match(filter, (TEST_MSG_ID_EXT + 0x80) | CAN_EFF_FLAG);
+    errors += CAN_FILTER_match(filter, TEST_MSG_ID_EXT);  // 标准帧不查扩展帧区间
+
+    // 查找速度: 标准帧和扩展帧交替
+    const uint32_t lookups = 200000;
+    volatile uint32_t hits = 0;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < lookups; i++) {
+        const canid_t id = (i & 1) ? (i & CAN_SFF_MASK)
+                                   : ((TEST_MSG_ID_EXT + (i & 0x3FFFF)) | CAN_EFF_FLAG);
+        hits += CAN_FILTER_match(filter, id);
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    CAN_FILTER_destroy(filter);
+
+    ESP_LOGI(TAG, "Software filter test completed:");
+    ESP_LOGI(TAG, "  %lu lookups in %lld us (%.2f M lookups/s), %lu hits",
+             lookups, duration_us, (float)lookups / (duration_us > 0 ? duration_us : 1), hits);
+    if (errors == 0) {
+        ESP_LOGI(TAG, "Software filter test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Software filter test FAILED - %lu wrong matches", errors);
+    }
+}
+
+// 掩码/过滤器求解测试: 由期望接收的ID计算两个掩码和六个过滤器，回环模式下验证期望ID全部通过、
+// 已知的无关报文被挡住
+void can_filter_solver_test(void)
+{
+    ESP_LOGI(TAG, "Starting filter solver test...");
+
+    MCP2515_FILTER_ID_t ids[16];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){ .id = 0x100 + i, .rate = 10, .wanted = true };
+    }
+    ids[count++] = (MCP2515_FILTER_ID_t){ .id = TEST_MSG_ID_1, .rate = 100, .wanted = true };
+    for (uint32_t i = 0; i < 4; i++) {
+        ids[count++] = (MCP2515_FILTER_ID_t){ .id = (TEST_MSG_ID_EXT + i) | CAN_EFF_FLAG, .rate = 20, .wanted = true };
+    }
+    // 总线上已知的高频无关报文
+    ids[count++] = (MCP2515_FILTER_ID_t){ .id = TEST_MSG_ID_2, .rate = 1000, .wanted = false };
+    const uint32_t wanted = count - 1;
+
+    MCP2515_FILTER_PLAN_t plan;
+    int64_t start = esp_timer_get_time();
+    ERROR_t result = MCP2515_solveFilters(ids, count, 1.0f, &plan);
+    int64_t solve_us = esp_timer_get_time() - start;
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Filter solver failed: %d", result);
+        return;
+    }
+    ESP_LOGI(TAG, "Solved in %lld us: RXM0 0x%08lX, RXM1 0x%08lX, %lu false IDs (%.1f frames/s)",
+             solve_us, plan.mask[0], plan.mask[1], plan.false_ids, plan.false_rate);
+    for (int i = 0; i < 6; i++) {
+        ESP_LOGI(TAG, "  RXF%d: 0x%08lX%s", i, plan.filter[i], plan.filter_ext[i] ? " (ext)" : "");
+    }
+
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_LOOPBACK);
+    MCP2515_configFilterPlan(config, &plan);
+    result = MCP2515_configApply(config);
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to apply filter plan: %d", result);
+        return;
+    }
+
+    CAN_RING ring = CAN_RING_create(32);
+    if (ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create ring");
+        return;
+    }
+    CAN_FRAME_t frame;
+    frame.can_dlc = 0;
+    uint32_t received = 0;
+    uint32_t leaked = 0;
+    CAN_FRAME_TS_t frames[8];
+    for (uint32_t i = 0; i < count; i++) {
+        frame.can_id = ids[i].id;
+        while (MCP2515_sendMessageAfterCtrlCheck(&frame) != ERROR_OK) {
+            MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        }
+        vTaskDelay(pdMS_TO_TICKS(2));
+        MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        uint32_t n;
+        while ((n = CAN_RING_popBatch(ring, frames, 8)) > 0) {
+            for (uint32_t j = 0; j < n; j++) {
+                if (frames[j].frame.can_id == TEST_MSG_ID_2) {
+                    leaked++;
+                } else {
+                    received++;
+                }
+            }
+        }
+    }
+    CAN_RING_destroy(ring);
+
+    // 恢复为接收所有报文
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configFilterMask(config, MASK0, true, 0);
+    MCP2515_configFilterMask(config, MASK1, true, 0);
+    MCP2515_configApply(config);
+
+    ESP_LOGI(TAG, "Filter solver test: %lu/%lu wanted frames received, %lu unwanted frames leaked",
+             received, wanted, leaked);
+    if (received == wanted && leaked == 0) {
+        ESP_LOGI(TAG, "Filter solver test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Filter solver test FAILED");
+    }
+}
+
+// 分发表测试: 按过滤器命中号和ID哈希表把帧交给处理函数，回环模式下检查路由结果，
+// 并比较订阅16个和512个ID时单次路由的耗时
+typedef struct {
+    volatile uint32_t calls;
+    volatile uint8_t filhit;
+} dispatch_test_counter_t;
+
+static void dispatch_test_handler(void *arg, const CAN_FRAME_TS rx)
+{
+    dispatch_test_counter_t *counter = (dispatch_test_counter_t *)arg;
+    counter->filhit = rx->filhit;
+    counter->calls++;
+}
+
+static float dispatch_route_ns(const uint32_t subscribed)
+{
+    CAN_DISPATCH_CONFIG_t dispatch_config = CAN_DISPATCH_DEFAULT_CONFIG(subscribed);
+    dispatch_config.queue_len = 0;
+    CAN_DISPATCH dispatch = CAN_DISPATCH_create(&dispatch_config);
+    if (dispatch == NULL) {
+        return -1.0f;
+    }
+    static dispatch_test_counter_t sink;
+    for (uint32_t i = 0; i < subscribed; i++) {
+        CAN_DISPATCH_onId(dispatch, (TEST_MSG_ID_EXT + i * 7) | CAN_EFF_FLAG, CAN_DISPATCH_INLINE,
+                          dispatch_test_handler, &sink);
+    }
+    CAN_DISPATCH_seal(dispatch);
+
+    const uint32_t routes = 100000;
+    CAN_FRAME_TS_t rx = { .filhit = CAN_FILHIT_UNKNOWN };
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < routes; i++) {
+        rx.frame.can_id = (TEST_MSG_ID_EXT + (i % subscribed) * 7) | CAN_EFF_FLAG;
+        CAN_DISPATCH_route(dispatch, &rx);
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    CAN_DISPATCH_destroy(dispatch);
+    return duration_us * 1000.0f / routes;
+}
+
+void can_dispatch_test(void)
+{
+    ESP_LOGI(TAG, "Starting dispatch table test...");
+
+    // RXB0: RXF0=0x100, RXF1=0x110; RXB1: RXF2..RXF5=0x200..0x500, 每个过滤器放行16个ID
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_LOOPBACK);
+    MCP2515_configFilterMask(config, MASK0, false, 0x7F0);
+    MCP2515_configFilterMask(config, MASK1, false, 0x7F0);
+    const canid_t bases[CAN_DISPATCH_FILTERS] = {0x100, 0x110, 0x200, 0x300, 0x400, 0x500};
+    const RXF_t filters[CAN_DISPATCH_FILTERS] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
+    for (int i = 0; i < CAN_DISPATCH_FILTERS; i++) {
+        MCP2515_configFilter(config, filters[i], false, bases[i]);
+    }
+    MCP2515_configRxBuffer(config, RXB0, RXBnCTRL_RXM_STDEXT, true);
+    MCP2515_configRxBuffer(config, RXB1, RXBnCTRL_RXM_STDEXT, false);
+    ERROR_t result = MCP2515_configApply(config);
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to apply filters: %d", result);
+        return;
+    }
+
+    CAN_DISPATCH_CONFIG_t dispatch_config = CAN_DISPATCH_DEFAULT_CONFIG(16);
+    CAN_DISPATCH dispatch = CAN_DISPATCH_create(&dispatch_config);
+    if (dispatch == NULL) {
+        ESP_LOGE(TAG, "Failed to create dispatch table");
+        return;
+    }
+    static dispatch_test_counter_t by_filter[CAN_DISPATCH_FILTERS];
+    static dispatch_test_counter_t by_id;
+    memset(by_filter, 0, sizeof(by_filter));
+    memset(&by_id, 0, sizeof(by_id));
+    for (int i = 0; i < CAN_DISPATCH_FILTERS; i++) {
+        // RXF3 的帧交给工作任务处理
+        CAN_DISPATCH_onFilter(dispatch, i, (i == 3) ? CAN_DISPATCH_DEFERRED : CAN_DISPATCH_INLINE,
+                              dispatch_test_handler, &by_filter[i]);
+    }
+    // 单独订阅的ID优先于它所在的过滤器
+    CAN_DISPATCH_onId(dispatch, 0x105, CAN_DISPATCH_INLINE, dispatch_test_handler, &by_id);
+    MCP2515_setRxDispatch(dispatch);
+
+    CAN_RING ring = CAN_RING_create(8);
+    if (ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create ring");
+        MCP2515_setRxDispatch(NULL);
+        CAN_DISPATCH_destroy(dispatch);
+        return;
+    }
+    CAN_FRAME_t frame;
+    frame.can_dlc = 0;
+    const uint32_t rounds = 4;
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (int i = 0; i <= CAN_DISPATCH_FILTERS; i++) {
+            frame.can_id = (i < CAN_DISPATCH_FILTERS) ? bases[i] + round : 0x105;
+            while (MCP2515_sendMessageAfterCtrlCheck(&frame) != ERROR_OK) {
+                MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+            }
+            vTaskDelay(pdMS_TO_TICKS(2));
+            MCP2515_drainRx(ring, 0, CAN_TS_NONE);
+        }
+    }
+    vTaskDelay(pdMS_TO_TICKS(10)); // 等待工作任务处理完延迟帧
+    const uint32_t leftover = CAN_RING_count(ring);
+    MCP2515_setRxDispatch(NULL);
+    CAN_RING_destroy(ring);
+
+    CAN_DISPATCH_STATS_t stats;
+    CAN_DISPATCH_getStats(dispatch, &stats);
+    CAN_DISPATCH_destroy(dispatch);
+
+    // 恢复为接收所有报文
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    MCP2515_configFilterMask(config, MASK0, true, 0);
+    MCP2515_configFilterMask(config, MASK1, true, 0);
+    MCP2515_configApply(config);
+
+    uint32_t errors = leftover;
+    for (int i = 0; i < CAN_DISPATCH_FILTERS; i++) {
+        if (by_filter[i].calls != rounds || by_filter[i].filhit != i) {
+            ESP_LOGE(TAG, "  RXF%d: %lu calls, last filhit %u", i, by_filter[i].calls, by_filter[i].filhit);
+            errors++;
+        }
+    }
+    if (by_id.calls != rounds) {
+        errors++;
+    }
+
+    const float small_ns = dispatch_route_ns(16);
+    const float large_ns = dispatch_route_ns(512);
+
+    ESP_LOGI(TAG, "Dispatch table test completed:");
+    ESP_LOGI(TAG, "  by ID: %lu, by filter: %lu, deferred: %lu, unhandled: %lu, ring: %lu",
+             stats.by_id, stats.by_filter, stats.deferred, stats.unhandled, leftover);
+    ESP_LOGI(TAG, "  route: %.0f ns with 16 IDs, %.0f ns with 512 IDs", small_ns, large_ns);
+    if (errors == 0) {
+        ESP_LOGI(TAG, "Dispatch table test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Dispatch table test FAILED - %lu errors", errors);
+    }
+}
+
+// 自适应中断/轮询测试: 回环模式下以10%~90%的总线负载发送，分别在纯中断和自适应模式下
+// 统计中断服务任务的CPU占用和从发送到分发的延迟。应在核心0上运行(中断服务任务在核心1)
+#define ADAPTIVE_TEST_FRAME_BITS 130  // 8字节标准帧含填充位约130位
+#define ADAPTIVE_TEST_BIT_US     2    // 500kbps
+#define ADAPTIVE_TEST_RUN_US     1000000
+
+typedef struct {
+    volatile uint32_t frames;
+    volatile uint32_t latency_sum_us;
+    volatile uint32_t latency_max_us;
+} adaptive_test_latency_t;
+
+static void adaptive_test_handler(void *arg, const CAN_FRAME_TS rx)
+{
+    adaptive_test_latency_t *latency = (adaptive_test_latency_t *)arg;
+    const uint8_t *d = rx->frame.data;
+    const uint32_t sent_us = ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+    const uint32_t delay_us = (uint32_t)esp_timer_get_time() - sent_us;
+    latency->latency_sum_us += delay_us;
+    if (delay_us > latency->latency_max_us) {
+        latency->latency_max_us = delay_us;
+    }
+    latency->frames++;
+}
+
+void can_adaptive_irq_test(void)
+{
+    ESP_LOGI(TAG, "Starting adaptive INT/polling test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    static adaptive_test_latency_t latency;
+    CAN_DISPATCH_CONFIG_t dispatch_config = CAN_DISPATCH_DEFAULT_CONFIG(1);
+    dispatch_config.queue_len = 0;
+    CAN_DISPATCH dispatch = CAN_DISPATCH_create(&dispatch_config);
+    if (dispatch == NULL) {
+        ESP_LOGE(TAG, "Failed to create dispatch table");
+        return;
+    }
+    CAN_DISPATCH_onId(dispatch, TEST_MSG_ID_1, CAN_DISPATCH_INLINE, adaptive_test_handler, &latency);
+    MCP2515_setRxDispatch(dispatch);
+
+    CAN_FRAME_t frame;
+    frame.can_id = TEST_MSG_ID_1;
+    frame.can_dlc = 8;
+    memset(frame.data, 0x55, 8);
+
+    const uint8_t thresholds[2] = {0, 3}; // 纯中断, 自适应
+    bool polled_at_high_load = false;
+    for (int mode = 0; mode < 2; mode++) {
+        MCP2515_ESP_IRQ_setAdaptive(thresholds[mode], 250, 4);
+        for (uint32_t load = 10; load <= 90; load += 20) {
+            const uint32_t period_us = ADAPTIVE_TEST_FRAME_BITS * ADAPTIVE_TEST_BIT_US * 100 / load;
+            memset((void *)&latency, 0, sizeof(latency));
+            vTaskDelay(pdMS_TO_TICKS(20));
+            MCP2515_ESP_IRQ_resetStats();
+
+            uint32_t sent = 0;
+            const int64_t start = esp_timer_get_time();
+            int64_t next = start;
+            while (next - start < ADAPTIVE_TEST_RUN_US) {
+                // 忙等到下一帧的发送时刻，节拍周期(1ms以上)对高负载来说太粗
+                while (esp_timer_get_time() < next) {
+                }
+                const uint32_t now = (uint32_t)esp_timer_get_time();
+                frame.data[0] = (now >> 24) & 0xFF;
+                frame.data[1] = (now >> 16) & 0xFF;
+                frame.data[2] = (now >> 8) & 0xFF;
+                frame.data[3] = now & 0xFF;
+                if (MCP2515_sendMessageAfterCtrlCheck(&frame) == ERROR_OK) {
+                    sent++;
+                }
+                next += period_us;
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+
+            MCP2515_ESP_IRQ_STATS_t stats;
+            MCP2515_ESP_IRQ_getStats(&stats);
+            const int64_t elapsed_us = esp_timer_get_time() - stats.since_us;
+            const float cpu = elapsed_us > 0 ? 100.0f * (float)stats.busy_us / (float)elapsed_us : 0.0f;
+            ESP_LOGI(TAG, "  %s load %2lu%%: %lu/%lu frames, CPU %.1f%%, latency avg %lu us max %lu us, "
+                     "%lu wake-ups, %lu polls",
+                     mode ? "adaptive " : "interrupt", load, latency.frames, sent, cpu,
+                     latency.frames ? latency.latency_sum_us / latency.frames : 0, latency.latency_max_us,
+                     stats.wakeups, stats.polls);
+            if (mode == 1 && load == 90 && stats.polls > 0) {
+                polled_at_high_load = true;
+            }
+        }
+    }
+
+    MCP2515_ESP_IRQ_setAdaptive(3, 250, 4);
+    MCP2515_setRxDispatch(NULL);
+    CAN_DISPATCH_destroy(dispatch);
+    MCP2515_setNormalMode();
+
+    if (polled_at_high_load) {
+        ESP_LOGI(TAG, "Adaptive INT/polling test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Adaptive INT/polling test FAILED - no polling at 90%% load");
+    }
+}
+
+// 发送队列优先级测试: 先提交一批低优先级的大块数据帧，再提交一个紧急控制帧，
+// 紧急帧应抢占邮箱(中止最不紧急的一个)，最多排在已经上总线的几帧之后
+#define TXQ_TEST_BULK 12
+
+static canid_t txq_test_order[TXQ_TEST_BULK + 1];
+static volatile uint32_t txq_test_received;
+
+static void txq_test_handler(void *arg, const CAN_FRAME_TS rx)
+{
+    if (txq_test_received < TXQ_TEST_BULK + 1) {
+        txq_test_order[txq_test_received] = rx->frame.can_id;
+    }
+    txq_test_received++;
+}
+
+void can_tx_priority_test(void)
+{
+    ESP_LOGI(TAG, "Starting TX priority queue test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    MCP2515_TXQ txq = MCP2515_TXQ_create(32);
+    CAN_DISPATCH_CONFIG_t dispatch_config = CAN_DISPATCH_DEFAULT_CONFIG(0);
+    dispatch_config.queue_len = 0;
+    CAN_DISPATCH dispatch = CAN_DISPATCH_create(&dispatch_config);
+    if (txq == NULL || dispatch == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX queue or dispatch table");
+        MCP2515_TXQ_destroy(txq);
+        CAN_DISPATCH_destroy(dispatch);
+        return;
+    }
+    // 无论哪个过滤器命中，都按到达顺序记录
+    for (int i = 0; i < CAN_DISPATCH_FILTERS; i++) {
+        CAN_DISPATCH_onFilter(dispatch, i, CAN_DISPATCH_INLINE, txq_test_handler, NULL);
+    }
+    txq_test_received = 0;
+    MCP2515_setRxDispatch(dispatch);
+    MCP2515_TXQ previous = MCP2515_setTxQueue(txq);
+
+    CAN_FRAME_t frame;
+    frame.can_dlc = 8;
+    memset(frame.data, 0x5A, 8);
+    for (uint32_t i = 0; i < TXQ_TEST_BULK; i++) {
+        frame.can_id = 0x700 + i;
+        MCP2515_sendMessageAfterCtrlCheck(&frame);
+    }
+    frame.can_id = 0x010;
+    MCP2515_sendMessageAfterCtrlCheck(&frame);
+
+    for (int wait = 0; wait < 100 && MCP2515_TXQ_pending(txq) > 0; wait++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    vTaskDelay(pdMS_TO_TICKS(5));
+
+    const uint32_t pending = MCP2515_TXQ_pending(txq);
+    MCP2515_setTxQueue(previous);
+    MCP2515_setRxDispatch(NULL);
+    MCP2515_TXQ_logStats(txq, TAG);
+    MCP2515_TXQ_destroy(txq);
+    CAN_DISPATCH_destroy(dispatch);
+    MCP2515_setNormalMode();
+
+    uint32_t urgent_at = TXQ_TEST_BULK + 1;
+    uint32_t out_of_order = 0;
+    uint32_t next_bulk = 0x700;
+    for (uint32_t i = 0; i < txq_test_received && i < TXQ_TEST_BULK + 1; i++) {
+        if (txq_test_order[i] == 0x010) {
+            urgent_at = i;
+        } else if (txq_test_order[i] != next_bulk++) {
+            out_of_order++;
+        }
+    }
+    ESP_LOGI(TAG, "TX priority test: %lu frames received, urgent frame at position %lu",
+             txq_test_received, urgent_at);
+    // 提交紧急帧时最多有一帧正在总线上，再加上中止来不及的情况
+    if (pending == 0 && txq_test_received == TXQ_TEST_BULK + 1 && urgent_at <= 2 && out_of_order == 0) {
+        ESP_LOGI(TAG, "TX priority test PASSED");
+    } else {
+        ESP_LOGE(TAG, "TX priority test FAILED - %lu pending, %lu out of order", pending, out_of_order);
+    }
+}
+
+// 异步发送测试: 生产者阻塞等待队列空位而不是轮询ERROR_ALLTXBUSY，
+// 完成回调统计结果，三个邮箱始终保持装满，测量回环模式下的吞吐量
+#define TX_ASYNC_TEST_FRAMES 500
+#define TX_ASYNC_TEST_QUEUE  8
+
+static volatile uint32_t tx_async_done;
+static volatile uint32_t tx_async_failed;
+static volatile uint32_t tx_async_out_of_order;
+static volatile MCP2515_TX_HANDLE tx_async_last;
+static volatile int64_t tx_async_last_us;
+
+static void tx_async_test_done(const MCP2515_TX_EVENT_t *event)
+{
+    if (event->result != MCP2515_TX_DONE) {
+        tx_async_failed++;
+    }
+    // ID相同的帧按提交顺序完成
+    if (tx_async_last != 0 && (int32_t)(event->handle - tx_async_last) <= 0) {
+        tx_async_out_of_order++;
+    }
+    tx_async_last = event->handle;
+    tx_async_last_us = event->done_us;
+    tx_async_done++;
+}
+
+void can_tx_async_test(void)
+{
+    ESP_LOGI(TAG, "Starting async TX test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    MCP2515_TXQ txq = MCP2515_TXQ_create(TX_ASYNC_TEST_QUEUE);
+    if (txq == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX queue");
+        return;
+    }
+    tx_async_done = 0;
+    tx_async_failed = 0;
+    tx_async_out_of_order = 0;
+    tx_async_last = 0;
+    MCP2515_TXQ previous = MCP2515_setTxQueue(txq);
+
+    CAN_FRAME_t frame;
+    frame.can_id = 0x321;
+    frame.can_dlc = 8;
+    memset(frame.data, 0x55, 8);
+    uint32_t refused = 0;
+    const int64_t start_us = esp_timer_get_time();
+    for (uint32_t i = 0; i < TX_ASYNC_TEST_FRAMES; i++) {
+        frame.data[0] = i & 0xFF;
+        // 队列满时睡眠到某帧完成释放空位
+        if (MCP2515_TXQ_submitAsync(txq, &frame, pdMS_TO_TICKS(100), tx_async_test_done, NULL) == 0) {
+            refused++;
+        }
+    }
+    for (int wait = 0; wait < 100 && tx_async_done + refused < TX_ASYNC_TEST_FRAMES; wait++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    const int64_t elapsed_us = tx_async_last_us - start_us;
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    MCP2515_setTxQueue(previous);
+    MCP2515_TXQ_destroy(txq);
+    MCP2515_setNormalMode();
+
+    ESP_LOGI(TAG, "Async TX: %lu/%d completed in %lld us (%.0f frames/s), %lu refused, high water %lu",
+             tx_async_done, TX_ASYNC_TEST_FRAMES, elapsed_us,
+             elapsed_us > 0 ? tx_async_done * 1e6 / elapsed_us : 0.0, refused, stats.high_water);
+    if (tx_async_done == TX_ASYNC_TEST_FRAMES && refused == 0 && tx_async_failed == 0
+        && tx_async_out_of_order == 0) {
+        ESP_LOGI(TAG, "Async TX test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Async TX test FAILED - %lu failed, %lu out of order", tx_async_failed, tx_async_out_of_order);
+    }
+}
+
+// 广播管理器测试: 回环模式下注册300条10/20/100/1000ms周期的报文(相位错开)，
+// 运行3秒后检查没有超期，并报告抖动和调度延迟；一个控制任务同时无锁更新负载
+#define BCM_TEST_MSGS     300
+#define BCM_TEST_RUN_MS   3000
+
+static volatile bool bcm_test_writing;
+
+static void bcm_test_writer(void *arg)
+{
+    CAN_BCM bcm = (CAN_BCM)arg;
+    uint8_t data[8] = {0};
+    while (bcm_test_writing) {
+        // 所有字节写同一个值，读到不同的值说明拷贝撕裂
+        memset(data, data[0] + 1, sizeof(data));
+        CAN_BCM_setData(bcm, 0, data, sizeof(data));
+        vTaskDelay(1);
+    }
+    vTaskDelete(NULL);
+}
+
+static volatile uint32_t bcm_test_torn;
+
+static void bcm_test_check(void *arg, CAN_FRAME frame)
+{
+    for (int i = 1; i < frame->can_dlc; i++) {
+        if (frame->data[i] != frame->data[0]) {
+            bcm_test_torn++;
+            break;
+        }
+    }
+}
+
+void can_bcm_test(void)
+{
+    ESP_LOGI(TAG, "Starting broadcast manager test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    MCP2515_TXQ txq = MCP2515_TXQ_create(64);
+    CAN_BCM_CONFIG_t bcm_config = CAN_BCM_DEFAULT_CONFIG(txq, BCM_TEST_MSGS);
+    CAN_BCM bcm = (txq != NULL) ? CAN_BCM_create(&bcm_config) : NULL;
+    if (bcm == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX queue or broadcast manager");
+        MCP2515_TXQ_destroy(txq);
+        MCP2515_setNormalMode();
+        return;
+    }
+    MCP2515_TXQ previous = MCP2515_setTxQueue(txq);
+
+    // 500kbps下8字节帧约需222us，这组报文约占总线的60%
+    const uint32_t periods_ms[] = {10, 20, 100, 1000};
+    const uint32_t counts[] = {5, 20, 100, 175};
+    CAN_FRAME_t frame;
+    frame.can_dlc = 8;
+    memset(frame.data, 0, sizeof(frame.data));
+    uint32_t n = 0;
+    for (int p = 0; p < 4; p++) {
+        for (uint32_t k = 0; k < counts[p]; k++, n++) {
+            // 周期越短ID越小(优先级越高)，相位错开避免同一节拍内突发
+            frame.can_id = 0x100 + n;
+            const uint32_t phase_ms = (n * 7) % periods_ms[p];
+            CAN_BCM_add(bcm, &frame, periods_ms[p] * 1000, phase_ms * 1000,
+                        (n == 0) ? bcm_test_check : NULL, NULL);
+        }
+    }
+
+    bcm_test_torn = 0;
+    bcm_test_writing = true;
+    xTaskCreate(bcm_test_writer, "bcm_writer", 2048, bcm, 3, NULL);
+    if (CAN_BCM_start(bcm) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start broadcast manager");
+    }
+    vTaskDelay(pdMS_TO_TICKS(BCM_TEST_RUN_MS));
+    bcm_test_writing = false;
+
+    // 停止调度后等已排队的帧发完(完成回调仍会访问报文表)，再销毁
+    CAN_BCM_stop(bcm);
+    for (int wait = 0; wait < 100 && MCP2515_TXQ_pending(txq) > 0; wait++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    CAN_BCM_STATS_t stats;
+    CAN_BCM_getStats(bcm, &stats);
+    CAN_BCM_logStats(bcm, TAG);
+    CAN_BCM_destroy(bcm);
+    MCP2515_TXQ_logStats(txq, TAG);
+    MCP2515_setTxQueue(previous);
+    MCP2515_TXQ_destroy(txq);
+    MCP2515_setNormalMode();
+
+    // 3秒内的期望帧数: 5*300 + 20*150 + 100*30 + 175*3
+    const uint32_t expected = 5 * 300 + 20 * 150 + 100 * 30 + 175 * 3;
+    ESP_LOGI(TAG, "BCM test: %lu of ~%lu frames, %lu torn payloads", stats.sent, expected, bcm_test_torn);
+    if (stats.overruns == 0 && stats.refused == 0 && stats.failed == 0 && stats.expired == 0 && bcm_test_torn == 0
+        && stats.sent + BCM_TEST_MSGS >= expected) {
+        ESP_LOGI(TAG, "Broadcast manager test PASSED");
+    } else {
+        ESP_LOGE(TAG, "Broadcast manager test FAILED - %lu overruns, %lu refused, %lu failed, %lu expired",
+                 stats.overruns, stats.refused, stats.failed, stats.expired);
+    }
+}
+
+// 发送截止时间测试: 回环模式下一次提交一批1ms后截止的帧，总线只来得及发出前几帧，
+// 其余的应在队列中丢弃或从邮箱中止，按ID统计的错过次数与结果一致；不带截止时间的帧全部发出
+#define TX_DEADLINE_TEST_FRAMES 32
+#define TX_DEADLINE_TEST_US     1000
+
+static volatile uint32_t tx_deadline_done;
+static volatile uint32_t tx_deadline_expired;
+static volatile uint32_t tx_deadline_other;
+static volatile uint32_t tx_deadline_finished;
+
+static void tx_deadline_test_done(const MCP2515_TX_EVENT_t *event)
+{
+    if (event->result == MCP2515_TX_DONE) {
+        tx_deadline_done++;
+    } else if (event->result == MCP2515_TX_EXPIRED) {
+        tx_deadline_expired++;
+    } else {
+        tx_deadline_other++;
+    }
+    tx_deadline_finished++;
+}
+
+void can_tx_deadline_test(void)
+{
+    ESP_LOGI(TAG, "Starting TX deadline test...");
+
+    ERROR_t result = MCP2515_setLoopbackMode();
+    if (result != ERROR_OK) {
+        ESP_LOGE(TAG, "Failed to set loopback mode: %d", result);
+        return;
+    }
+
+    MCP2515_TXQ txq = MCP2515_TXQ_create(TX_DEADLINE_TEST_FRAMES * 2);
+    if (txq == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX queue");
+        return;
+    }
+    MCP2515_TXQ previous = MCP2515_setTxQueue(txq);
+    tx_deadline_done = 0;
+    tx_deadline_expired = 0;
+    tx_deadline_other = 0;
+    tx_deadline_finished = 0;
+
+    CAN_FRAME_t frame;
+    frame.can_dlc = 8;
+    memset(frame.data, 0xAA, 8);
+    // 8字节帧约230us，1ms内最多发出4-5帧
+    const int64_t deadline_us = esp_timer_get_time() + TX_DEADLINE_TEST_US;
+    frame.can_id = 0x2A0;
+    for (uint32_t i = 0; i < TX_DEADLINE_TEST_FRAMES; i++) {
+        MCP2515_TXQ_submitDeadline(txq, &frame, deadline_us, 0, tx_deadline_test_done, NULL);
+    }
+    frame.can_id = 0x2B0;
+    for (uint32_t i = 0; i < TX_DEADLINE_TEST_FRAMES; i++) {
+        MCP2515_TXQ_submitDeadline(txq, &frame, 0, 0, tx_deadline_test_done, NULL);
+    }
+    for (int wait = 0; wait < 100 && tx_deadline_finished < 2 * TX_DEADLINE_TEST_FRAMES; wait++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    MCP2515_TXQ_logStats(txq, TAG);
+    const uint32_t pending = MCP2515_TXQ_pending(txq);
+    MCP2515_setTxQueue(previous);
+    MCP2515_TXQ_destroy(txq);
+    MCP2515_setNormalMode();
+
+    ESP_LOGI(TAG, "TX deadline: %lu sent, %lu expired, %lu late, %lu other, %lu pending",
+             tx_deadline_done, tx_deadline_expired, stats.late, tx_deadline_other, pending);
+    const bool counted = stats.misses[0].can_id == 0x2A0 && stats.misses[0].count == stats.expired + stats.late
+                         && stats.misses[1].count == 0;
+    if (pending == 0 && tx_deadline_other == 0 && tx_deadline_finished == 2 * TX_DEADLINE_TEST_FRAMES
+        && tx_deadline_expired > 0 && tx_deadline_expired == stats.expired
+        && tx_deadline_done >= TX_DEADLINE_TEST_FRAMES && counted) {
+        ESP_LOGI(TAG, "TX deadline test PASSED");
+    } else {
+        ESP_LOGE(TAG, "TX deadline test FAILED");
+    }
+}
@@ -17,6 +17,23 @@ void can_receive_test_messages(void);
 void can_error_test(void);
 void can_performance_test(void);
 void can_filter_test(void);
+void can_rx_transaction_test(void);
+void can_tx_transaction_test(void);
+void can_spi_buffer_benchmark(void);
+void can_shadow_test(void);
+void can_boot_benchmark(void);
+void can_ring_test(void);
+void can_rx_drain_test(void);
+void can_irq_latency_test(void);
+void can_pool_test(void);
+void can_soft_filter_test(void);
+void can_filter_solver_test(void);
+void can_dispatch_test(void);
+void can_adaptive_irq_test(void);
+void can_tx_priority_test(void);
+void can_tx_async_test(void);
+void can_bcm_test(void);
+void can_tx_deadline_test(void);
 
 // 测试状态
 typedef enum {
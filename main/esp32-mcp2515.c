@@ -2,14 +2,19 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
-#include "freertos/queue.h"
 #include "can.h"
 #include "mcp2515.h"
+#include "mcp2515_esp_spi.h"
+#include "mcp2515_esp_irq.h"
+#include "mcp2515_txq.h"
+#include "can_bcm.h"
+#include "can_ring.h"
 
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "esp_intr_alloc.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_task_wdt.h"
 
 // GPIO引脚定义 - Seeed XIAO ESP32S3
@@ -18,63 +23,26 @@
 #define PIN_NUM_CLK  7
 #define PIN_NUM_CS   44
 #define PIN_NUM_INTERRUPT 43
+// MCP2515 CLKOUT/SOF引脚，连接后以帧起始沿作为接收时间戳(精度优于INT)
+#define PIN_NUM_SOF GPIO_NUM_NC
 
 #define TAG "CAN_MODULE"
 
+// 接收环形缓冲区容量(必须为2的幂)和应用任务每批读取的帧数
+#define CAN_RX_RING_SIZE 64
+#define CAN_APP_BATCH    8
+// 发送队列容量，三个发送邮箱之外等待发送的帧数
+#define CAN_TX_QUEUE_SIZE 32
+// 广播管理器可注册的周期报文数，以及示例报文的发送周期
+#define CAN_BCM_MAX_MSGS 32
+#define CAN_TX_PERIOD_US 1000000
+
 // 全局变量
 static CAN_FRAME_t can_frame_tx;
-static CAN_FRAME_t can_frame_rx;
-static QueueHandle_t can_rx_queue;
-static bool can_interrupt_flag = false;
-
-// 中断处理函数
-static void IRAM_ATTR can_isr_handler(void* arg)
-{
-    can_interrupt_flag = true;
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    xQueueSendFromISR(can_rx_queue, &can_interrupt_flag, &xHigherPriorityTaskWoken);
-    if (xHigherPriorityTaskWoken) {
-        portYIELD_FROM_ISR();
-    }
-}
-
-// 初始化GPIO中断
-static esp_err_t init_can_interrupt(void)
-{
-    esp_err_t ret;
-    
-    // 配置中断引脚为输入，上拉
-    gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_NEGEDGE,
-        .mode = GPIO_MODE_INPUT,
-        .pin_bit_mask = (1ULL << PIN_NUM_INTERRUPT),
-        .pull_down_en = 0,
-        .pull_up_en = 1,
-    };
-    
-    ret = gpio_config(&io_conf);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "GPIO config failed: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
-    // 安装GPIO中断服务
-    ret = gpio_install_isr_service(0);
-    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
-        ESP_LOGE(TAG, "GPIO ISR service install failed: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
-    // 添加中断处理函数
-    ret = gpio_isr_handler_add(PIN_NUM_INTERRUPT, can_isr_handler, NULL);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "GPIO ISR handler add failed: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
-    ESP_LOGI(TAG, "CAN interrupt initialized successfully");
-    return ESP_OK;
-}
+static CAN_RING can_rx_ring = NULL;
+static TaskHandle_t can_app_task_handle = NULL;
+static MCP2515_TXQ can_tx_queue = NULL;
+static CAN_BCM can_bcm = NULL;
 
 // SPI初始化
 bool SPI_Init(void)
@@ -98,7 +66,7 @@ bool SPI_Init(void)
         .mode = 0, // (0,0) - CPOL=0, CPHA=0
         .clock_speed_hz = 10000000, // 10MHz，降低速度确保稳定性
         .spics_io_num = PIN_NUM_CS,
-        .queue_size = 7,
+        .queue_size = MCP2515_PIPELINE_DEPTH,
         .flags = 0,
         .pre_cb = NULL,
         .post_cb = NULL,
@@ -114,32 +82,56 @@ bool SPI_Init(void)
         ESP_LOGE(TAG, "SPI device add failed: %s", esp_err_to_name(ret));
         return false;
     }
-    MCP2515_Object->spi = spi_handle;
+    MCP2515_TRANSPORT transport = MCP2515_ESP_SPI_create(spi_handle);
+    if (transport == NULL) {
+        ESP_LOGE(TAG, "SPI transport create failed");
+        return false;
+    }
+    MCP2515_setTransport(transport);
     return true;
 }
 
-// CAN发送任务
+// 周期报文负载更新回调，每次发送前在广播管理器的调度任务中执行，写入报文计数
+static void can_counter_update(void *arg, CAN_FRAME frame)
+{
+    uint32_t *message_counter = (uint32_t *)arg;
+    frame->data[0] = (*message_counter >> 24) & 0xFF;
+    frame->data[1] = (*message_counter >> 16) & 0xFF;
+    frame->data[2] = (*message_counter >> 8) & 0xFF;
+    frame->data[3] = *message_counter & 0xFF;
+    (*message_counter)++;
+}
+
+// 注册周期报文，调度任务在中断服务任务启动后再开始(发送完成由其处理)
+static bool can_bcm_setup(void)
+{
+    static uint32_t message_counter = 0;
+    CAN_BCM_CONFIG_t bcm_config = CAN_BCM_DEFAULT_CONFIG(can_tx_queue, CAN_BCM_MAX_MSGS);
+    can_bcm = CAN_BCM_create(&bcm_config);
+    if (can_bcm == NULL) {
+        return false;
+    }
+    can_frame_tx.can_id = 0x123 | CAN_EFF_FLAG; // 扩展帧ID
+    can_frame_tx.can_dlc = 8;
+    can_frame_tx.data[4] = 0xAA;
+    can_frame_tx.data[5] = 0xBB;
+    can_frame_tx.data[6] = 0xCC;
+    can_frame_tx.data[7] = 0xDD;
+    return CAN_BCM_add(can_bcm, &can_frame_tx, CAN_TX_PERIOD_US, 0, can_counter_update, &message_counter) != CAN_BCM_NONE;
+}
+
+// CAN发送任务: 周期报文由广播管理器发送，这里负责总线错误恢复并报告发送统计
 void can_send_task(void *pvParameters)
 {
-    uint32_t message_counter = 0;
-    
+    CAN_BCM_STATS_t reported = {0};
+
     while(1) {
-        // 准备发送的CAN消息
-        can_frame_tx.can_id = 0x123 | CAN_EFF_FLAG; // 扩展帧ID
-        can_frame_tx.can_dlc = 8;
-        can_frame_tx.data[0] = (message_counter >> 24) & 0xFF;
-        can_frame_tx.data[1] = (message_counter >> 16) & 0xFF;
-        can_frame_tx.data[2] = (message_counter >> 8) & 0xFF;
-        can_frame_tx.data[3] = message_counter & 0xFF;
-        can_frame_tx.data[4] = 0xAA;
-        can_frame_tx.data[5] = 0xBB;
-        can_frame_tx.data[6] = 0xCC;
-        can_frame_tx.data[7] = 0xDD;
-        
+        vTaskDelay(pdMS_TO_TICKS(1000));
+
         // 检查CAN状态，如果处于错误状态则尝试恢复
         uint8_t error_flags = MCP2515_getErrorFlags();
         if (error_flags != 0) {
-            ESP_LOGW(TAG, "CAN error detected before sending, flags: 0x%02X", error_flags);
+            ESP_LOGW(TAG, "CAN error detected, flags: 0x%02X", error_flags);
             
             // 清除错误标志
             if (error_flags & EFLG_RX0OVR) {
@@ -155,133 +147,157 @@ void can_send_task(void *pvParameters)
                 // 重新检查状态
                 error_flags = MCP2515_getErrorFlags();
                 if (error_flags & EFLG_TXBO) {
-                    ESP_LOGE(TAG, "Bus-off recovery failed, skipping send");
-                    vTaskDelay(pdMS_TO_TICKS(1000));
+                    ESP_LOGE(TAG, "Bus-off recovery failed");
+                    vTaskDelay(pdMS_TO_TICKS(2000));
                     continue;
                 }
             }
         }
-        
-        // 发送消息
-        ERROR_t result = MCP2515_sendMessageAfterCtrlCheck(&can_frame_tx);
-        if (result == ERROR_OK) {
-            ESP_LOGI(TAG, "CAN message sent successfully, counter: %lu", message_counter);
-            message_counter++;
-        } else {
-            ESP_LOGE(TAG, "Failed to send CAN message, error: %d", result);
-            
-            // 检查发送后的错误状态
-            error_flags = MCP2515_getErrorFlags();
-            if (error_flags != 0) {
-                ESP_LOGE(TAG, "CAN error flags after send: 0x%02X", error_flags);
-                
-                // 如果是总线关闭，等待更长时间
-                if (error_flags & EFLG_TXBO) {
-                    ESP_LOGE(TAG, "Bus-off after send, waiting for recovery...");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
-                }
+
+        // 只在有新的发送、失败或超期时报告
+        CAN_BCM_STATS_t stats;
+        CAN_BCM_getStats(can_bcm, &stats);
+        if (stats.sent != reported.sent || stats.failed != reported.failed || stats.expired != reported.expired
+            || stats.overruns != reported.overruns) {
+            ESP_LOGI(TAG, "CAN messages sent: %lu (+%lu), failed: %lu, expired: %lu, overruns: %lu, worst jitter %lu us",
+                     (unsigned long)stats.sent, (unsigned long)(stats.sent - reported.sent),
+                     (unsigned long)stats.failed, (unsigned long)stats.expired, (unsigned long)stats.overruns,
+                     (unsigned long)stats.max_jitter_us);
+            reported = stats;
+        }
+    }
+}
+
+// 处理一轮MCP2515中断标志，由驱动的中断服务任务调用
+// timestamp_us为触发本次中断的报文的接收时间(ISR中采集)，返回收到的帧数(驱动据此在中断和轮询之间切换)
+static uint32_t can_service_interrupts(void *arg, int64_t timestamp_us, can_ts_source_t source)
+{
+    // 状态检查、读取报文和清除标志在同一个SPI会话中完成
+    uint32_t frames_received = 0;
+    uint8_t tx_error_mask = 0;
+    MCP2515_beginSession();
+
+    // 直接读取中断状态，不等待
+    uint8_t interrupts = MCP2515_getInterrupts();
+    
+    // 检查接收中断 - 读到两个接收缓冲区都为空为止，按到达顺序放入环形缓冲区
+    // READ RX指令只清除已读缓冲区的RXnIF，读取期间新到的报文不会丢失
+    if (interrupts & (CANINTF_RX0IF | CANINTF_RX1IF)) {
+        // INT时刻只在本轮首次读到的标志全部是接收标志时属于接收帧，否则用读取时刻
+        frames_received = MCP2515_drainRx(can_rx_ring, timestamp_us,
+                                          MCP2515_rxTimestampSource(interrupts, source));
+    }
+    
+    // 检查发送中断 - 需要特殊处理
+    if (interrupts & (CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF)) {
+        // 清除已完成的发送中断标志，并释放对应的发送邮箱
+        MCP2515_txCompleted(interrupts);
+    }
+    
+    // 检查报文错误中断 - 读取各发送缓冲区的完成状态
+    if (interrupts & CANINTF_MERRF) {
+        const TXBn_t txBuffers[N_TXBUFFERS] = {TXB0, TXB1, TXB2};
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            if (MCP2515_getTransmitResult(txBuffers[i]) != ERROR_OK) {
+                tx_error_mask |= (1U << i);
             }
         }
+        MCP2515_clearMERR();
+    }
+
+    // 唤醒中断无需处理，只清除该标志
+    if (interrupts & CANINTF_WAKIF) {
+        MCP2515_clearInterruptFlags(CANINTF_WAKIF);
+    }
+
+    MCP2515_endSession();
+
+    // 报文已在环形缓冲区中，通知应用任务处理
+    if (frames_received > 0 && can_app_task_handle != NULL) {
+        xTaskNotifyGive(can_app_task_handle);
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (tx_error_mask & (1U << i)) {
+            ESP_LOGW(TAG, "TXB%d transmission error", i);
+        }
+    }
+
+    // 检查错误中断
+    if (interrupts & CANINTF_ERRIF) {
+        uint8_t error_flags = MCP2515_getErrorFlags();
+        
+        // 处理错误状态
+        if (error_flags & (EFLG_RX0OVR | EFLG_RX1OVR)) {
+            MCP2515_RX_STATS_t rx_stats;
+            MCP2515_clearRXnOVR();
+            MCP2515_getRxStats(&rx_stats);
+            ESP_LOGE(TAG, "RX overflow detected (%lu overruns, %lu dropped, %lu reordered)",
+                     (unsigned long)rx_stats.overruns, (unsigned long)rx_stats.dropped,
+                     (unsigned long)rx_stats.reordered);
+        }
+        
+        if (error_flags & EFLG_TXBO) {
+            ESP_LOGE(TAG, "Bus-off state detected, attempting recovery");
+            // 尝试恢复总线
+            MCP2515_setNormalMode();
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
         
-        vTaskDelay(pdMS_TO_TICKS(1000)); // 1秒发送一次
+        MCP2515_clearERRIF();
     }
+
+    return frames_received;
 }
 
-// CAN接收任务
-void can_receive_task(void *pvParameters)
+// CAN应用任务: 从环形缓冲区批量读取报文并处理(此处仅打印)
+void can_app_task(void *pvParameters)
 {
-    bool interrupt_flag;
-    
+    CAN_FRAME_TS_t frames[CAN_APP_BATCH];
+    uint32_t reported_drops = 0;
+    uint32_t reported_wakeups = 0;
+
     while(1) {
-        // 等待中断信号，添加超时
-        if (xQueueReceive(can_rx_queue, &interrupt_flag, pdMS_TO_TICKS(1000))) {
-            can_interrupt_flag = false;
-            
-            // 直接读取中断状态，不等待
-            uint8_t interrupts = MCP2515_getInterrupts();
-            
-            // 检查接收中断
-            if (interrupts & (CANINTF_RX0IF | CANINTF_RX1IF)) {
-                // 尝试读取消息
-                ERROR_t result = MCP2515_readMessageAfterStatCheck(&can_frame_rx);
-                if (result == ERROR_OK) {
-                    ESP_LOGI(TAG, "CAN message received - ID: 0x%08X, DLC: %d, Data: %02X %02X %02X %02X %02X %02X %02X %02X",
-                             (unsigned int)can_frame_rx.can_id, can_frame_rx.can_dlc,
-                             can_frame_rx.data[0], can_frame_rx.data[1], can_frame_rx.data[2], can_frame_rx.data[3],
-                             can_frame_rx.data[4], can_frame_rx.data[5], can_frame_rx.data[6], can_frame_rx.data[7]);
-                } else if (result == ERROR_NOMSG) {
-                    // 如果状态检查失败，尝试直接读取
-                    ERROR_t direct_result = MCP2515_readMessage(RXB0, &can_frame_rx);
-                    if (direct_result == ERROR_OK) {
-                        ESP_LOGI(TAG, "CAN message received - ID: 0x%08X, DLC: %d, Data: %02X %02X %02X %02X %02X %02X %02X %02X",
-                                 (unsigned int)can_frame_rx.can_id, can_frame_rx.can_dlc,
-                                 can_frame_rx.data[0], can_frame_rx.data[1], can_frame_rx.data[2], can_frame_rx.data[3],
-                                 can_frame_rx.data[4], can_frame_rx.data[5], can_frame_rx.data[6], can_frame_rx.data[7]);
-                    } else {
-                        // 尝试读取RX1
-                        direct_result = MCP2515_readMessage(RXB1, &can_frame_rx);
-                        if (direct_result == ERROR_OK) {
-                            ESP_LOGI(TAG, "CAN message received - ID: 0x%08X, DLC: %d, Data: %02X %02X %02X %02X %02X %02X %02X %02X",
-                                     (unsigned int)can_frame_rx.can_id, can_frame_rx.can_dlc,
-                                     can_frame_rx.data[0], can_frame_rx.data[1], can_frame_rx.data[2], can_frame_rx.data[3],
-                                     can_frame_rx.data[4], can_frame_rx.data[5], can_frame_rx.data[6], can_frame_rx.data[7]);
-                        }
-                    }
-                }
-            }
-            
-            // 检查发送中断 - 需要特殊处理
-            if (interrupts & (CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF)) {
-                // 清除发送中断标志 - 发送完成后必须清除
-                MCP2515_clearTXInterrupts();
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) == 0) {
+            // 总线空闲时报告中断延迟统计
+            MCP2515_ESP_IRQ_STATS_t irq_stats;
+            MCP2515_ESP_IRQ_getStats(&irq_stats);
+            if (irq_stats.wakeups != reported_wakeups) {
+                MCP2515_ESP_IRQ_logStats(TAG);
+                reported_wakeups = irq_stats.wakeups;
             }
-            
-            // 检查错误中断
-            if (interrupts & CANINTF_ERRIF) {
-                uint8_t error_flags = MCP2515_getErrorFlags();
-                
-                // 处理错误状态
-                if (error_flags & EFLG_RX0OVR) {
-                    ESP_LOGE(TAG, "RX0 overflow detected, clearing");
-                    MCP2515_clearRXnOVR();
-                }
-                
-                if (error_flags & EFLG_TXBO) {
-                    ESP_LOGE(TAG, "Bus-off state detected, attempting recovery");
-                    // 尝试恢复总线
-                    MCP2515_setNormalMode();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-                }
-                
-                MCP2515_clearERRIF();
-            }
-            
-            // 最后清除所有中断标志，确保没有遗漏
-            MCP2515_clearInterrupts();
-            
-        } else {
-            // 超时，检查是否有未处理的中断
-            uint8_t interrupts = MCP2515_getInterrupts();
-            if (interrupts != 0) {
-                // 处理未处理的中断
-                if (interrupts & (CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF)) {
-                    MCP2515_clearTXInterrupts();
-                } else {
-                    MCP2515_clearInterrupts();
-                }
+        }
+
+        uint32_t n;
+        while ((n = CAN_RING_popBatch(can_rx_ring, frames, CAN_APP_BATCH)) > 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                const CAN_FRAME frame = &frames[i].frame;
+                ESP_LOGI(TAG, "CAN message received at %lld us - ID: 0x%08X, DLC: %d, Data: %02X %02X %02X %02X %02X %02X %02X %02X",
+                         frames[i].timestamp_us, (unsigned int)frame->can_id, frame->can_dlc,
+                         frame->data[0], frame->data[1], frame->data[2], frame->data[3],
+                         frame->data[4], frame->data[5], frame->data[6], frame->data[7]);
             }
         }
+
+        // 处理速度跟不上时报告丢帧情况
+        CAN_RING_STATS_t stats;
+        CAN_RING_getStats(can_rx_ring, &stats);
+        if (stats.dropped != reported_drops) {
+            ESP_LOGW(TAG, "RX ring dropped %lu frames (high water %lu/%lu)",
+                     (unsigned long)(stats.dropped - reported_drops),
+                     (unsigned long)stats.high_water, (unsigned long)stats.capacity);
+            reported_drops = stats.dropped;
+        }
     }
 }
 
 void app_main(void)
 {
+    int64_t t_start = esp_timer_get_time();
     ESP_LOGI(TAG, "Starting ESP32 MCP2515 CAN application...");
     
-    // 创建CAN接收队列
-    can_rx_queue = xQueueCreate(10, sizeof(bool));
-    if (can_rx_queue == NULL) {
-        ESP_LOGE(TAG, "Failed to create CAN RX queue");
+    can_rx_ring = CAN_RING_create(CAN_RX_RING_SIZE);
+    if (can_rx_ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create CAN RX ring");
         return;
     }
     
@@ -291,19 +307,13 @@ void app_main(void)
         ESP_LOGE(TAG, "MCP2515 initialization failed: %d", result);
         return;
     }
-    ESP_LOGI(TAG, "MCP2515 initialized successfully");
     
     // 初始化SPI
     if (!SPI_Init()) {
         ESP_LOGE(TAG, "SPI initialization failed");
         return;
     }
-    
-    // 初始化CAN中断
-    if (init_can_interrupt() != ESP_OK) {
-        ESP_LOGE(TAG, "CAN interrupt initialization failed");
-        return;
-    }
+    int64_t t_spi = esp_timer_get_time();
     
     // 复位MCP2515
     result = MCP2515_reset();
@@ -311,35 +321,60 @@ void app_main(void)
         ESP_LOGE(TAG, "MCP2515 reset failed: %d", result);
         return;
     }
-    ESP_LOGI(TAG, "MCP2515 reset completed");
+    int64_t t_reset = esp_timer_get_time();
     
-    // 设置波特率 - 使用500kbps，更稳定
-    result = MCP2515_setBitrate(CAN_500KBPS, MCP_8MHZ);
+    // 设置波特率 - 使用500kbps，更稳定；与正常模式一起在一次配置中完成
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_NORMAL);
+    result = MCP2515_configBitrate(config, CAN_500KBPS, MCP_8MHZ);
     if (result != ERROR_OK) {
         ESP_LOGE(TAG, "MCP2515 set bitrate failed: %d", result);
         return;
     }
-    ESP_LOGI(TAG, "MCP2515 bitrate set to 500kbps");
-    
-    // 设置正常模式
-    result = MCP2515_setNormalMode();
+    if (PIN_NUM_SOF != GPIO_NUM_NC) {
+        // CLKOUT引脚改为输出SOF信号
+        MCP2515_configClkOut(config, CLKOUT_DISABLE);
+    }
+    result = MCP2515_configApply(config);
     if (result != ERROR_OK) {
-        ESP_LOGE(TAG, "MCP2515 set normal mode failed: %d", result);
+        ESP_LOGE(TAG, "MCP2515 configuration failed: %d", result);
+        return;
+    }
+    // configApply已确认CANSTAT进入正常模式，无需额外等待
+    int64_t t_ready = esp_timer_get_time();
+
+    // 安装发送队列: 三个发送邮箱由队列按仲裁优先级装载，发送完成中断(TX0IF~TX2IF)全部打开
+    can_tx_queue = MCP2515_TXQ_create(CAN_TX_QUEUE_SIZE);
+    if (can_tx_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create CAN TX queue");
+        return;
+    }
+    MCP2515_setTxQueue(can_tx_queue);
+    if (!can_bcm_setup()) {
+        ESP_LOGE(TAG, "Failed to set up CAN broadcast manager");
         return;
     }
-    ESP_LOGI(TAG, "MCP2515 set to normal mode");
-    
-    // 等待模式切换完成
-    vTaskDelay(pdMS_TO_TICKS(100));
-    
-    // 检查MCP2515状态
-    uint8_t canstat = MCP2515_readRegister(MCP_CANSTAT);
-    ESP_LOGI(TAG, "MCP2515 CANSTAT: 0x%02X", canstat);
     
-    // 创建发送和接收任务
+    // 创建应用任务，再启动驱动的中断服务任务(固定核心，优先级高于发送和应用任务)
+    xTaskCreate(can_app_task, "can_app", 4096, NULL, 4, &can_app_task_handle);
+    MCP2515_ESP_IRQ_CONFIG_t irq_config = MCP2515_ESP_IRQ_DEFAULT_CONFIG(PIN_NUM_INTERRUPT, can_service_interrupts, NULL);
+    irq_config.sof_pin = PIN_NUM_SOF;
+    if (MCP2515_ESP_IRQ_start(&irq_config) != ESP_OK) {
+        ESP_LOGE(TAG, "CAN interrupt initialization failed");
+        return;
+    }
+    // 周期报文调度任务的优先级低于中断服务任务，高于发送和应用任务
+    if (CAN_BCM_start(can_bcm) != ESP_OK) {
+        ESP_LOGE(TAG, "CAN broadcast manager start failed");
+        return;
+    }
     xTaskCreate(can_send_task, "can_send", 4096, NULL, 5, NULL);
-    xTaskCreate(can_receive_task, "can_receive", 4096, NULL, 5, NULL);
     
+    // 启动路径上不打印日志，任务创建后再统一报告各阶段耗时(自上电起的微秒数)
+    ESP_LOGI(TAG, "MCP2515 bitrate set to 500kbps, normal mode");
+    ESP_LOGI(TAG, "Boot timeline: app_main %lld us, SPI %lld us, reset %lld us (RESET->config %lu us), ready %lld us (mode switch %lu us)",
+             t_start, t_spi, t_reset, (unsigned long)MCP2515_getResetTime(),
+             t_ready, (unsigned long)MCP2515_getModeSwitchTime());
     ESP_LOGI(TAG, "CAN application started successfully");
     
     // 主循环 - 保持系统运行
@@ -1,15 +1,262 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
 #include "mcp2515.h"
+#include "mcp2515_txq.h"
+#include "can_dispatch.h"
 
-static SemaphoreHandle_t spi_mutex = NULL;
+typedef struct MCP2515_PIPE_SLOT_s {
+	uint8_t tx_data[1 + MCP_RXB_FRAME_LEN] __attribute__((aligned(4)));
+	uint8_t rx_data[1 + MCP_RXB_FRAME_LEN] __attribute__((aligned(4)));
+	CAN_FRAME frame; // decode target of a queued READ RX BUFFER, NULL for writes
+} MCP2515_PIPE_SLOT_t;
+
+// preallocated buffers for MCP2515_pipeline*(), one per SPI queue entry
+static MCP2515_PIPE_SLOT_t pipe_pool[MCP2515_PIPELINE_DEPTH];
+static uint8_t pipe_queued = 0;
+static bool pipe_open = false;
+
+// task holding the device through MCP2515_beginSession(), NULL when no session is open
+static TaskHandle_t session_owner = NULL;
+static uint32_t session_depth = 0;
 
 MCP2515 MCP2515_Object = NULL;
 
+static bool MCP2515_ready(void)
+{
+    if (MCP2515_Object == NULL || MCP2515_Object->transport == NULL) {
+        ESP_LOGE(TAG_MCP2515, "SPI transport is NULL!");
+        return false;
+    }
+    return true;
+}
+
+static ERROR_t MCP2515_transfer(const uint8_t *tx, uint8_t *rx, const size_t len)
+{
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    MCP2515_Object->spi_transactions++;
+    // inside a session the bus is acquired for this device, busy-wait instead of sleeping on the ISR
+    ERROR_t ret = transport->transfer(transport->ctx, tx, rx, len, session_owner != NULL);
+    if (ret != ERROR_OK) {
+        printf("spi transfer failed\n");
+    }
+    return ret;
+}
+
+static void MCP2515_lock(void)
+{
+    if (session_owner != NULL && session_owner == xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    if (transport->lock) transport->lock(transport->ctx);
+}
+
+static void MCP2515_unlock(void)
+{
+    if (session_owner != NULL && session_owner == xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    if (transport->unlock) transport->unlock(transport->ctx);
+}
+
+// filters and masks: not bit-modifiable and only writable in configuration mode
+static bool MCP2515_isAcceptanceRegister(const uint8_t reg)
+{
+    return reg <= MCP_RXF2EID0
+        || (reg >= MCP_RXF3SIDH && reg <= MCP_RXF5EID0)
+        || (reg >= MCP_RXM0SIDH && reg <= MCP_RXM1EID0);
+}
+
+// bits of a register mirrored in the shadow, 0 if the register is not shadowed
+static uint8_t MCP2515_shadowMask(const uint8_t reg)
+{
+    if (MCP2515_isAcceptanceRegister(reg)) {
+        // SIDL has unimplemented bits: 4 and 2 in RXFnSIDL, 4..2 in RXMnSIDL
+        if ((reg & 0x03) == MCP_SIDL) {
+            return (reg >= MCP_RXM0SIDH) ? 0xE3 : 0xEB;
+        }
+        return 0xFF;
+    }
+    switch (reg) {
+        case MCP_CANCTRL:
+        case MCP_CANINTE:
+        case MCP_CNF1:
+        case MCP_CNF2:
+            return 0xFF;
+        case MCP_CNF3:
+            return 0xC7;
+        // RXM and BUKT, RXRTR/BUKT1/FILHIT are set by the chip
+        case MCP_RXB0CTRL:
+            return RXBnCTRL_RXM_MASK | RXB0CTRL_BUKT;
+        case MCP_RXB1CTRL:
+            return RXBnCTRL_RXM_MASK;
+        default:
+            return 0;
+    }
+}
+
+// RXBnCTRL also carries chip-owned status bits, so it is written through but always read from the chip
+static bool MCP2515_shadowCached(const uint8_t reg)
+{
+    return MCP2515_Object->shadow_valid && MCP2515_shadowMask(reg) != 0
+        && reg != MCP_RXB0CTRL && reg != MCP_RXB1CTRL;
+}
+
+// mirror a completed WRITE/BITMOD; mask is 0xFF for WRITE
+static void MCP2515_trackWrite(const uint8_t reg, uint8_t mask, const uint8_t value)
+{
+    if (MCP2515_isAcceptanceRegister(reg)) {
+        mask = 0xFF; // BITMOD acts as WRITE on these
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (reg == MCP2515_Object->TXB_ptr[i].CTRL && (mask & value & TXB_TXREQ)) {
+            MCP2515_Object->tx_busy |= (1U << i);
+        }
+    }
+    const uint8_t owned = MCP2515_shadowMask(reg) & mask;
+    if (owned == 0) {
+        return;
+    }
+    // filters, masks and CNFn ignore writes outside configuration mode
+    if ((MCP2515_isAcceptanceRegister(reg) || (reg >= MCP_CNF3 && reg <= MCP_CNF1))
+        && MCP2515_Object->CANCTRL_REQOP_MODE != CANCTRL_REQOP_CONFIG) {
+        return;
+    }
+    uint8_t *cached = &MCP2515_Object->shadow[reg];
+    *cached = (uint8_t)((*cached & ~owned) | (value & owned));
+}
+
+static void MCP2515_readHardware(const uint8_t reg, uint8_t values[], const uint8_t n)
+{
+    MCP2515_lock();
+    uint8_t *tx_data = MCP2515_Object->spi_tx_buf;
+    uint8_t *rx_data = MCP2515_Object->spi_rx_buf;
+    tx_data[0] = INSTRUCTION_READ;
+    tx_data[1] = reg;
+    if (MCP2515_transfer(tx_data, rx_data, 2 + (size_t)n) != ERROR_OK) {
+        memset(values, 0, n);
+    } else {
+        memcpy(values, &rx_data[2], n);
+    }
+    MCP2515_unlock();
+}
+
+// rebuild the mailbox-busy bitmap from TXREQ with one READ STATUS
+static void MCP2515_syncTxBusy(void)
+{
+    const uint8_t tx_data[2] = {INSTRUCTION_READ_STATUS, 0x00};
+    uint8_t rx_data[2] = {0};
+    MCP2515_lock();
+    if (MCP2515_transfer(tx_data, rx_data, sizeof(tx_data)) == ERROR_OK) {
+        uint8_t busy = 0;
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            if (rx_data[1] & MCP2515_Object->TXB_ptr[i].STAT_TXREQ) {
+                busy |= (1U << i);
+            }
+        }
+        // TXnIF of a mailbox reclaimed here must not be taken later for the completion
+        // of the next frame loaded into it; only matters while TX interrupts are masked
+        const uint8_t freed = MCP2515_Object->tx_busy & ~busy;
+        uint8_t stale = 0;
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            if (freed & (1U << i)) {
+                stale |= (uint8_t)(CANINTF_TX0IF << i);
+            }
+        }
+        if (stale != 0) {
+            const uint8_t clear[4] = {INSTRUCTION_BITMOD, MCP_CANINTF, stale, 0};
+            MCP2515_transfer(clear, NULL, sizeof(clear));
+        }
+        MCP2515_Object->tx_busy = busy;
+    }
+    MCP2515_unlock();
+}
+
+// poll CANSTAT (and CANCTRL after RESET) until OPMOD reports mode, returns the elapsed time in *elapsed_us
+static ERROR_t MCP2515_waitMode(const CANCTRL_REQOP_MODE_t mode, const bool after_reset,
+                                const uint32_t timeout_us, uint32_t *elapsed_us)
+{
+    const int64_t start = esp_timer_get_time();
+    uint32_t backoff_us = MCP2515_POLL_MIN_US;
+    for (;;) {
+        // CANSTAT and CANCTRL are adjacent, one READ returns both
+        uint8_t regs[2];
+        MCP2515_readHardware(MCP_CANSTAT, regs, 2);
+        const uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+        bool ready = (regs[0] & CANSTAT_OPMOD) == mode;
+        if (after_reset) {
+            // a chip still held in reset (or not answering) does not return the power-on CANCTRL
+            ready = ready && regs[1] == (CANCTRL_REQOP_CONFIG | CANCTRL_CLKEN | CANCTRL_CLKPRE);
+        }
+        if (ready) {
+            *elapsed_us = elapsed;
+            return ERROR_OK;
+        }
+        if (elapsed >= timeout_us) {
+            *elapsed_us = elapsed;
+            return ERROR_FAIL;
+        }
+        if (elapsed < MCP2515_POLL_SPIN_US) {
+            esp_rom_delay_us(backoff_us);
+            if (backoff_us < MCP2515_POLL_MAX_US) {
+                backoff_us *= 2;
+            }
+        } else {
+            vTaskDelay(1);
+        }
+    }
+}
+
+void MCP2515_setTransport(const MCP2515_TRANSPORT transport)
+{
+    if (MCP2515_Object != NULL) {
+        MCP2515_Object->transport = transport;
+    }
+}
+
+ERROR_t MCP2515_beginSession(void)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    if (session_owner != NULL && session_owner == xTaskGetCurrentTaskHandle()) {
+        session_depth++;
+        return ERROR_OK;
+    }
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    if (transport->lock) transport->lock(transport->ctx);
+    if (transport->acquire && transport->acquire(transport->ctx) != ERROR_OK) {
+        if (transport->unlock) transport->unlock(transport->ctx);
+        ESP_LOGE(TAG_MCP2515, "Couldn't acquire the SPI bus");
+        return ERROR_FAIL;
+    }
+    session_owner = xTaskGetCurrentTaskHandle();
+    session_depth = 1;
+    return ERROR_OK;
+}
+
+void MCP2515_endSession(void)
+{
+    if (session_owner == NULL || session_owner != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    if (--session_depth > 0) {
+        return;
+    }
+    session_owner = NULL;
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    if (transport->release) transport->release(transport->ctx);
+    if (transport->unlock) transport->unlock(transport->ctx);
+}
+
 ERROR_t MCP2515_init(){
 
 	// MEMORY ALLOCATIONS FOR MCP2515 STRUCTURE
@@ -20,6 +267,18 @@ ERROR_t MCP2515_init(){
 	}
 	MCP2515_Object->TXB_ptr = NULL;
 	MCP2515_Object->RXB_ptr = NULL;
+	MCP2515_Object->transport = NULL;
+	MCP2515_Object->spi_transactions = 0;
+	MCP2515_Object->CANCTRL_REQOP_MODE = CANCTRL_REQOP_POWERUP;
+	memset(MCP2515_Object->shadow, 0, sizeof(MCP2515_Object->shadow));
+	MCP2515_Object->shadow_valid = false;
+	MCP2515_Object->tx_busy = 0;
+	MCP2515_Object->reset_us = 0;
+	MCP2515_Object->mode_switch_us = 0;
+	memset(&MCP2515_Object->rx_stats, 0, sizeof(MCP2515_Object->rx_stats));
+	MCP2515_Object->soft_filter = NULL;
+	MCP2515_Object->rx_dispatch = NULL;
+	MCP2515_Object->txq = NULL;
 	MCP2515_Object->TXB_ptr = (TXBn_REGS)malloc(sizeof(TXBn_REGS_t[N_TXBUFFERS]));
 	MCP2515_Object->RXB_ptr = (RXBn_REGS)malloc(sizeof(RXBn_REGS_t[N_RXBUFFERS]));
 	if(MCP2515_Object->TXB_ptr == NULL || MCP2515_Object->RXB_ptr == NULL){
@@ -27,74 +286,96 @@ ERROR_t MCP2515_init(){
 		return ERROR_FAIL;
 	}
 
+	// DMA-capable scratch buffers shared by all transfers (used under spi_mutex)
+	MCP2515_Object->spi_tx_buf = heap_caps_aligned_alloc(4, MCP2515_SPI_BUF_LEN, MALLOC_CAP_DMA);
+	MCP2515_Object->spi_rx_buf = heap_caps_aligned_alloc(4, MCP2515_SPI_BUF_LEN, MALLOC_CAP_DMA);
+	if(MCP2515_Object->spi_tx_buf == NULL || MCP2515_Object->spi_rx_buf == NULL){
+		ESP_LOGE(TAG_MCP2515, "Couldn't initialize MCP2515_Object->(spi_tx_buf || spi_rx_buf). (NULL pointer)");
+		return ERROR_FAIL;
+	}
+
 	// TXBn and RXBn REGISTER INITIALIZATION
 	MCP2515_Object->TXB_ptr[0].CTRL = MCP_TXB0CTRL;
 	MCP2515_Object->TXB_ptr[0].DATA = MCP_TXB0DATA;
 	MCP2515_Object->TXB_ptr[0].SIDH = MCP_TXB0SIDH;
+	MCP2515_Object->TXB_ptr[0].LOAD = INSTRUCTION_LOAD_TX0;
+	MCP2515_Object->TXB_ptr[0].RTS = INSTRUCTION_RTS_TX0;
+	MCP2515_Object->TXB_ptr[0].STAT_TXREQ = STAT_TX0REQ;
 
 	MCP2515_Object->TXB_ptr[1].CTRL = MCP_TXB1CTRL;
 	MCP2515_Object->TXB_ptr[1].DATA = MCP_TXB1DATA;
 	MCP2515_Object->TXB_ptr[1].SIDH = MCP_TXB1SIDH;
+	MCP2515_Object->TXB_ptr[1].LOAD = INSTRUCTION_LOAD_TX1;
+	MCP2515_Object->TXB_ptr[1].RTS = INSTRUCTION_RTS_TX1;
+	MCP2515_Object->TXB_ptr[1].STAT_TXREQ = STAT_TX1REQ;
 
 	MCP2515_Object->TXB_ptr[2].CTRL = MCP_TXB2CTRL;
 	MCP2515_Object->TXB_ptr[2].DATA = MCP_TXB2DATA;
 	MCP2515_Object->TXB_ptr[2].SIDH = MCP_TXB2SIDH;
+	MCP2515_Object->TXB_ptr[2].LOAD = INSTRUCTION_LOAD_TX2;
+	MCP2515_Object->TXB_ptr[2].RTS = INSTRUCTION_RTS_TX2;
+	MCP2515_Object->TXB_ptr[2].STAT_TXREQ = STAT_TX2REQ;
 
 	MCP2515_Object->RXB_ptr[0].CTRL = MCP_RXB0CTRL;
 	MCP2515_Object->RXB_ptr[0].DATA = MCP_RXB0DATA;
 	MCP2515_Object->RXB_ptr[0].SIDH = MCP_RXB0SIDH;
 	MCP2515_Object->RXB_ptr[0].CANINTF_RXnIF = CANINTF_RX0IF;
+	MCP2515_Object->RXB_ptr[0].READ = INSTRUCTION_READ_RX0;
 
 	MCP2515_Object->RXB_ptr[1].CTRL = MCP_RXB1CTRL;
 	MCP2515_Object->RXB_ptr[1].DATA = MCP_RXB1DATA;
 	MCP2515_Object->RXB_ptr[1].SIDH = MCP_RXB1SIDH;
 	MCP2515_Object->RXB_ptr[1].CANINTF_RXnIF = CANINTF_RX1IF;
-
-	// 初始化SPI互斥锁
-	if (spi_mutex == NULL) {
-		spi_mutex = xSemaphoreCreateMutex();
-	}
+	MCP2515_Object->RXB_ptr[1].READ = INSTRUCTION_READ_RX1;
 
 	return ERROR_OK;
 }
 
+// CANINTE value of each MCP2515_INT_PROFILE_t
+static const uint8_t MCP2515_intProfiles[] = {
+    [MCP2515_INT_PROFILE_ALL] = CANINTF_RX0IF | CANINTF_RX1IF | CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF
+                              | CANINTF_ERRIF | CANINTF_MERRF,
+    [MCP2515_INT_PROFILE_RX_ONLY] = CANINTF_RX0IF | CANINTF_RX1IF,
+    [MCP2515_INT_PROFILE_TX_BATCHED] = CANINTF_RX0IF | CANINTF_RX1IF | CANINTF_TX0IF | CANINTF_ERRIF | CANINTF_MERRF,
+};
+
 ERROR_t MCP2515_reset(void)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
         return ERROR_FAIL;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = 8;
-    trans.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
-    trans.tx_data[0] = INSTRUCTION_RESET;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
-    }
-    vTaskDelay(10 / portTICK_PERIOD_MS);
+    const uint8_t instruction = INSTRUCTION_RESET;
+    MCP2515_lock();
+    MCP2515_transfer(&instruction, NULL, 1);
+    // power-on values: configuration mode, CLKOUT enabled at /8, everything else cleared
+    memset(MCP2515_Object->shadow, 0, sizeof(MCP2515_Object->shadow));
+    MCP2515_Object->shadow[MCP_CANCTRL] = CANCTRL_REQOP_CONFIG | CANCTRL_CLKEN | CANCTRL_CLKPRE;
+    MCP2515_Object->shadow_valid = true;
+    MCP2515_Object->CANCTRL_REQOP_MODE = CANCTRL_REQOP_CONFIG;
+    MCP2515_Object->tx_busy = 0;
+    MCP2515_Object->bitrate = 0;
+    MCP2515_unlock();
+    // ready as soon as the oscillator start-up timer has expired, no fixed sleep
+    if (MCP2515_waitMode(CANCTRL_REQOP_CONFIG, true, MCP2515_RESET_TIMEOUT_US,
+                         &MCP2515_Object->reset_us) != ERROR_OK) {
+        ESP_LOGE(TAG_MCP2515, "no configuration mode %lu us after RESET", (unsigned long)MCP2515_Object->reset_us);
+        MCP2515_Object->shadow_valid = false;
+        return ERROR_FAILINIT;
+    }
     uint8_t zeros[14];
     memset(zeros, 0, sizeof(zeros));
     MCP2515_setRegisters(MCP_TXB0CTRL, zeros, 14);
     MCP2515_setRegisters(MCP_TXB1CTRL, zeros, 14);
     MCP2515_setRegisters(MCP_TXB2CTRL, zeros, 14);
 
-    MCP2515_setRegister(MCP_RXB0CTRL, 0);
-    MCP2515_setRegister(MCP_RXB1CTRL, 0);
-
-    MCP2515_setRegister(MCP_CANINTE, CANINTF_RX0IF | CANINTF_RX1IF | CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF | CANINTF_ERRIF | CANINTF_MERRF);
+    MCP2515_CONFIG_t config;
+    MCP2515_configInit(config, CANCTRL_REQOP_CONFIG);
+    MCP2515_configInterrupts(config, MCP2515_intProfiles[MCP2515_INT_PROFILE_ALL]);
 
     // receives all valid messages using either Standard or Extended Identifiers that
     // meet filter criteria. RXF0 is applied for RXB0, RXF1 is applied for RXB1
-    MCP2515_modifyRegister(MCP_RXB0CTRL,
-                   RXBnCTRL_RXM_MASK | RXB0CTRL_BUKT | RXB0CTRL_FILHIT_MASK,
-                   RXBnCTRL_RXM_STDEXT | RXB0CTRL_BUKT | RXB0CTRL_FILHIT);
-    MCP2515_modifyRegister(MCP_RXB1CTRL,
-                   RXBnCTRL_RXM_MASK | RXB1CTRL_FILHIT_MASK,
-                   RXBnCTRL_RXM_STDEXT | RXB1CTRL_FILHIT);
+    MCP2515_configRxBuffer(config, RXB0, RXBnCTRL_RXM_STDEXT, true);
+    MCP2515_configRxBuffer(config, RXB1, RXBnCTRL_RXM_STDEXT, false);
 
     // clear filters and masks
     // do not filter any standard frames for RXF0 used by RXB0
@@ -102,145 +383,138 @@ ERROR_t MCP2515_reset(void)
     const RXF_t filters[] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
     for (int i=0; i<6; i++) {
         const bool ext = (i == 1);
-        ERROR_t result = MCP2515_setFilter(filters[i], ext, 0);
-        if (result != ERROR_OK) {
-            return result;
-        }
+        MCP2515_configFilter(config, filters[i], ext, 0);
     }
 
     MASK_t masks[] = {MASK0, MASK1};
     for (int i=0; i<2; i++) {
-        ERROR_t result = MCP2515_setFilterMask(masks[i], true, 0);
-        if (result != ERROR_OK) {
-            return result;
-        }
+        MCP2515_configFilterMask(config, masks[i], true, 0);
     }
 
-    return ERROR_OK;
+    // everything above goes out in one configuration-mode pass
+    return MCP2515_configApply(config);
 }
 
 uint8_t MCP2515_readRegister(const REGISTER_t reg)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
+        return 0;
+    }
+    if (MCP2515_shadowCached(reg)) {
+        return MCP2515_Object->shadow[reg];
+    }
+    return MCP2515_readRegisterSync(reg);
+}
+
+uint8_t MCP2515_readRegisterSync(const REGISTER_t reg)
+{
+    if (!MCP2515_ready()) {
         return 0;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = 24;
-    trans.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
-    trans.tx_data[0] = INSTRUCTION_READ;
-    trans.tx_data[1] = reg;
-    trans.tx_data[2] = 0x00;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
+    const uint8_t tx_data[3] = {INSTRUCTION_READ, reg, 0x00};
+    uint8_t rx_data[3] = {0};
+    MCP2515_lock();
+    ERROR_t ret = MCP2515_transfer(tx_data, rx_data, sizeof(tx_data));
+    if (ret == ERROR_OK && MCP2515_Object->shadow_valid) {
+        MCP2515_Object->shadow[reg] = rx_data[2] & MCP2515_shadowMask(reg);
     }
-    return trans.rx_data[2];
+    MCP2515_unlock();
+    return rx_data[2];
 }
 
 void MCP2515_readRegisters(const REGISTER_t reg, uint8_t values[], const uint8_t n)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
         memset(values, 0, n);
         return;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    uint8_t rx_data[n + 2];
-    uint8_t tx_data[n + 2];
-    memset(rx_data, 0, sizeof(rx_data));
-    memset(tx_data, 0, sizeof(tx_data));
-    tx_data[0] = INSTRUCTION_READ;
-    tx_data[1] = reg;
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = ((2 + ((size_t)n)) * 8);
-    trans.rx_buffer = rx_data;
-    trans.tx_buffer = tx_data;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
+    if (2 + (size_t)n > MCP2515_SPI_BUF_LEN) {
+        ESP_LOGE(TAG_MCP2515, "readRegisters: %u bytes exceed the SPI buffer", n);
+        memset(values, 0, n);
+        return;
     }
-    for (uint8_t i = 0; i < n; i++) {
-        values[i] = rx_data[i+2];
+    bool cached = true;
+    for (uint8_t i = 0; i < n && cached; i++) {
+        cached = MCP2515_shadowCached(reg + i);
     }
+    if (cached) {
+        memcpy(values, &MCP2515_Object->shadow[reg], n);
+        return;
+    }
+    MCP2515_readHardware(reg, values, n);
 }
 
 void MCP2515_setRegister(const REGISTER_t reg, const uint8_t value)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
         return;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = 24;
-    trans.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
-    trans.tx_data[0] = INSTRUCTION_WRITE;
-    trans.tx_data[1] = reg;
-    trans.tx_data[2] = value;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
+    const uint8_t tx_data[3] = {INSTRUCTION_WRITE, reg, value};
+    MCP2515_lock();
+    if (MCP2515_transfer(tx_data, NULL, sizeof(tx_data)) == ERROR_OK) {
+        MCP2515_trackWrite(reg, 0xFF, value);
     }
+    MCP2515_unlock();
 }
 
 void MCP2515_setRegisters(const REGISTER_t reg, const uint8_t values[], const uint8_t n)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
+        return;
+    }
+    if (2 + (size_t)n > MCP2515_SPI_BUF_LEN) {
+        ESP_LOGE(TAG_MCP2515, "setRegisters: %u bytes exceed the SPI buffer", n);
         return;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    uint8_t tx_data[n + 2];
-    memset(tx_data, 0, sizeof(tx_data));
+    MCP2515_lock();
+    uint8_t *tx_data = MCP2515_Object->spi_tx_buf;
     tx_data[0] = INSTRUCTION_WRITE;
     tx_data[1] = reg;
-    for (uint8_t i = 0; i < n; i++) {
-        tx_data[2 + i] = values[i];
-    }
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = ((2 + ((size_t)n)) * 8);
-    trans.tx_buffer = tx_data;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
+    memcpy(&tx_data[2], values, n);
+    if (MCP2515_transfer(tx_data, NULL, 2 + (size_t)n) == ERROR_OK) {
+        for (uint8_t i = 0; i < n; i++) {
+            MCP2515_trackWrite(reg + i, 0xFF, values[i]);
+        }
     }
+    MCP2515_unlock();
 }
 
 void MCP2515_modifyRegister(const REGISTER_t reg, const uint8_t mask, const uint8_t data)
 {
-    if (MCP2515_Object == NULL || MCP2515_Object->spi == NULL) {
-        ESP_LOGE(TAG_MCP2515, "SPI handle is NULL!");
+    if (!MCP2515_ready()) {
         return;
     }
-    if (spi_mutex) xSemaphoreTake(spi_mutex, portMAX_DELAY);
-    spi_transaction_t trans;
-    memset(&trans, 0, sizeof(trans));
-    trans.length = 32;
-    trans.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
-    trans.tx_data[0] = INSTRUCTION_BITMOD;
-    trans.tx_data[1] = reg;
-    trans.tx_data[2] = mask;
-    trans.tx_data[3] = data;
-    esp_err_t ret = spi_device_transmit(MCP2515_Object->spi, &trans);
-    if (spi_mutex) xSemaphoreGive(spi_mutex);
-    if (ret != ESP_OK) {
-        printf("spi_device_transmit failed\n");
+    const uint8_t tx_data[4] = {INSTRUCTION_BITMOD, reg, mask, data};
+    MCP2515_lock();
+    if (MCP2515_transfer(tx_data, NULL, sizeof(tx_data)) == ERROR_OK) {
+        MCP2515_trackWrite(reg, mask, data);
     }
+    MCP2515_unlock();
+}
+
+static uint8_t MCP2515_quickStatus(const INSTRUCTION_t instruction)
+{
+    if (!MCP2515_ready()) {
+        return 0;
+    }
+    const uint8_t tx_data[2] = {instruction, 0x00};
+    uint8_t rx_data[2] = {0};
+    MCP2515_lock();
+    ERROR_t ret = MCP2515_transfer(tx_data, rx_data, sizeof(tx_data));
+    MCP2515_unlock();
+    return (ret == ERROR_OK) ? rx_data[1] : 0;
 }
 
 uint8_t MCP2515_getStatus(void)
 {
-    return MCP2515_readRegister(MCP_CANSTAT);
+    // RXnIF, TXREQ and TXnIF of every buffer in one 2-byte transaction, see STAT_t
+    return MCP2515_quickStatus(INSTRUCTION_READ_STATUS);
+}
+
+uint8_t MCP2515_getRxStatus(void)
+{
+    // full buffers, frame type and filter hit in one 2-byte transaction, see RXSTAT_t
+    return MCP2515_quickStatus(INSTRUCTION_RX_STATUS);
 }
 
 ERROR_t MCP2515_setConfigMode()
@@ -265,20 +539,20 @@ ERROR_t MCP2515_setLoopbackMode()
 
 ERROR_t MCP2515_setOneShotMode(bool set)
 {
-    uint8_t data = 0;
-    if (set)
-        data = 1U << 3;
-    MCP2515_modifyRegister(MCP_CANCTRL, 1U << 3, data);
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-    bool modeMatch = false;
-    for (int i = 0; i < 10; i++) {
-        uint8_t ctrlR = MCP2515_readRegister(MCP_CANCTRL);
-        modeMatch = (ctrlR & (1U << 3)) == data;
-        if (modeMatch)
-            break;
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
     }
-    return modeMatch ? ERROR_OK : ERROR_FAIL;
+    const uint8_t data = set ? CANCTRL_OSM : 0;
+    if (MCP2515_Object->shadow_valid) {
+        // OSM takes effect as soon as CANCTRL is written, there is nothing to wait for
+        if ((MCP2515_Object->shadow[MCP_CANCTRL] & CANCTRL_OSM) != data) {
+            MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_OSM, data);
+        }
+        return ERROR_OK;
+    }
+    MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_OSM, data);
+    uint8_t ctrlR = MCP2515_readRegisterSync(MCP_CANCTRL);
+    return ((ctrlR & CANCTRL_OSM) == data) ? ERROR_OK : ERROR_FAIL;
 }
 
 ERROR_t MCP2515_setNormalMode()
@@ -288,36 +562,37 @@ ERROR_t MCP2515_setNormalMode()
 
 ERROR_t MCP2515_setMode(const CANCTRL_REQOP_MODE_t mode)
 {
-	MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_REQOP, mode);
-
-    bool modeMatch = false;
-
-    for (int i = 0; i < 10; i++) {
-        uint8_t newmode = MCP2515_readRegister(MCP_CANSTAT);
-        newmode &= CANSTAT_OPMOD;
-
-        modeMatch = newmode == mode;
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    // already there: no request, no CANSTAT polling. Sleep is always re-requested
+    // because a bus wake-up moves the chip to listen-only on its own
+    if (MCP2515_Object->shadow_valid && MCP2515_Object->CANCTRL_REQOP_MODE == mode
+        && mode != CANCTRL_REQOP_SLEEP
+        && (MCP2515_Object->shadow[MCP_CANCTRL] & CANCTRL_REQOP) == mode) {
+        return ERROR_OK;
+    }
 
-        if (modeMatch) {
-            break;
-        }
+	MCP2515_modifyRegister(MCP_CANCTRL, CANCTRL_REQOP, mode);
 
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-    }
+    bool modeMatch = MCP2515_waitMode(mode, false, MCP2515_MODE_TIMEOUT_US,
+                                      &MCP2515_Object->mode_switch_us) == ERROR_OK;
 
+    MCP2515_Object->CANCTRL_REQOP_MODE = modeMatch ? mode : CANCTRL_REQOP_POWERUP;
     return modeMatch ? ERROR_OK : ERROR_FAIL;
 
 }
 
 
-ERROR_t MCP2515_setBitrate(const CAN_SPEED_t canSpeed, CAN_CLOCK_t canClock)
-{
-	printf("Hello from MCP2515_setBitrate!\n\r");
-    ERROR_t ERROR_t = MCP2515_setConfigMode();
-    if (ERROR_t != ERROR_OK) {
-        return ERROR_FAIL;
-    }
+// nominal bit/s of each CAN_SPEED_t
+static const uint32_t MCP2515_bitrates[] = {
+    5000, 10000, 20000, 31250, 33333, 40000, 50000, 80000,
+    83333, 95000, 100000, 125000, 200000, 250000, 500000, 1000000,
+};
 
+// CNF3, CNF2, CNF1 in register order (0x28..0x2A), false if the combination is not supported
+static bool MCP2515_bitrateRegisters(const CAN_SPEED_t canSpeed, const CAN_CLOCK_t canClock, uint8_t cnf[3])
+{
     uint8_t set, cfg1, cfg2, cfg3;
     set = 1;
     switch (canClock)
@@ -589,14 +864,30 @@ ERROR_t MCP2515_setBitrate(const CAN_SPEED_t canSpeed, CAN_CLOCK_t canClock)
     }
 
     if (set) {
-        MCP2515_setRegisters(MCP_CNF1, &cfg1, 1);
-        MCP2515_setRegisters(MCP_CNF2, &cfg2, 1);
-        MCP2515_setRegisters(MCP_CNF3, &cfg3, 1);
-        return ERROR_OK;
+        cnf[0] = cfg3;
+        cnf[1] = cfg2;
+        cnf[2] = cfg1;
     }
-    else {
+    return set;
+}
+
+ERROR_t MCP2515_setBitrate(const CAN_SPEED_t canSpeed, CAN_CLOCK_t canClock)
+{
+	printf("Hello from MCP2515_setBitrate!\n\r");
+    uint8_t cnf[3];
+    if (!MCP2515_bitrateRegisters(canSpeed, canClock, cnf)) {
         return ERROR_FAIL;
     }
+
+    ERROR_t ERROR_t = MCP2515_setConfigMode();
+    if (ERROR_t != ERROR_OK) {
+        return ERROR_FAIL;
+    }
+
+    // CNF3..CNF1 are contiguous, one sequential WRITE
+    MCP2515_setRegisters(MCP_CNF3, cnf, 3);
+    MCP2515_Object->bitrate = MCP2515_bitrates[canSpeed];
+    return ERROR_OK;
 }
 
 ERROR_t MCP2515_setClkOut(const CAN_CLKOUT_t divisor)
@@ -641,6 +932,30 @@ void MCP2515_prepareId(uint8_t *buffer, const bool ext, const uint32_t id)
     }
 }
 
+static bool MCP2515_maskRegister(const MASK_t mask, REGISTER_t *reg)
+{
+    switch (mask) {
+        case MASK0: *reg = MCP_RXM0SIDH; return true;
+        case MASK1: *reg = MCP_RXM1SIDH; return true;
+        default:
+            return false;
+    }
+}
+
+static bool MCP2515_filterRegister(const RXF_t num, REGISTER_t *reg)
+{
+    switch (num) {
+        case RXF0: *reg = MCP_RXF0SIDH; return true;
+        case RXF1: *reg = MCP_RXF1SIDH; return true;
+        case RXF2: *reg = MCP_RXF2SIDH; return true;
+        case RXF3: *reg = MCP_RXF3SIDH; return true;
+        case RXF4: *reg = MCP_RXF4SIDH; return true;
+        case RXF5: *reg = MCP_RXF5SIDH; return true;
+        default:
+            return false;
+    }
+}
+
 ERROR_t MCP2515_setFilterMask(const MASK_t mask, const bool ext, const uint32_t ulData)
 {
     ERROR_t res = MCP2515_setConfigMode();
@@ -652,11 +967,8 @@ ERROR_t MCP2515_setFilterMask(const MASK_t mask, const bool ext, const uint32_t
     MCP2515_prepareId(tbufdata, ext, ulData);
 
     REGISTER_t reg;
-    switch (mask) {
-        case MASK0: reg = MCP_RXM0SIDH; break;
-        case MASK1: reg = MCP_RXM1SIDH; break;
-        default:
-            return ERROR_FAIL;
+    if (!MCP2515_maskRegister(mask, &reg)) {
+        return ERROR_FAIL;
     }
 
     MCP2515_setRegisters(reg, tbufdata, 4);
@@ -672,16 +984,8 @@ ERROR_t MCP2515_setFilter(const RXF_t num, const bool ext, const uint32_t ulData
     }
 
     REGISTER_t reg;
-
-    switch (num) {
-        case RXF0: reg = MCP_RXF0SIDH; break;
-        case RXF1: reg = MCP_RXF1SIDH; break;
-        case RXF2: reg = MCP_RXF2SIDH; break;
-        case RXF3: reg = MCP_RXF3SIDH; break;
-        case RXF4: reg = MCP_RXF4SIDH; break;
-        case RXF5: reg = MCP_RXF5SIDH; break;
-        default:
-            return ERROR_FAIL;
+    if (!MCP2515_filterRegister(num, &reg)) {
+        return ERROR_FAIL;
     }
 
     uint8_t tbufdata[4];
@@ -691,17 +995,159 @@ ERROR_t MCP2515_setFilter(const RXF_t num, const bool ext, const uint32_t ulData
     return ERROR_OK;
 }
 
-ERROR_t MCP2515_sendMessage(const TXBn_t txbn, const CAN_FRAME frame)
+static void MCP2515_configStage(MCP2515_CONFIG config, const uint8_t reg, const uint8_t mask, const uint8_t value)
 {
-    if (frame->can_dlc > CAN_MAX_DLEN) {
-        return ERROR_FAILTX;
+    config->value[reg] = (uint8_t)((config->value[reg] & ~mask) | (value & mask));
+    config->mask[reg] |= mask;
+}
+
+void MCP2515_configInit(MCP2515_CONFIG config, const CANCTRL_REQOP_MODE_t mode)
+{
+    memset(config, 0, sizeof(MCP2515_CONFIG_t));
+    config->mode = mode;
+}
+
+ERROR_t MCP2515_configBitrate(MCP2515_CONFIG config, const CAN_SPEED_t canSpeed, const CAN_CLOCK_t canClock)
+{
+    uint8_t cnf[3];
+    if (!MCP2515_bitrateRegisters(canSpeed, canClock, cnf)) {
+        return ERROR_FAIL;
+    }
+    for (int i = 0; i < 3; i++) {
+        MCP2515_configStage(config, MCP_CNF3 + i, 0xFF, cnf[i]);
     }
+    config->bitrate = MCP2515_bitrates[canSpeed];
+    return ERROR_OK;
+}
 
-    const TXBn_REGS txbuf = &MCP2515_Object->TXB_ptr[txbn];
+ERROR_t MCP2515_configFilterMask(MCP2515_CONFIG config, const MASK_t mask, const bool ext, const uint32_t ulData)
+{
+    REGISTER_t reg;
+    if (!MCP2515_maskRegister(mask, &reg)) {
+        return ERROR_FAIL;
+    }
+    uint8_t tbufdata[4];
+    MCP2515_prepareId(tbufdata, ext, ulData);
+    for (int i = 0; i < 4; i++) {
+        MCP2515_configStage(config, reg + i, 0xFF, tbufdata[i]);
+    }
+    return ERROR_OK;
+}
 
+ERROR_t MCP2515_configFilter(MCP2515_CONFIG config, const RXF_t num, const bool ext, const uint32_t ulData)
+{
+    REGISTER_t reg;
+    if (!MCP2515_filterRegister(num, &reg)) {
+        return ERROR_FAIL;
+    }
+    uint8_t tbufdata[4];
+    MCP2515_prepareId(tbufdata, ext, ulData);
+    for (int i = 0; i < 4; i++) {
+        MCP2515_configStage(config, reg + i, 0xFF, tbufdata[i]);
+    }
+    return ERROR_OK;
+}
 
-    uint8_t data[13];
+ERROR_t MCP2515_configRxBuffer(MCP2515_CONFIG config, const RXBn_t rxbn, const uint8_t rxm, const bool rollover)
+{
+    if (rxbn != RXB0 && rxbn != RXB1) {
+        return ERROR_FAIL;
+    }
+    uint8_t mask = RXBnCTRL_RXM_MASK;
+    uint8_t value = rxm & RXBnCTRL_RXM_MASK;
+    if (rxbn == RXB0) {
+        mask |= RXB0CTRL_BUKT;
+        value |= rollover ? RXB0CTRL_BUKT : 0;
+    }
+    config->rxbctrl_value[rxbn] = (uint8_t)((config->rxbctrl_value[rxbn] & ~mask) | value);
+    config->rxbctrl_mask[rxbn] |= mask;
+    return ERROR_OK;
+}
+
+void MCP2515_configInterrupts(MCP2515_CONFIG config, const uint8_t caninte)
+{
+    MCP2515_configStage(config, MCP_CANINTE, 0xFF, caninte);
+}
+
+void MCP2515_configClkOut(MCP2515_CONFIG config, const CAN_CLKOUT_t divisor)
+{
+    // same register effects as MCP2515_setClkOut()
+    if (divisor == CLKOUT_DISABLE) {
+        config->canctrl_value &= ~CANCTRL_CLKEN;
+        config->canctrl_mask |= CANCTRL_CLKEN;
+        MCP2515_configStage(config, MCP_CNF3, CNF3_SOF, CNF3_SOF);
+        return;
+    }
+    config->canctrl_value = (uint8_t)((config->canctrl_value & ~(CANCTRL_CLKEN | CANCTRL_CLKPRE))
+                                      | CANCTRL_CLKEN | (divisor & CANCTRL_CLKPRE));
+    config->canctrl_mask |= CANCTRL_CLKEN | CANCTRL_CLKPRE;
+    MCP2515_configStage(config, MCP_CNF3, CNF3_SOF, 0x00);
+}
+
+ERROR_t MCP2515_configApply(const MCP2515_CONFIG config)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    ERROR_t rc = MCP2515_setConfigMode();
+    if (rc != ERROR_OK) {
+        return rc;
+    }
 
+    // per register: 2 = staged, 1 = not staged but known from the shadow (rewritten
+    // unchanged to join two staged ranges), 0 = must not be touched
+    const bool shadow = MCP2515_Object->shadow_valid;
+    uint8_t kind[MCP_CANINTE + 1];
+    uint8_t data[MCP_CANINTE + 1];
+    for (uint8_t reg = 0; reg <= MCP_CANINTE; reg++) {
+        const uint8_t mask = config->mask[reg];
+        kind[reg] = 0;
+        if (mask == 0xFF || (mask != 0 && shadow)) {
+            data[reg] = (uint8_t)((MCP2515_Object->shadow[reg] & ~mask) | (config->value[reg] & mask));
+            kind[reg] = 2;
+        } else if (mask != 0) {
+            // partial update with nothing to merge against, CNF3/CANINTE are bit-modifiable
+            MCP2515_modifyRegister(reg, mask, config->value[reg]);
+        } else if (reg != MCP_CANCTRL && MCP2515_shadowCached(reg)) {
+            data[reg] = MCP2515_Object->shadow[reg];
+            kind[reg] = 1;
+        }
+    }
+
+    // one sequential WRITE per run, trimmed to its first and last staged register
+    uint8_t reg = 0;
+    while (reg <= MCP_CANINTE) {
+        if (kind[reg] != 2) {
+            reg++;
+            continue;
+        }
+        uint8_t last = reg;
+        for (uint8_t next = reg + 1; next <= MCP_CANINTE && kind[next] != 0; next++) {
+            if (kind[next] == 2) {
+                last = next;
+            }
+        }
+        MCP2515_setRegisters(reg, &data[reg], last - reg + 1);
+        reg = last + 1;
+    }
+
+    for (int i = 0; i < N_RXBUFFERS; i++) {
+        if (config->rxbctrl_mask[i] != 0) {
+            MCP2515_modifyRegister(MCP2515_Object->RXB_ptr[i].CTRL, config->rxbctrl_mask[i], config->rxbctrl_value[i]);
+        }
+    }
+    if (config->canctrl_mask != 0) {
+        MCP2515_modifyRegister(MCP_CANCTRL, config->canctrl_mask, config->canctrl_value);
+    }
+    if (config->bitrate != 0) {
+        MCP2515_Object->bitrate = config->bitrate;
+    }
+
+    return MCP2515_setMode(config->mode);
+}
+
+static uint8_t MCP2515_encodeFrame(uint8_t *data, const CAN_FRAME frame)
+{
     bool ext = (frame->can_id & CAN_EFF_FLAG);
     bool rtr = (frame->can_id & CAN_RTR_FLAG);
     uint32_t id = (frame->can_id & (ext ? CAN_EFF_MASK : CAN_SFF_MASK));
@@ -712,29 +1158,126 @@ ERROR_t MCP2515_sendMessage(const TXBn_t txbn, const CAN_FRAME frame)
 
     memcpy(&data[MCP_DATA], frame->data, frame->can_dlc);
 
-    MCP2515_setRegisters(txbuf->SIDH, data, 5 + frame->can_dlc);
+    return 5 + frame->can_dlc;
+}
+
+static ERROR_t MCP2515_decodeFrame(const uint8_t *tbufdata, const CAN_FRAME frame)
+{
+    uint32_t id = (tbufdata[MCP_SIDH]<<3) + (tbufdata[MCP_SIDL]>>5);
+    bool rtr;
 
-    MCP2515_modifyRegister(txbuf->CTRL, TXB_TXREQ, TXB_TXREQ);
+    if ( (tbufdata[MCP_SIDL] & TXB_EXIDE_MASK) ==  TXB_EXIDE_MASK ) {
+        id = (id<<2) + (tbufdata[MCP_SIDL] & 0x03);
+        id = (id<<8) + tbufdata[MCP_EID8];
+        id = (id<<8) + tbufdata[MCP_EID0];
+        id |= CAN_EFF_FLAG;
+        // extended remote frames are flagged by RTR in RXBnDLC
+        rtr = (tbufdata[MCP_DLC] & RTR_MASK) != 0;
+    } else {
+        // standard remote frames are flagged by SRR in RXBnSIDL
+        rtr = (tbufdata[MCP_SIDL] & RXBnSIDL_SRR) != 0;
+    }
 
-    uint8_t ctrl = MCP2515_readRegister(txbuf->CTRL);
-    if ((ctrl & (TXB_ABTF | TXB_MLOA | TXB_TXERR)) != 0) {
-        return ERROR_FAILTX;
+    uint8_t dlc = (tbufdata[MCP_DLC] & DLC_MASK);
+    if (dlc > CAN_MAX_DLEN) {
+        return ERROR_FAIL;
     }
+
+    if (rtr) {
+        id |= CAN_RTR_FLAG;
+    }
+
+    frame->can_id = id;
+    frame->can_dlc = dlc;
+    memcpy(frame->data, &tbufdata[MCP_DATA], dlc);
+
     return ERROR_OK;
 }
 
+ERROR_t MCP2515_loadMessage(const TXBn_t txbn, const CAN_FRAME frame)
+{
+    if (frame->can_dlc > CAN_MAX_DLEN) {
+        return ERROR_FAILTX;
+    }
+
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+
+    MCP2515_lock();
+    // LOAD TX BUFFER: instruction byte followed by SIDH..D7, encoded straight into the DMA buffer
+    uint8_t *tx_data = MCP2515_Object->spi_tx_buf;
+    tx_data[0] = MCP2515_Object->TXB_ptr[txbn].LOAD;
+    const uint8_t len = MCP2515_encodeFrame(&tx_data[1], frame);
+    const ERROR_t ret = MCP2515_transfer(tx_data, NULL, 1 + (size_t)len);
+    MCP2515_unlock();
+    return (ret == ERROR_OK) ? ERROR_OK : ERROR_FAILTX;
+}
+
+ERROR_t MCP2515_requestToSend(const uint8_t mailboxes)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+
+    // the RTS opcodes share 0x80, ORing them selects several buffers (0x87 = RTS ALL)
+    uint8_t rts = 0;
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (mailboxes & (1U << i)) {
+            rts |= MCP2515_Object->TXB_ptr[i].RTS;
+        }
+    }
+    if (rts == 0) {
+        return ERROR_OK;
+    }
+
+    MCP2515_lock();
+    const ERROR_t ret = MCP2515_transfer(&rts, NULL, 1);
+    if (ret == ERROR_OK) {
+        MCP2515_Object->tx_busy |= mailboxes & ((1U << N_TXBUFFERS) - 1);
+    }
+    MCP2515_unlock();
+    return (ret == ERROR_OK) ? ERROR_OK : ERROR_FAILTX;
+}
+
+ERROR_t MCP2515_sendMessage(const TXBn_t txbn, const CAN_FRAME frame)
+{
+    ERROR_t ret = MCP2515_loadMessage(txbn, frame);
+    if (ret == ERROR_OK) {
+        // REQUEST TO SEND: one byte sets TXREQ of the loaded buffer
+        ret = MCP2515_requestToSend((uint8_t)(1U << txbn));
+    }
+
+    // the outcome (ABTF/MLOA/TXERR) is reported by MCP2515_getTransmitResult() on completion
+    return ret;
+}
+
 ERROR_t MCP2515_sendMessageAfterCtrlCheck(const CAN_FRAME frame)
 {
     if (frame->can_dlc > CAN_MAX_DLEN) {
         return ERROR_FAILTX;
     }
 
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+
+    if (MCP2515_Object->txq != NULL) {
+        return MCP2515_TXQ_submit(MCP2515_Object->txq, frame);
+    }
+
     TXBn_t txBuffers[N_TXBUFFERS] = {TXB0, TXB1, TXB2};
+    const uint8_t all_busy = (1U << N_TXBUFFERS) - 1;
 
+    // the busy bitmap only goes stale towards "busy" (TXnIF not handled yet),
+    // so a READ STATUS is needed only when it has no free mailbox left
+    if ((MCP2515_Object->tx_busy & all_busy) == all_busy) {
+        MCP2515_syncTxBusy();
+    }
+
+    const uint8_t busy = MCP2515_Object->tx_busy;
     for (int i=0; i<N_TXBUFFERS; i++) {
-        const TXBn_REGS txbuf = &MCP2515_Object->TXB_ptr[txBuffers[i]];
-        uint8_t ctrlval = MCP2515_readRegister(txbuf->CTRL);
-        if ( (ctrlval & TXB_TXREQ) == 0 ) {
+        if ( (busy & (1U << txBuffers[i])) == 0 ) {
             return MCP2515_sendMessage(txBuffers[i], frame);
         }
     }
@@ -742,43 +1285,78 @@ ERROR_t MCP2515_sendMessageAfterCtrlCheck(const CAN_FRAME frame)
     return ERROR_ALLTXBUSY;
 }
 
-ERROR_t MCP2515_readMessage(const RXBn_t rxbn, const CAN_FRAME frame)
+uint32_t MCP2515_sendBatch(CAN_FRAME_t frames[], const uint32_t n)
 {
-    const RXBn_REGS rxb = &MCP2515_Object->RXB_ptr[rxbn];
-
-    uint8_t tbufdata[5];
-
-    MCP2515_readRegisters(rxb->SIDH, tbufdata, 5);
-
-    uint32_t id = (tbufdata[MCP_SIDH]<<3) + (tbufdata[MCP_SIDL]>>5);
-
-    if ( (tbufdata[MCP_SIDL] & TXB_EXIDE_MASK) ==  TXB_EXIDE_MASK ) {
-        id = (id<<2) + (tbufdata[MCP_SIDL] & 0x03);
-        id = (id<<8) + tbufdata[MCP_EID8];
-        id = (id<<8) + tbufdata[MCP_EID0];
-        id |= CAN_EFF_FLAG;
+    if (n == 0 || MCP2515_beginSession() != ERROR_OK) {
+        return 0;
     }
 
-    uint8_t dlc = (tbufdata[MCP_DLC] & DLC_MASK);
-    if (dlc > CAN_MAX_DLEN) {
-        return ERROR_FAIL;
+    if (MCP2515_Object->txq != NULL) {
+        const uint32_t accepted = MCP2515_TXQ_submitBatch(MCP2515_Object->txq, frames, n);
+        MCP2515_endSession();
+        return accepted;
     }
 
-    uint8_t ctrl = MCP2515_readRegister(rxb->CTRL);
-    if (ctrl & RXBnCTRL_RTR) {
-        id |= CAN_RTR_FLAG;
+    const uint8_t all_busy = (1U << N_TXBUFFERS) - 1;
+    if ((MCP2515_Object->tx_busy & all_busy) == all_busy) {
+        MCP2515_syncTxBusy();
     }
 
-    frame->can_id = id;
-    frame->can_dlc = dlc;
+    // at equal TXP the highest buffer goes first, so fill downwards to keep the batch order
+    const uint8_t busy = MCP2515_Object->tx_busy;
+    uint8_t loaded = 0;
+    uint32_t accepted = 0;
+    for (int i = N_TXBUFFERS - 1; i >= 0 && accepted < n; i--) {
+        if (busy & (1U << i)) {
+            continue;
+        }
+        if (MCP2515_loadMessage((TXBn_t)i, &frames[accepted]) != ERROR_OK) {
+            break;
+        }
+        loaded |= (uint8_t)(1U << i);
+        accepted++;
+    }
+    if (MCP2515_requestToSend(loaded) != ERROR_OK) {
+        accepted = 0;
+    }
 
-    MCP2515_readRegisters(rxb->DATA, frame->data, dlc);
+    MCP2515_endSession();
+    return accepted;
+}
 
-    MCP2515_modifyRegister(MCP_CANINTF, rxb->CANINTF_RXnIF, 0);
+ERROR_t MCP2515_getTransmitResult(const TXBn_t txbn)
+{
+    const TXBn_REGS txbuf = &MCP2515_Object->TXB_ptr[txbn];
 
+    uint8_t ctrl = MCP2515_readRegister(txbuf->CTRL);
+    if ((ctrl & (TXB_ABTF | TXB_MLOA | TXB_TXERR)) != 0) {
+        return ERROR_FAILTX;
+    }
     return ERROR_OK;
 }
 
+ERROR_t MCP2515_readMessage(const RXBn_t rxbn, const CAN_FRAME frame)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+
+    const RXBn_REGS rxb = &MCP2515_Object->RXB_ptr[rxbn];
+
+    // READ RX BUFFER: SIDH..D7 in one burst, RXnIF is cleared by the chip when CS goes high
+    MCP2515_lock();
+    uint8_t *tx_data = MCP2515_Object->spi_tx_buf;
+    uint8_t *rx_data = MCP2515_Object->spi_rx_buf;
+    tx_data[0] = rxb->READ;
+    ERROR_t rc = MCP2515_transfer(tx_data, rx_data, 1 + MCP_RXB_FRAME_LEN);
+    // decode straight out of the DMA buffer while it is still ours
+    if (rc == ERROR_OK) {
+        rc = MCP2515_decodeFrame(&rx_data[1], frame);
+    }
+    MCP2515_unlock();
+    return rc;
+}
+
 ERROR_t MCP2515_readMessageAfterStatCheck(const CAN_FRAME frame)
 {
     ERROR_t rc;
@@ -795,6 +1373,205 @@ ERROR_t MCP2515_readMessageAfterStatCheck(const CAN_FRAME frame)
     return rc;
 }
 
+// destination of frames read out of the chip when the ring has no room
+static CAN_FRAME_TS_t rx_discard;
+
+// RX STATUS filter match to RXFn: 6 and 7 are RXF0/RXF1 rolled over into RXB1
+static inline uint8_t MCP2515_rxStatusFilter(const uint8_t rxstat)
+{
+    const uint8_t filhit = rxstat & RXSTAT_FILHIT_MASK;
+    return (filhit >= 6) ? filhit - 6 : filhit;
+}
+
+uint32_t MCP2515_drainRx(CAN_RING ring, const int64_t timestamp_us, const can_ts_source_t ts_source)
+{
+    if (!MCP2515_ready()) {
+        return 0;
+    }
+    // the session keeps the software filter from being swapped mid-drain
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return 0;
+    }
+    MCP2515_RX_STATS_t *stats = &MCP2515_Object->rx_stats;
+    const CAN_FILTER filter = MCP2515_Object->soft_filter;
+    const CAN_DISPATCH dispatch = MCP2515_Object->rx_dispatch;
+    uint32_t delivered = 0;
+    bool rxb0_read_alone = false;
+    can_ts_source_t source = ts_source;
+
+    for (int poll = 0; poll < MCP2515_RX_DRAIN_MAX; poll++) {
+        const uint8_t rxstat = MCP2515_getRxStatus();
+        const bool full0 = (rxstat & RXSTAT_RXB0) != 0;
+        const bool full1 = (rxstat & RXSTAT_RXB1) != 0;
+        if (!full0 && !full1) {
+            break;
+        }
+
+        RXBn_t order[N_RXBUFFERS];
+        uint8_t filhit[N_RXBUFFERS];
+        int n = 1;
+        if (full0 && full1) {
+            // RX STATUS describes RXB0 only; RXB1 costs a register read, done
+            // only when the dispatch table needs it
+            filhit[RXB0] = MCP2515_rxStatusFilter(rxstat);
+            filhit[RXB1] = (dispatch != NULL)
+                         ? MCP2515_readRegisterSync(MCP_RXB1CTRL) & RXB1CTRL_FILHIT_MASK
+                         : CAN_FILHIT_UNKNOWN;
+            // frames landing between two polls keep rollover order, RXB0 then RXB1.
+            // A frame that rolled into RXB1 while RXB0 was being read is older than
+            // the one refilling RXB0: the next poll follows that read by a few us,
+            // well under one frame time
+            if (rxb0_read_alone) {
+                order[0] = RXB1;
+                order[1] = RXB0;
+                stats->reordered++;
+            } else {
+                order[0] = RXB0;
+                order[1] = RXB1;
+            }
+            n = 2;
+        } else {
+            order[0] = full0 ? RXB0 : RXB1;
+            filhit[order[0]] = MCP2515_rxStatusFilter(rxstat);
+        }
+        rxb0_read_alone = (n == 1 && order[0] == RXB0);
+
+        for (int i = 0; i < n; i++) {
+            // decode straight into the ring slot; READ RX BUFFER clears only this RXnIF.
+            // A full ring is not a drop yet, the filter or a handler may still take the frame
+            CAN_FRAME_TS slot = (ring != NULL) ? CAN_RING_reserve(ring) : NULL;
+            const CAN_FRAME_TS rx = slot ? slot : &rx_discard;
+            if (MCP2515_readMessage(order[i], &rx->frame) != ERROR_OK) {
+                continue;
+            }
+            // only the oldest pending frame raised INT, later ones get their read time
+            const bool stamped = (source != CAN_TS_NONE);
+            source = CAN_TS_NONE;
+            if (filter != NULL && !CAN_FILTER_match(filter, rx->frame.can_id)) {
+                // the slot is not committed and gets reused by the next frame
+                stats->rejected++;
+                continue;
+            }
+            rx->timestamp_us = stamped ? timestamp_us : esp_timer_get_time();
+            rx->ts_source = stamped ? ts_source : CAN_TS_READ;
+            rx->filhit = filhit[order[i]];
+            if (dispatch != NULL && CAN_DISPATCH_route(dispatch, rx)) {
+                stats->dispatched++;
+                continue;
+            }
+            if (slot == NULL && ring != NULL) {
+                // the consumer may have made room during the read
+                slot = CAN_RING_reserve(ring);
+                if (slot != NULL) {
+                    *slot = *rx;
+                }
+            }
+            if (slot != NULL) {
+                CAN_RING_commit(ring);
+                stats->frames++;
+                delivered++;
+            } else {
+                if (ring != NULL) {
+                    CAN_RING_drop(ring);
+                }
+                stats->dropped++;
+            }
+        }
+    }
+
+    MCP2515_endSession();
+    return delivered;
+}
+
+can_ts_source_t MCP2515_rxTimestampSource(const uint8_t interrupts, const can_ts_source_t source)
+{
+    const uint8_t rx = CANINTF_RX0IF | CANINTF_RX1IF;
+    const uint8_t pending = interrupts & MCP2515_getInterruptMask();
+    // a TX or error flag that asserted INT first would date the frame before it arrived
+    if (!(pending & rx) || (pending & ~rx)) {
+        return CAN_TS_NONE;
+    }
+    return source;
+}
+
+CAN_FILTER MCP2515_setSoftFilter(CAN_FILTER filter)
+{
+    if (MCP2515_Object == NULL) {
+        return NULL;
+    }
+    if (filter != NULL) {
+        CAN_FILTER_seal(filter);
+    }
+    // drains run inside a session, taking one here waits for the current drain to end
+    const bool locked = (MCP2515_beginSession() == ERROR_OK);
+    CAN_FILTER previous = MCP2515_Object->soft_filter;
+    MCP2515_Object->soft_filter = filter;
+    if (locked) {
+        MCP2515_endSession();
+    }
+    return previous;
+}
+
+CAN_DISPATCH MCP2515_setRxDispatch(CAN_DISPATCH dispatch)
+{
+    if (MCP2515_Object == NULL) {
+        return NULL;
+    }
+    if (dispatch != NULL) {
+        CAN_DISPATCH_seal(dispatch);
+    }
+    const bool locked = (MCP2515_beginSession() == ERROR_OK);
+    CAN_DISPATCH previous = MCP2515_Object->rx_dispatch;
+    MCP2515_Object->rx_dispatch = dispatch;
+    if (locked) {
+        MCP2515_endSession();
+    }
+    return previous;
+}
+
+MCP2515_TXQ MCP2515_setTxQueue(MCP2515_TXQ txq)
+{
+    if (MCP2515_Object == NULL) {
+        return NULL;
+    }
+    const bool locked = (MCP2515_beginSession() == ERROR_OK);
+    MCP2515_TXQ previous = MCP2515_Object->txq;
+    if (previous == txq) {
+        if (locked) {
+            MCP2515_endSession();
+        }
+        return previous;
+    }
+    if (previous != NULL) {
+        // its loaded frames go back into its heap, the mailboxes are free for the next queue
+        MCP2515_TXQ_detach(previous);
+    }
+    MCP2515_Object->txq = txq;
+    if (txq != NULL) {
+        const uint8_t tx = CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF;
+        MCP2515_modifyRegister(MCP_CANINTE, tx, tx);
+        // TXBnCTRL may have been reset since the queue last wrote TXP
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            txq->txp[i] = 0xFF;
+        }
+        // frames submitted while another queue was installed are waiting in the heap
+        MCP2515_TXQ_attach(txq);
+    }
+    if (locked) {
+        MCP2515_endSession();
+    }
+    return previous;
+}
+
+void MCP2515_getRxStats(MCP2515_RX_STATS_t *stats)
+{
+    if (MCP2515_Object == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = MCP2515_Object->rx_stats;
+}
+
 bool MCP2515_checkReceive(void)
 {
     uint8_t res = MCP2515_getStatus();
@@ -837,23 +1614,70 @@ void MCP2515_clearInterrupts(void)
 	MCP2515_setRegister(MCP_CANINTF, 0);
 }
 
+void MCP2515_clearInterruptFlags(const uint8_t flags)
+{
+	MCP2515_modifyRegister(MCP_CANINTF, flags, 0);
+}
+
 uint8_t MCP2515_getInterruptMask(void)
 {
     return MCP2515_readRegister(MCP_CANINTE);
 }
 
+ERROR_t MCP2515_setInterruptProfile(const MCP2515_INT_PROFILE_t profile)
+{
+    if ((unsigned)profile >= sizeof(MCP2515_intProfiles) || !MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    // WAKIE is left as it is
+    MCP2515_modifyRegister(MCP_CANINTE, (uint8_t)~CANINTF_WAKIF, MCP2515_intProfiles[profile]);
+    return ERROR_OK;
+}
+
+void MCP2515_setRxInterrupts(const bool enabled)
+{
+    const uint8_t rx = CANINTF_RX0IF | CANINTF_RX1IF;
+    MCP2515_modifyRegister(MCP_CANINTE, rx, enabled ? rx : 0);
+}
+
 void MCP2515_clearTXInterrupts(void)
 {
 	MCP2515_modifyRegister(MCP_CANINTF, (CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF), 0);
 }
 
+void MCP2515_txCompleted(const uint8_t interrupts)
+{
+    const uint8_t flags = interrupts & (CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF);
+    if (flags == 0 || !MCP2515_ready()) {
+        return;
+    }
+    if (MCP2515_Object->txq != NULL) {
+        // the queue reads the mailboxes itself and loads the next frames
+        MCP2515_TXQ_service(MCP2515_Object->txq);
+        return;
+    }
+    // clear only the flags that were seen, so a completion racing this call is not lost
+    const uint8_t tx_data[4] = {INSTRUCTION_BITMOD, MCP_CANINTF, flags, 0};
+    MCP2515_lock();
+    if (MCP2515_transfer(tx_data, NULL, sizeof(tx_data)) == ERROR_OK) {
+        if (flags & CANINTF_TX0IF) MCP2515_Object->tx_busy &= ~(1U << TXB0);
+        if (flags & CANINTF_TX1IF) MCP2515_Object->tx_busy &= ~(1U << TXB1);
+        if (flags & CANINTF_TX2IF) MCP2515_Object->tx_busy &= ~(1U << TXB2);
+    }
+    MCP2515_unlock();
+}
+
 void MCP2515_clearRXnOVR(void)
 {
 	uint8_t eflg = MCP2515_getErrorFlags();
 	if (eflg != 0) {
+		if (MCP2515_Object != NULL) {
+			if (eflg & EFLG_RX0OVR) MCP2515_Object->rx_stats.overruns++;
+			if (eflg & EFLG_RX1OVR) MCP2515_Object->rx_stats.overruns++;
+		}
 		MCP2515_clearRXnOVRFlags();
-		MCP2515_clearInterrupts();
-		//modifyRegister(MCP_CANINTF, CANINTF_ERRIF, 0);
+		// ERRIF only, a blanket CANINTF write would also drop RXnIF of unread frames
+		MCP2515_clearInterruptFlags(CANINTF_ERRIF);
 	}
 
 }
@@ -871,3 +1695,188 @@ void MCP2515_clearERRIF()
     //clearInterrupts();
 	MCP2515_modifyRegister(MCP_CANINTF, CANINTF_ERRIF, 0);
 }
+
+uint32_t MCP2515_getSpiTransactionCount(void)
+{
+    return MCP2515_Object ? MCP2515_Object->spi_transactions : 0;
+}
+
+uint32_t MCP2515_getResetTime(void)
+{
+    return MCP2515_Object ? MCP2515_Object->reset_us : 0;
+}
+
+uint32_t MCP2515_getModeSwitchTime(void)
+{
+    return MCP2515_Object ? MCP2515_Object->mode_switch_us : 0;
+}
+
+void MCP2515_resetSpiTransactionCount(void)
+{
+    if (MCP2515_Object) {
+        MCP2515_Object->spi_transactions = 0;
+    }
+}
+
+ERROR_t MCP2515_syncShadow(void)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    uint8_t regs[MCP_CANINTE + 1];
+    MCP2515_readHardware(MCP_RXF0SIDH, regs, sizeof(regs));
+    for (uint8_t reg = 0; reg < sizeof(regs); reg++) {
+        MCP2515_Object->shadow[reg] = regs[reg] & MCP2515_shadowMask(reg);
+    }
+    MCP2515_readHardware(MCP_RXB0CTRL, &regs[0], 1);
+    MCP2515_readHardware(MCP_RXB1CTRL, &regs[1], 1);
+    MCP2515_Object->shadow[MCP_RXB0CTRL] = regs[0] & MCP2515_shadowMask(MCP_RXB0CTRL);
+    MCP2515_Object->shadow[MCP_RXB1CTRL] = regs[1] & MCP2515_shadowMask(MCP_RXB1CTRL);
+    MCP2515_Object->CANCTRL_REQOP_MODE = (CANCTRL_REQOP_MODE_t)(MCP2515_readRegisterSync(MCP_CANSTAT) & CANSTAT_OPMOD);
+    MCP2515_Object->shadow_valid = true;
+    MCP2515_syncTxBusy();
+    return ERROR_OK;
+}
+
+ERROR_t MCP2515_auditShadow(void)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    if (!MCP2515_Object->shadow_valid) {
+        ESP_LOGE(TAG_MCP2515, "audit: shadow not loaded, call reset or syncShadow first");
+        return ERROR_FAIL;
+    }
+    uint8_t chip[128];
+    MCP2515_readHardware(MCP_RXF0SIDH, chip, MCP_CANINTE + 1);
+    MCP2515_readHardware(MCP_RXB0CTRL, &chip[MCP_RXB0CTRL], 1);
+    MCP2515_readHardware(MCP_RXB1CTRL, &chip[MCP_RXB1CTRL], 1);
+
+    uint32_t mismatches = 0;
+    for (uint8_t reg = 0; reg < sizeof(chip); reg++) {
+        const uint8_t mask = MCP2515_shadowMask(reg);
+        if (mask != 0 && (chip[reg] & mask) != MCP2515_Object->shadow[reg]) {
+            ESP_LOGE(TAG_MCP2515, "audit: reg 0x%02X shadow 0x%02X chip 0x%02X",
+                     reg, MCP2515_Object->shadow[reg], chip[reg] & mask);
+            mismatches++;
+        }
+    }
+
+    // a mailbox may look busy after it completed, never free while TXREQ is set
+    const uint8_t stat = MCP2515_getStatus();
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if ((stat & MCP2515_Object->TXB_ptr[i].STAT_TXREQ) && !(MCP2515_Object->tx_busy & (1U << i))) {
+            ESP_LOGE(TAG_MCP2515, "audit: TXB%d has TXREQ set but is tracked as free", i);
+            mismatches++;
+        }
+    }
+
+    return (mismatches == 0) ? ERROR_OK : ERROR_FAIL;
+}
+
+ERROR_t MCP2515_pipelineBegin(void)
+{
+    if (!MCP2515_ready()) {
+        return ERROR_FAIL;
+    }
+    if (MCP2515_Object->transport->queue == NULL) {
+        ESP_LOGE(TAG_MCP2515, "SPI transport has no queue support");
+        return ERROR_FAIL;
+    }
+    MCP2515_lock();
+    pipe_queued = 0;
+    pipe_open = true;
+    return ERROR_OK;
+}
+
+static MCP2515_PIPE_SLOT_t *MCP2515_pipelineSlot(void)
+{
+    if (!pipe_open || pipe_queued >= MCP2515_PIPELINE_DEPTH) {
+        return NULL;
+    }
+    MCP2515_PIPE_SLOT_t *slot = &pipe_pool[pipe_queued];
+    slot->frame = NULL;
+    return slot;
+}
+
+static ERROR_t MCP2515_pipelineQueue(MCP2515_PIPE_SLOT_t *slot, const size_t len)
+{
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    MCP2515_Object->spi_transactions++;
+    ERROR_t ret = transport->queue(transport->ctx, slot->tx_data,
+                                   slot->frame ? slot->rx_data : NULL, len, slot);
+    if (ret != ERROR_OK) {
+        printf("spi queue failed\n");
+        return ERROR_FAIL;
+    }
+    pipe_queued++;
+    return ERROR_OK;
+}
+
+ERROR_t MCP2515_pipelineReadMessage(const RXBn_t rxbn, const CAN_FRAME frame)
+{
+    MCP2515_PIPE_SLOT_t *slot = MCP2515_pipelineSlot();
+    if (slot == NULL) {
+        return ERROR_FAIL;
+    }
+    memset(slot->tx_data, 0, sizeof(slot->tx_data));
+    slot->tx_data[0] = MCP2515_Object->RXB_ptr[rxbn].READ;
+    slot->frame = frame;
+    return MCP2515_pipelineQueue(slot, sizeof(slot->tx_data));
+}
+
+ERROR_t MCP2515_pipelineSendMessage(const TXBn_t txbn, const CAN_FRAME frame)
+{
+    if (frame->can_dlc > CAN_MAX_DLEN) {
+        return ERROR_FAILTX;
+    }
+    if (pipe_queued + 2 > MCP2515_PIPELINE_DEPTH) {
+        return ERROR_FAIL;
+    }
+    const TXBn_REGS txbuf = &MCP2515_Object->TXB_ptr[txbn];
+
+    MCP2515_PIPE_SLOT_t *slot = MCP2515_pipelineSlot();
+    if (slot == NULL) {
+        return ERROR_FAIL;
+    }
+    slot->tx_data[0] = txbuf->LOAD;
+    const uint8_t len = MCP2515_encodeFrame(&slot->tx_data[1], frame);
+    if (MCP2515_pipelineQueue(slot, 1 + (size_t)len) != ERROR_OK) {
+        return ERROR_FAILTX;
+    }
+
+    slot = MCP2515_pipelineSlot();
+    slot->tx_data[0] = txbuf->RTS;
+    if (MCP2515_pipelineQueue(slot, 1) != ERROR_OK) {
+        return ERROR_FAILTX;
+    }
+    // the pipeline holds the lock until MCP2515_pipelineEnd()
+    MCP2515_Object->tx_busy |= (1U << txbn);
+    return ERROR_OK;
+}
+
+ERROR_t MCP2515_pipelineEnd(void)
+{
+    if (!pipe_open) {
+        return ERROR_FAIL;
+    }
+    const MCP2515_TRANSPORT transport = MCP2515_Object->transport;
+    ERROR_t rc = ERROR_OK;
+    // results complete in queue order; frames are decoded as soon as each read lands
+    for (uint8_t i = 0; i < pipe_queued; i++) {
+        void *user = NULL;
+        if (transport->get_result(transport->ctx, &user) != ERROR_OK || user == NULL) {
+            printf("spi get result failed\n");
+            rc = ERROR_FAIL;
+            continue;
+        }
+        MCP2515_PIPE_SLOT_t *slot = (MCP2515_PIPE_SLOT_t *)user;
+        if (slot->frame != NULL && MCP2515_decodeFrame(&slot->rx_data[1], slot->frame) != ERROR_OK) {
+            rc = ERROR_FAIL;
+        }
+    }
+    pipe_queued = 0;
+    pipe_open = false;
+    MCP2515_unlock();
+    return rc;
+}
@@ -3,8 +3,10 @@
 
 #include "stdbool.h"
 #include "stdint.h"
-#include "driver/spi_master.h"
+#include "stddef.h"
 #include "can.h"
+#include "can_ring.h"
+#include "can_filter.h"
 
 #define TAG_MCP2515 "MCP2515"
 /*
@@ -181,6 +183,7 @@ static const uint8_t CNF3_SOF = 0x80;
 static const uint8_t TXB_EXIDE_MASK = 0x08;
 static const uint8_t DLC_MASK       = 0x0F;
 static const uint8_t RTR_MASK       = 0x40;
+static const uint8_t RXBnSIDL_SRR   = 0x10;
 
 static const uint8_t RXBnCTRL_RXM_STD    = 0x20;
 static const uint8_t RXBnCTRL_RXM_EXT    = 0x40;
@@ -200,6 +203,9 @@ static const uint8_t MCP_EID0 = 3;
 static const uint8_t MCP_DLC  = 4;
 static const uint8_t MCP_DATA = 5;
 
+// SIDH, SIDL, EID8, EID0, DLC and up to 8 data bytes as returned by READ RX BUFFER
+#define MCP_RXB_FRAME_LEN (5 + CAN_MAX_DLEN)
+
 static const uint8_t CANCTRL_REQOP = 0xE0;
 static const uint8_t CANCTRL_ABAT = 0x10;
 static const uint8_t CANCTRL_OSM = 0x08;
@@ -209,6 +215,25 @@ static const uint8_t CANCTRL_CLKPRE = 0x03;
 #define N_TXBUFFERS 3
 #define N_RXBUFFERS 2
 
+// size of the DMA-capable scratch buffers: instruction, address and the whole register map
+#define MCP2515_SPI_BUF_LEN (2 + 128)
+
+// SPI transactions that can be in flight in one pipeline, matches the device queue_size
+#define MCP2515_PIPELINE_DEPTH 7
+
+// upper bound of polls in one MCP2515_drainRx() call, guards against a stuck RXnIF
+#define MCP2515_RX_DRAIN_MAX 256
+
+// CANSTAT polling after RESET and mode requests: busy-wait with doubling back-off
+// for up to MCP2515_POLL_SPIN_US, then yield a tick between polls
+#define MCP2515_POLL_MIN_US 2
+#define MCP2515_POLL_MAX_US 64
+#define MCP2515_POLL_SPIN_US 2000
+// RESET to configuration mode: tOST (128 OSC1 cycles) plus crystal start-up after power-on
+#define MCP2515_RESET_TIMEOUT_US 10000
+// a requested mode is entered once the bus is idle, a 5 kbps frame takes ~30 ms
+#define MCP2515_MODE_TIMEOUT_US 100000
+
 typedef enum {
     MCP_20MHZ,
     MCP_16MHZ,
@@ -287,6 +312,13 @@ typedef enum {
 	CANINTF_MERRF = 0x80
 }CANINTF_t;
 
+// which CANINTE sources drive the INT pin, see MCP2515_setInterruptProfile()
+typedef enum {
+	MCP2515_INT_PROFILE_ALL = 0,     // RX, TX, ERR and MERR, as after MCP2515_reset()
+	MCP2515_INT_PROFILE_RX_ONLY,     // RX only: TX, ERR and MERR are seen by the next RX pass or idle check
+	MCP2515_INT_PROFILE_TX_BATCHED   // RX, ERR, MERR and TXB0 only, one TX interrupt per batch
+}MCP2515_INT_PROFILE_t;
+
 typedef enum {
 	EFLG_RX1OVR = (uint8_t)0b10000000,
 	EFLG_RX0OVR = (uint8_t)0b01000000,
@@ -313,11 +345,27 @@ typedef enum {
 
 
 
+/* READ STATUS instruction response */
 typedef enum {
-	STAT_RX0IF = (uint8_t)(1<<0),
-	STAT_RX1IF = (uint8_t)(1<<1)
+	STAT_RX0IF  = (uint8_t)(1<<0),
+	STAT_RX1IF  = (uint8_t)(1<<1),
+	STAT_TX0REQ = (uint8_t)(1<<2),
+	STAT_TX0IF  = (uint8_t)(1<<3),
+	STAT_TX1REQ = (uint8_t)(1<<4),
+	STAT_TX1IF  = (uint8_t)(1<<5),
+	STAT_TX2REQ = (uint8_t)(1<<6),
+	STAT_TX2IF  = (uint8_t)(1<<7)
 }STAT_t;
 
+/* RX STATUS instruction response */
+typedef enum {
+	RXSTAT_FILHIT_MASK = (uint8_t)0x07,
+	RXSTAT_RTR         = (uint8_t)0x08,
+	RXSTAT_EXT         = (uint8_t)0x10,
+	RXSTAT_RXB0        = (uint8_t)0x40,
+	RXSTAT_RXB1        = (uint8_t)0x80
+}RXSTAT_t;
+
 
 
 typedef enum {
@@ -430,6 +478,7 @@ typedef enum {
 
 static const uint32_t SPI_CLOCK = 10000000; // 10MHz
 static const uint8_t STAT_RXIF_MASK = STAT_RX0IF | STAT_RX1IF;
+static const uint8_t STAT_TXREQ_MASK = STAT_TX0REQ | STAT_TX1REQ | STAT_TX2REQ;
 static const uint8_t EFLG_ERRORMASK = EFLG_RX1OVR
 									| EFLG_RX0OVR
 									| EFLG_TXBO
@@ -440,6 +489,9 @@ typedef struct TXBn_REGS_s {
 	REGISTER_t CTRL;
 	REGISTER_t SIDH;
 	REGISTER_t DATA;
+	INSTRUCTION_t LOAD;
+	INSTRUCTION_t RTS;
+	STAT_t STAT_TXREQ;
 } TXBn_REGS_t[1], *TXBn_REGS;
 
 typedef struct RXBn_REGS_s {
@@ -447,9 +499,63 @@ typedef struct RXBn_REGS_s {
 	REGISTER_t SIDH;
 	REGISTER_t DATA;
 	CANINTF_t  CANINTF_RXnIF;
+	INSTRUCTION_t READ;
 } RXBn_REGS_t[1], *RXBn_REGS;
 
 
+/*
+ * SPI transport the driver talks through. The ESP-IDF SPI master
+ * (mcp2515_esp_spi.h) and the host register-model simulator (mcp2515_sim.h)
+ * are the two backends. lock/unlock/acquire/release may be NULL.
+ */
+typedef struct MCP2515_TRANSPORT_s {
+	void *ctx;
+	// full-duplex transfer, rx may be NULL; polling is set inside a session
+	ERROR_t (*transfer)(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, bool polling);
+	// start a transfer without waiting, get_result returns the user pointers in queue order
+	ERROR_t (*queue)(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, void *user);
+	ERROR_t (*get_result)(void *ctx, void **user);
+	// serialise driver calls between tasks
+	void (*lock)(void *ctx);
+	void (*unlock)(void *ctx);
+	// hold the bus for this device across a session
+	ERROR_t (*acquire)(void *ctx);
+	void (*release)(void *ctx);
+} MCP2515_TRANSPORT_t[1], *MCP2515_TRANSPORT;
+
+/*
+ * Configuration builder. MCP2515_config*() only stage register values;
+ * MCP2515_configApply() enters configuration mode once, writes the staged
+ * registers with as few sequential WRITEs as the register map allows and
+ * requests the final mode given to MCP2515_configInit().
+ */
+typedef struct MCP2515_CONFIG_s {
+	// staged bits of 0x00 (RXF0SIDH) .. 0x2B (CANINTE), mask 0 = not staged
+	uint8_t value[MCP_CANINTE + 1];
+	uint8_t mask[MCP_CANINTE + 1];
+	uint8_t rxbctrl_value[N_RXBUFFERS];
+	uint8_t rxbctrl_mask[N_RXBUFFERS];
+	// CLKEN/CLKPRE, REQOP comes from mode
+	uint8_t canctrl_value;
+	uint8_t canctrl_mask;
+	CANCTRL_REQOP_MODE_t mode;
+	uint32_t bitrate;           // bit/s staged by MCP2515_configBitrate(), 0 if none
+} MCP2515_CONFIG_t[1], *MCP2515_CONFIG;
+
+// transmit queue, see mcp2515_txq.h
+typedef struct MCP2515_TXQ_s *MCP2515_TXQ;
+// RX dispatcher, see can_dispatch.h
+typedef struct CAN_DISPATCH_s *CAN_DISPATCH;
+
+typedef struct MCP2515_RX_STATS_s {
+	uint32_t frames;     // frames delivered by MCP2515_drainRx()
+	uint32_t dropped;    // accepted, unclaimed frames that found the ring full
+	uint32_t overruns;   // RX0OVR/RX1OVR events, frames the chip could not store
+	uint32_t reordered;  // RXB1 delivered before RXB0 to keep arrival order
+	uint32_t rejected;   // frames refused by the software filter
+	uint32_t dispatched; // frames claimed by the dispatch table instead of the ring
+} MCP2515_RX_STATS_t;
+
 typedef struct MCP2515_s{
 	ERROR_t ERROR;
 	MASK_t MASK;
@@ -458,6 +564,7 @@ typedef struct MCP2515_s{
 	TXBn_t TXBn;
 	CANINTF_t CANINTF;
 	EFLG_t EFLG_t;
+	// last operation mode confirmed in CANSTAT, CANCTRL_REQOP_POWERUP while unknown
 	CANCTRL_REQOP_MODE_t CANCTRL_REQOP_MODE;
 	STAT_t STAT;
 	TXBnCTRL_t TXBnCTRL;
@@ -467,12 +574,40 @@ typedef struct MCP2515_s{
 	TXBn_REGS TXB_ptr;
 	RXBn_REGS RXB_ptr;
 
-	spi_device_handle_t spi;
+	MCP2515_TRANSPORT transport;
+	uint8_t *spi_tx_buf;
+	uint8_t *spi_rx_buf;
+
+	// number of SPI transactions issued since init (or the last reset of the counter)
+	uint32_t spi_transactions;
+
+	// write-through copy of the configuration registers, indexed by address;
+	// only the driver-owned bits of CANCTRL, CANINTE, CNF1-3, RXBnCTRL and the
+	// filters/masks are kept, reads are served from it once shadow_valid is set
+	uint8_t shadow[128];
+	bool shadow_valid;
+	// bit n set from REQUEST TO SEND of TXBn until its TXnIF is handled
+	uint8_t tx_busy;
+
+	// measured RESET-to-configuration-mode time and duration of the last mode switch
+	uint32_t reset_us;
+	uint32_t mode_switch_us;
+	// bit/s of the timing last written to CNF1-3, 0 while unknown
+	uint32_t bitrate;
+
+	MCP2515_RX_STATS_t rx_stats;
+	// software acceptance filter applied by MCP2515_drainRx(), NULL accepts everything
+	CAN_FILTER soft_filter;
+	// handlers consulted by MCP2515_drainRx() before the ring, NULL for none
+	CAN_DISPATCH rx_dispatch;
+	// when set, sendMessageAfterCtrlCheck() submits here and TX completions refill the mailboxes
+	MCP2515_TXQ txq;
 }MCP2515_t[1], *MCP2515;
 
 ERROR_t MCP2515_setMode(const CANCTRL_REQOP_MODE_t mode);
 
 uint8_t MCP2515_readRegister(const REGISTER_t reg);
+uint8_t MCP2515_readRegisterSync(const REGISTER_t reg);
 void MCP2515_readRegisters(const REGISTER_t reg, uint8_t values[], const uint8_t n);
 void MCP2515_setRegister(const REGISTER_t reg, const uint8_t value);
 void MCP2515_setRegisters(const REGISTER_t reg, const uint8_t values[], const uint8_t n);
@@ -481,7 +616,34 @@ void MCP2515_modifyRegister(const REGISTER_t reg, const uint8_t mask, const uint
 void MCP2515_prepareId(uint8_t *buffer, const bool ext, const uint32_t id);
 
 ERROR_t MCP2515_init();
+void MCP2515_setTransport(const MCP2515_TRANSPORT transport);
+/*
+ * Hold the device across a sequence of driver calls: the mutex is taken and
+ * the bus acquired once, and every transfer inside the session uses polling
+ * transactions. Sessions nest within the same task. Do not block (vTaskDelay,
+ * mode changes) while a session is open, other SPI devices are locked out.
+ */
+ERROR_t MCP2515_beginSession(void);
+void MCP2515_endSession(void);
+/*
+ * Queue several transfers back-to-back on the SPI device and collect them in
+ * MCP2515_pipelineEnd(), which also decodes queued RX reads into their frames.
+ * Only pipeline calls may be made between begin and end.
+ */
+ERROR_t MCP2515_pipelineBegin(void);
+ERROR_t MCP2515_pipelineReadMessage(const RXBn_t rxbn, const CAN_FRAME frame);
+ERROR_t MCP2515_pipelineSendMessage(const TXBn_t txbn, const CAN_FRAME frame);
+ERROR_t MCP2515_pipelineEnd(void);
 ERROR_t MCP2515_reset(void);
+void MCP2515_configInit(MCP2515_CONFIG config, const CANCTRL_REQOP_MODE_t mode);
+ERROR_t MCP2515_configBitrate(MCP2515_CONFIG config, const CAN_SPEED_t canSpeed, const CAN_CLOCK_t canClock);
+ERROR_t MCP2515_configFilterMask(MCP2515_CONFIG config, const MASK_t mask, const bool ext, const uint32_t ulData);
+ERROR_t MCP2515_configFilter(MCP2515_CONFIG config, const RXF_t num, const bool ext, const uint32_t ulData);
+// rxm is one of RXBnCTRL_RXM_*, rollover only applies to RXB0
+ERROR_t MCP2515_configRxBuffer(MCP2515_CONFIG config, const RXBn_t rxbn, const uint8_t rxm, const bool rollover);
+void MCP2515_configInterrupts(MCP2515_CONFIG config, const uint8_t caninte);
+void MCP2515_configClkOut(MCP2515_CONFIG config, const CAN_CLKOUT_t divisor);
+ERROR_t MCP2515_configApply(const MCP2515_CONFIG config);
 ERROR_t MCP2515_setConfigMode();
 ERROR_t MCP2515_setListenOnlyMode();
 ERROR_t MCP2515_setSleepMode();
@@ -494,8 +656,63 @@ ERROR_t MCP2515_setFilterMask(const MASK_t num, const bool ext, const uint32_t u
 ERROR_t MCP2515_setFilter(const RXF_t num, const bool ext, const uint32_t ulData);
 ERROR_t MCP2515_sendMessage(const TXBn_t txbn, const CAN_FRAME frame);
 ERROR_t MCP2515_sendMessageAfterCtrlCheck(const CAN_FRAME frame);
+// LOAD TX BUFFER without TXREQ; the frame waits for MCP2515_requestToSend()
+ERROR_t MCP2515_loadMessage(const TXBn_t txbn, const CAN_FRAME frame);
+// one RTS instruction for every mailbox in the bitmask (bit n = TXBn), RTS ALL for all three
+ERROR_t MCP2515_requestToSend(const uint8_t mailboxes);
+/*
+ * Send frames[0..n-1] in order and return how many were accepted. Without a
+ * transmit queue the free mailboxes are loaded and started with a single RTS,
+ * so at most three frames are taken per call. With a queue installed, all
+ * frames that fit are queued at once and the mailboxes are refilled as they
+ * complete. Acceptance stops at the first frame with an invalid DLC.
+ */
+uint32_t MCP2515_sendBatch(CAN_FRAME_t frames[], const uint32_t n);
+ERROR_t MCP2515_getTransmitResult(const TXBn_t txbn);
 ERROR_t MCP2515_readMessage(const RXBn_t rxbn, const CAN_FRAME frame);
 ERROR_t MCP2515_readMessageAfterStatCheck(const CAN_FRAME frame);
+/*
+ * Read frames until both receive buffers are empty and deliver them to ring in
+ * arrival order. Only the RXnIF of consumed buffers is cleared (by READ RX
+ * BUFFER itself). Returns the number of frames delivered.
+ * The oldest frame, the one that raised INT, is stamped with timestamp_us and
+ * ts_source; the others, and all of them when ts_source is CAN_TS_NONE, get
+ * the time they were read out (CAN_TS_READ). Pass the source through
+ * MCP2515_rxTimestampSource() first.
+ * Frames the software filter rejects are counted and never reach the ring.
+ * Frames are tagged with the acceptance filter that matched (filhit) and
+ * offered to the dispatch table, if one is installed; only frames no handler
+ * claims are delivered to ring, which may be NULL when everything is dispatched.
+ */
+uint32_t MCP2515_drainRx(CAN_RING ring, const int64_t timestamp_us, const can_ts_source_t ts_source);
+/*
+ * Source for MCP2515_drainRx() given the CANINTF value read first in the
+ * service pass. Any enabled flag asserts INT, so the INT (or SOF) stamp
+ * belongs to a received frame only if RXnIF was pending then and no other
+ * enabled flag was. Otherwise returns CAN_TS_NONE and the frames get their read time.
+ */
+can_ts_source_t MCP2515_rxTimestampSource(const uint8_t interrupts, const can_ts_source_t source);
+/*
+ * Install a sealed software filter (NULL accepts everything) and return the
+ * previous one. The swap waits for a running drain to finish, so the returned
+ * filter is no longer in use and may be destroyed.
+ */
+CAN_FILTER MCP2515_setSoftFilter(CAN_FILTER filter);
+/*
+ * Install a dispatch table (NULL removes it) and return the previous one. The
+ * table is sealed first; like the software filter, the swap waits for a
+ * running drain, so the returned table may be destroyed once its deferred
+ * handlers are idle.
+ */
+CAN_DISPATCH MCP2515_setRxDispatch(CAN_DISPATCH dispatch);
+void MCP2515_getRxStats(MCP2515_RX_STATS_t *stats);
+/*
+ * Install a transmit queue (NULL removes it) and return the previous one. The
+ * queue relies on TX0IF..TX2IF, so all three TX interrupts are enabled. The
+ * previous queue's loaded frames are aborted back into its heap; it keeps
+ * them there, and keeps accepting frames, until it is installed again.
+ */
+MCP2515_TXQ MCP2515_setTxQueue(MCP2515_TXQ txq);
 bool MCP2515_checkReceive(void);
 bool MCP2515_checkError(void);
 uint8_t MCP2515_getErrorFlags(void);
@@ -503,11 +720,34 @@ void MCP2515_clearRXnOVRFlags(void);
 uint8_t MCP2515_getInterrupts(void);
 uint8_t MCP2515_getInterruptMask(void);
 void MCP2515_clearInterrupts(void);
+/*
+ * Select the interrupt sources behind INT. With TX interrupts masked the
+ * mailboxes are reclaimed by the sender itself once all three look busy (one
+ * READ STATUS). TX_BATCHED keeps only TX0IE: TXB0 is loaded first and, at equal
+ * TXP, sent last, so its completion closes a batch of up to three frames.
+ */
+ERROR_t MCP2515_setInterruptProfile(const MCP2515_INT_PROFILE_t profile);
+// mask or restore RX0IE/RX1IE without touching the other sources, for polled receive
+void MCP2515_setRxInterrupts(const bool enabled);
+void MCP2515_clearInterruptFlags(const uint8_t flags);
 void MCP2515_clearTXInterrupts(void);
+void MCP2515_txCompleted(const uint8_t interrupts);
 uint8_t MCP2515_getStatus(void);
+uint8_t MCP2515_getRxStatus(void);
 void MCP2515_clearRXnOVR(void);
 void MCP2515_clearMERR();
 void MCP2515_clearERRIF();
+uint32_t MCP2515_getSpiTransactionCount(void);
+uint32_t MCP2515_getResetTime(void);
+uint32_t MCP2515_getModeSwitchTime(void);
+void MCP2515_resetSpiTransactionCount(void);
+/*
+ * Register shadow. MCP2515_syncShadow() reloads it (and the mailbox-busy
+ * bitmap) from the chip; MCP2515_auditShadow() compares it against the chip,
+ * logs every mismatch and returns ERROR_FAIL if there was one.
+ */
+ERROR_t MCP2515_syncShadow(void);
+ERROR_t MCP2515_auditShadow(void);
 
 extern MCP2515 MCP2515_Object;
 
@@ -0,0 +1,319 @@
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mcp2515_esp_irq.h"
+
+typedef struct MCP2515_ESP_IRQ_s {
+	MCP2515_ESP_IRQ_CONFIG_t config;
+	TaskHandle_t task;
+	// written by the ISR while the pin is unmasked, by nobody else
+	volatile int64_t asserted_us;
+	// set by the ISR, tells an INT wake-up from a poll timer wake-up
+	volatile bool int_fired;
+	// written by the SOF ISR only, sof_head counts edges
+	volatile int64_t sof_us[MCP2515_ESP_IRQ_SOF_HISTORY];
+	volatile uint32_t sof_head;
+	uint32_t sof_base;          // sof_head at the last stats reset
+	esp_timer_handle_t poll_timer;
+	bool polling;               // RX interrupts masked, the timer drives receive
+	uint8_t idle_polls;
+	portMUX_TYPE stats_lock;
+	MCP2515_ESP_IRQ_STATS_t stats;
+} MCP2515_ESP_IRQ_t;
+
+static MCP2515_ESP_IRQ_t irq = {
+    .task = NULL,
+    .stats_lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static void IRAM_ATTR MCP2515_ESP_IRQ_isr(void *arg)
+{
+    irq.asserted_us = esp_timer_get_time();
+    irq.int_fired = true;
+    // INT stays low until every flag is cleared, keep it masked until the task is done
+    gpio_intr_disable(irq.config.int_pin);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(irq.task, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void IRAM_ATTR MCP2515_ESP_IRQ_sofIsr(void *arg)
+{
+    irq.sof_us[irq.sof_head & (MCP2515_ESP_IRQ_SOF_HISTORY - 1)] = esp_timer_get_time();
+    irq.sof_head++;
+}
+
+// last SOF edge at or before the INT assertion and within one frame of it
+static bool MCP2515_ESP_IRQ_findSof(int64_t asserted_us, int64_t *sof_us)
+{
+    const uint32_t head = irq.sof_head;
+    for (uint32_t i = 1; i <= MCP2515_ESP_IRQ_SOF_HISTORY && i <= head; i++) {
+        const int64_t t = irq.sof_us[(head - i) & (MCP2515_ESP_IRQ_SOF_HISTORY - 1)];
+        if (t > asserted_us) {
+            // next frame already started, keep looking back
+            continue;
+        }
+        if (asserted_us - t > irq.config.sof_window_us) {
+            return false;
+        }
+        *sof_us = t;
+        return true;
+    }
+    return false;
+}
+
+static uint32_t MCP2515_ESP_IRQ_bucket(uint32_t us)
+{
+    uint32_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    return bucket < MCP2515_ESP_IRQ_HIST_BUCKETS ? bucket : MCP2515_ESP_IRQ_HIST_BUCKETS - 1;
+}
+
+static void MCP2515_ESP_IRQ_record(uint32_t latency_us, uint32_t extra_passes, bool sof_miss)
+{
+    portENTER_CRITICAL(&irq.stats_lock);
+    irq.stats.wakeups++;
+    irq.stats.sof_misses += sof_miss;
+    irq.stats.coalesced += extra_passes;
+    irq.stats.last_us = latency_us;
+    if (latency_us > irq.stats.max_us) {
+        irq.stats.max_us = latency_us;
+    }
+    irq.stats.hist[MCP2515_ESP_IRQ_bucket(latency_us)]++;
+    portEXIT_CRITICAL(&irq.stats_lock);
+}
+
+static void MCP2515_ESP_IRQ_pollTimer(void *arg)
+{
+    xTaskNotifyGive(irq.task);
+}
+
+static void MCP2515_ESP_IRQ_startPolling(void)
+{
+    MCP2515_setRxInterrupts(false);
+    irq.polling = true;
+    irq.idle_polls = 0;
+    esp_timer_start_periodic(irq.poll_timer, irq.config.poll_period_us);
+    portENTER_CRITICAL(&irq.stats_lock);
+    irq.stats.poll_entries++;
+    portEXIT_CRITICAL(&irq.stats_lock);
+}
+
+static void MCP2515_ESP_IRQ_stopPolling(void)
+{
+    esp_timer_stop(irq.poll_timer);
+    irq.polling = false;
+    // a frame that arrived after the last poll asserts INT as soon as RXnIE is back
+    MCP2515_setRxInterrupts(true);
+}
+
+// NAPI-style switch between interrupt-driven and polled receive
+static void MCP2515_ESP_IRQ_adapt(const uint32_t frames)
+{
+    const uint8_t threshold = irq.config.poll_threshold;
+    if (!irq.polling) {
+        if (threshold > 0 && frames >= threshold) {
+            MCP2515_ESP_IRQ_startPolling();
+        }
+        return;
+    }
+    if (frames > 0 && threshold > 0) {
+        irq.idle_polls = 0;
+    } else if (threshold == 0 || ++irq.idle_polls >= irq.config.poll_idle) {
+        MCP2515_ESP_IRQ_stopPolling();
+    }
+}
+
+static void MCP2515_ESP_IRQ_task(void *arg)
+{
+    while (1) {
+        const bool woken = ulTaskNotifyTake(pdTRUE, irq.config.idle_check) > 0;
+        const int64_t start_us = esp_timer_get_time();
+        uint32_t frames = 0;
+        if (woken && irq.int_fired) {
+            irq.int_fired = false;
+            const int64_t asserted_us = irq.asserted_us;
+            uint32_t latency_us = (uint32_t)(esp_timer_get_time() - asserted_us);
+            int64_t timestamp_us = asserted_us;
+            can_ts_source_t source = CAN_TS_INT;
+            bool sof_miss = false;
+            if (irq.config.sof_pin != GPIO_NUM_NC) {
+                if (MCP2515_ESP_IRQ_findSof(asserted_us, &timestamp_us)) {
+                    source = CAN_TS_SOF;
+                } else {
+                    sof_miss = true;
+                }
+            }
+
+            // keep servicing while INT is still asserted, new flags ride on this wake-up
+            uint32_t passes = 0;
+            do {
+                frames += irq.config.service(irq.config.arg, timestamp_us, source);
+                source = CAN_TS_NONE;
+            } while (gpio_get_level(irq.config.int_pin) == 0 && ++passes < irq.config.max_passes);
+
+            MCP2515_ESP_IRQ_record(latency_us, passes, sof_miss);
+            // a level that is still low fires again right away
+            gpio_intr_enable(irq.config.int_pin);
+            MCP2515_ESP_IRQ_adapt(frames);
+            portENTER_CRITICAL(&irq.stats_lock);
+            irq.stats.int_frames += frames;
+            portEXIT_CRITICAL(&irq.stats_lock);
+        } else if (woken && irq.polling) {
+            frames = irq.config.service(irq.config.arg, 0, CAN_TS_NONE);
+            MCP2515_ESP_IRQ_adapt(frames);
+            portENTER_CRITICAL(&irq.stats_lock);
+            irq.stats.polls++;
+            irq.stats.poll_frames += frames;
+            portEXIT_CRITICAL(&irq.stats_lock);
+        } else if (!woken && MCP2515_getInterrupts() != 0) {
+            portENTER_CRITICAL(&irq.stats_lock);
+            irq.stats.idle_hits++;
+            portEXIT_CRITICAL(&irq.stats_lock);
+            irq.config.service(irq.config.arg, 0, CAN_TS_NONE);
+            gpio_intr_enable(irq.config.int_pin);
+        } else {
+            // nothing pending, or a timer tick left over from the last polling period
+            continue;
+        }
+        const uint32_t busy_us = (uint32_t)(esp_timer_get_time() - start_us);
+        portENTER_CRITICAL(&irq.stats_lock);
+        irq.stats.busy_us += busy_us;
+        portEXIT_CRITICAL(&irq.stats_lock);
+    }
+}
+
+esp_err_t MCP2515_ESP_IRQ_start(const MCP2515_ESP_IRQ_CONFIG_t *config)
+{
+    if (config == NULL || config->service == NULL || config->max_passes == 0
+        || (config->poll_threshold > 0 && (config->poll_idle == 0 || config->poll_period_us == 0))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (irq.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    irq.config = *config;
+    irq.polling = false;
+    MCP2515_ESP_IRQ_resetStats();
+
+    if (irq.poll_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = MCP2515_ESP_IRQ_pollTimer,
+            .name = "mcp2515_poll",
+        };
+        if (esp_timer_create(&timer_args, &irq.poll_timer) != ESP_OK) {
+            ESP_LOGE(TAG_MCP2515, "Couldn't create the poll timer");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // the task must exist before the first interrupt can notify it
+    if (xTaskCreatePinnedToCore(MCP2515_ESP_IRQ_task, "mcp2515_irq", config->stack_size, NULL,
+                                config->priority, &irq.task, config->core) != pdPASS) {
+        ESP_LOGE(TAG_MCP2515, "Couldn't create the interrupt service task");
+        irq.task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    gpio_config_t io_conf = {
+        .intr_type = GPIO_INTR_LOW_LEVEL,
+        .mode = GPIO_MODE_INPUT,
+        .pin_bit_mask = (1ULL << config->int_pin),
+        .pull_down_en = 0,
+        .pull_up_en = 1,
+    };
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret == ESP_OK) {
+        ret = gpio_install_isr_service(0);
+        if (ret == ESP_ERR_INVALID_STATE) {
+            ret = ESP_OK;
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = gpio_isr_handler_add(config->int_pin, MCP2515_ESP_IRQ_isr, NULL);
+    }
+    if (ret == ESP_OK && config->sof_pin != GPIO_NUM_NC) {
+        // SOF goes high at the start of every frame on the bus
+        gpio_config_t sof_conf = {
+            .intr_type = GPIO_INTR_POSEDGE,
+            .mode = GPIO_MODE_INPUT,
+            .pin_bit_mask = (1ULL << config->sof_pin),
+            .pull_down_en = 1,
+            .pull_up_en = 0,
+        };
+        ret = gpio_config(&sof_conf);
+        if (ret == ESP_OK) {
+            ret = gpio_isr_handler_add(config->sof_pin, MCP2515_ESP_IRQ_sofIsr, NULL);
+        }
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_MCP2515, "INT pin setup failed: %s", esp_err_to_name(ret));
+        vTaskDelete(irq.task);
+        irq.task = NULL;
+    }
+    return ret;
+}
+
+void MCP2515_ESP_IRQ_getStats(MCP2515_ESP_IRQ_STATS_t *stats)
+{
+    portENTER_CRITICAL(&irq.stats_lock);
+    *stats = irq.stats;
+    portEXIT_CRITICAL(&irq.stats_lock);
+    stats->sof_edges = irq.sof_head - irq.sof_base;
+}
+
+void MCP2515_ESP_IRQ_resetStats(void)
+{
+    portENTER_CRITICAL(&irq.stats_lock);
+    memset(&irq.stats, 0, sizeof(irq.stats));
+    irq.stats.since_us = esp_timer_get_time();
+    irq.sof_base = irq.sof_head;
+    portEXIT_CRITICAL(&irq.stats_lock);
+}
+
+void MCP2515_ESP_IRQ_setAdaptive(const uint8_t poll_threshold, const uint32_t poll_period_us, const uint8_t poll_idle)
+{
+    // read by the service task one field at a time; only the threshold is checked while polling
+    irq.config.poll_idle = poll_idle > 0 ? poll_idle : 1;
+    if (poll_period_us > 0) {
+        irq.config.poll_period_us = poll_period_us;
+    }
+    irq.config.poll_threshold = poll_threshold;
+    if (irq.task != NULL && irq.polling) {
+        // a tick makes the task notice a threshold of 0 without waiting for a frame
+        xTaskNotifyGive(irq.task);
+    }
+}
+
+void MCP2515_ESP_IRQ_logStats(const char *tag)
+{
+    MCP2515_ESP_IRQ_STATS_t stats;
+    MCP2515_ESP_IRQ_getStats(&stats);
+    ESP_LOGI(tag, "INT latency: last %lu us, max %lu us (%lu wake-ups, %lu coalesced, %lu idle hits)",
+             (unsigned long)stats.last_us, (unsigned long)stats.max_us, (unsigned long)stats.wakeups,
+             (unsigned long)stats.coalesced, (unsigned long)stats.idle_hits);
+    const int64_t elapsed_us = esp_timer_get_time() - stats.since_us;
+    ESP_LOGI(tag, "  RX: %lu frames by INT, %lu by %lu polls (%lu switches to polling), service CPU %.1f%%",
+             (unsigned long)stats.int_frames, (unsigned long)stats.poll_frames, (unsigned long)stats.polls,
+             (unsigned long)stats.poll_entries,
+             elapsed_us > 0 ? 100.0f * (float)stats.busy_us / (float)elapsed_us : 0.0f);
+    if (irq.config.sof_pin != GPIO_NUM_NC) {
+        ESP_LOGI(tag, "  SOF: %lu edges, %lu wake-ups without a matching edge",
+                 (unsigned long)stats.sof_edges, (unsigned long)stats.sof_misses);
+    }
+    for (int i = 0; i < MCP2515_ESP_IRQ_HIST_BUCKETS; i++) {
+        if (stats.hist[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            ESP_LOGI(tag, "  < 1 us: %lu", (unsigned long)stats.hist[i]);
+        } else if (i == MCP2515_ESP_IRQ_HIST_BUCKETS - 1) {
+            ESP_LOGI(tag, "  >= %lu us: %lu", 1UL << (i - 1), (unsigned long)stats.hist[i]);
+        } else {
+            ESP_LOGI(tag, "  %lu-%lu us: %lu", 1UL << (i - 1), (1UL << i) - 1, (unsigned long)stats.hist[i]);
+        }
+    }
+}
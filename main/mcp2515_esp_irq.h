@@ -0,0 +1,104 @@
+#ifndef _MCP2515_ESP_IRQ_H_
+#define _MCP2515_ESP_IRQ_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "mcp2515.h"
+
+/*
+ * ESP-IDF interrupt path of the MCP2515. INT is taken as a low level: the ISR
+ * stamps the assertion time, masks the pin and wakes a dedicated service task
+ * with vTaskNotifyGiveFromISR(). The task, pinned to a configurable core at a
+ * configurable priority, calls the service callback until INT is released and
+ * then unmasks the pin, so flags raised during a pass are folded into the same
+ * wake-up instead of costing another one.
+ *
+ * Each wake-up hands the service callback a receive timestamp for the frame
+ * that raised INT. By default it is the INT assertion time taken in the ISR.
+ * With sof_pin set, the MCP2515 start-of-frame output (CNF3.SOF, enabled by
+ * MCP2515_configClkOut(CLKOUT_DISABLE)) is captured as well and the last SOF
+ * edge before the INT assertion is used instead, which removes the frame
+ * length and leaves only GPIO interrupt entry (a few us) as error. SOF pulses
+ * for every frame on the bus, so that pin takes one interrupt per bus frame.
+ *
+ * Receive switches between interrupts and polling the way Linux NAPI does.
+ * When one wake-up picks up poll_threshold frames or more, RX0IE/RX1IE are
+ * masked and a poll_period_us esp_timer drives the service passes instead;
+ * after poll_idle empty polls in a row the RX interrupts come back. Other
+ * sources keep using INT throughout. Polled frames carry their read time
+ * (CAN_TS_READ), so polling trades up to one period of latency for one
+ * wake-up per period instead of one per frame.
+ */
+
+// timestamp_us/source describe the INT assertion that started the pass, CAN_TS_NONE
+// on passes that were not started by a fresh one. It dates a received frame only if
+// RXnIF was what asserted INT, see MCP2515_rxTimestampSource(). Returns the frames received
+typedef uint32_t (*MCP2515_ESP_IRQ_SERVICE_CB)(void *arg, int64_t timestamp_us, can_ts_source_t source);
+
+typedef struct MCP2515_ESP_IRQ_CONFIG_s {
+	gpio_num_t int_pin;
+	UBaseType_t priority;
+	BaseType_t core;            // tskNO_AFFINITY lets the scheduler pick
+	uint32_t stack_size;
+	uint8_t max_passes;         // service passes per wake-up before the pin is unmasked anyway
+	TickType_t idle_check;      // CANINTF is polled after this long without an interrupt
+	gpio_num_t sof_pin;         // MCP2515 CLKOUT/SOF pin, GPIO_NUM_NC to stamp at INT
+	uint32_t sof_window_us;     // longest frame: an SOF further back than this is not ours
+	uint8_t poll_threshold;     // frames in one wake-up that switch RX to polling, 0 never polls
+	uint8_t poll_idle;          // empty polls in a row that switch back to interrupts
+	uint32_t poll_period_us;
+	MCP2515_ESP_IRQ_SERVICE_CB service;
+	void *arg;
+} MCP2515_ESP_IRQ_CONFIG_t;
+
+#define MCP2515_ESP_IRQ_DEFAULT_CONFIG(pin, cb, cb_arg) { \
+	.int_pin = (pin),                                     \
+	.priority = configMAX_PRIORITIES - 3,                 \
+	.core = portNUM_PROCESSORS - 1,                       \
+	.stack_size = 4096,                                   \
+	.max_passes = 8,                                      \
+	.idle_check = pdMS_TO_TICKS(1000),                    \
+	.sof_pin = GPIO_NUM_NC,                               \
+	.sof_window_us = 2000,                                \
+	.poll_threshold = 3,                                  \
+	.poll_idle = 4,                                       \
+	.poll_period_us = 250,                                \
+	.service = (cb),                                      \
+	.arg = (cb_arg),                                      \
+}
+
+// SOF edges remembered for matching against the next INT assertion, power of two
+#define MCP2515_ESP_IRQ_SOF_HISTORY 8
+
+// bucket 0 counts latencies under 1 us, bucket n (n > 0) [2^(n-1), 2^n) us, the last one everything above
+#define MCP2515_ESP_IRQ_HIST_BUCKETS 16
+
+typedef struct MCP2515_ESP_IRQ_STATS_s {
+	uint32_t wakeups;           // interrupts serviced
+	uint32_t coalesced;         // extra passes because INT was still low after a pass
+	uint32_t idle_hits;         // pending flags found by the idle check, i.e. a lost interrupt
+	uint32_t sof_edges;
+	uint32_t sof_misses;        // wake-ups without a matching SOF edge, stamped at INT instead
+	uint32_t last_us;           // INT assertion to start of service
+	uint32_t max_us;
+	uint32_t hist[MCP2515_ESP_IRQ_HIST_BUCKETS];
+	uint32_t int_frames;        // frames picked up by interrupt wake-ups
+	uint32_t poll_frames;       // frames picked up by timer polls
+	uint32_t polls;
+	uint32_t poll_entries;      // switches from interrupts to polling
+	uint64_t busy_us;           // time spent servicing, against the time since since_us gives the CPU load
+	int64_t since_us;           // last stats reset
+} MCP2515_ESP_IRQ_STATS_t;
+
+esp_err_t MCP2515_ESP_IRQ_start(const MCP2515_ESP_IRQ_CONFIG_t *config);
+void MCP2515_ESP_IRQ_getStats(MCP2515_ESP_IRQ_STATS_t *stats);
+void MCP2515_ESP_IRQ_resetStats(void);
+// change the polling parameters at run time, poll_threshold 0 returns to interrupts for good;
+// a new period applies from the next switch to polling
+void MCP2515_ESP_IRQ_setAdaptive(const uint8_t poll_threshold, const uint32_t poll_period_us, const uint8_t poll_idle);
+void MCP2515_ESP_IRQ_logStats(const char *tag);
+
+#endif
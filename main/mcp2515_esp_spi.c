@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "mcp2515_esp_spi.h"
+
+typedef struct MCP2515_ESP_SPI_s {
+	spi_device_handle_t spi;
+	SemaphoreHandle_t mutex;
+	// transactions handed to spi_device_queue_trans(), reused round-robin
+	spi_transaction_t queue_pool[MCP2515_PIPELINE_DEPTH];
+	uint8_t queue_next;
+} MCP2515_ESP_SPI_t[1], *MCP2515_ESP_SPI;
+
+static void MCP2515_ESP_SPI_prepare(spi_transaction_t *trans, const uint8_t *tx, uint8_t *rx, const size_t len)
+{
+    memset(trans, 0, sizeof(*trans));
+    trans->length = len * 8;
+    if (len <= 4) {
+        // short instructions travel in the transaction itself, no DMA descriptors
+        trans->flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
+        memcpy(trans->tx_data, tx, len);
+    } else {
+        trans->tx_buffer = tx;
+        trans->rx_buffer = rx;
+    }
+}
+
+static ERROR_t MCP2515_ESP_SPI_transfer(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, bool polling)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    spi_transaction_t trans;
+    MCP2515_ESP_SPI_prepare(&trans, tx, rx, len);
+    esp_err_t ret = polling ? spi_device_polling_transmit(dev->spi, &trans)
+                            : spi_device_transmit(dev->spi, &trans);
+    if (ret != ESP_OK) {
+        return ERROR_FAIL;
+    }
+    if (len <= 4 && rx != NULL) {
+        memcpy(rx, trans.rx_data, len);
+    }
+    return ERROR_OK;
+}
+
+static ERROR_t MCP2515_ESP_SPI_queue(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, void *user)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    spi_transaction_t *trans = &dev->queue_pool[dev->queue_next];
+    dev->queue_next = (dev->queue_next + 1) % MCP2515_PIPELINE_DEPTH;
+    memset(trans, 0, sizeof(*trans));
+    // queued transfers always use the caller's buffers, they outlive this call
+    trans->length = len * 8;
+    trans->tx_buffer = tx;
+    trans->rx_buffer = rx;
+    trans->user = user;
+    return spi_device_queue_trans(dev->spi, trans, portMAX_DELAY) == ESP_OK ? ERROR_OK : ERROR_FAIL;
+}
+
+static ERROR_t MCP2515_ESP_SPI_getResult(void *ctx, void **user)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    spi_transaction_t *trans = NULL;
+    if (spi_device_get_trans_result(dev->spi, &trans, portMAX_DELAY) != ESP_OK || trans == NULL) {
+        return ERROR_FAIL;
+    }
+    *user = trans->user;
+    return ERROR_OK;
+}
+
+static void MCP2515_ESP_SPI_lock(void *ctx)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    xSemaphoreTake(dev->mutex, portMAX_DELAY);
+}
+
+static void MCP2515_ESP_SPI_unlock(void *ctx)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    xSemaphoreGive(dev->mutex);
+}
+
+static ERROR_t MCP2515_ESP_SPI_acquire(void *ctx)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    return spi_device_acquire_bus(dev->spi, portMAX_DELAY) == ESP_OK ? ERROR_OK : ERROR_FAIL;
+}
+
+static void MCP2515_ESP_SPI_release(void *ctx)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)ctx;
+    spi_device_release_bus(dev->spi);
+}
+
+MCP2515_TRANSPORT MCP2515_ESP_SPI_create(spi_device_handle_t spi)
+{
+    MCP2515_ESP_SPI dev = (MCP2515_ESP_SPI)calloc(1, sizeof(MCP2515_ESP_SPI_t));
+    MCP2515_TRANSPORT transport = (MCP2515_TRANSPORT)calloc(1, sizeof(MCP2515_TRANSPORT_t));
+    if (dev == NULL || transport == NULL) {
+        ESP_LOGE(TAG_MCP2515, "Couldn't allocate the ESP SPI transport. (NULL pointer)");
+        free(dev);
+        free(transport);
+        return NULL;
+    }
+    dev->spi = spi;
+    dev->mutex = xSemaphoreCreateMutex();
+    if (dev->mutex == NULL) {
+        ESP_LOGE(TAG_MCP2515, "Couldn't create the SPI mutex");
+        free(dev);
+        free(transport);
+        return NULL;
+    }
+
+    transport->ctx = dev;
+    transport->transfer = MCP2515_ESP_SPI_transfer;
+    transport->queue = MCP2515_ESP_SPI_queue;
+    transport->get_result = MCP2515_ESP_SPI_getResult;
+    transport->lock = MCP2515_ESP_SPI_lock;
+    transport->unlock = MCP2515_ESP_SPI_unlock;
+    transport->acquire = MCP2515_ESP_SPI_acquire;
+    transport->release = MCP2515_ESP_SPI_release;
+    return transport;
+}
@@ -0,0 +1,13 @@
+#ifndef _MCP2515_ESP_SPI_H_
+#define _MCP2515_ESP_SPI_H_
+
+#include "driver/spi_master.h"
+#include "mcp2515.h"
+
+/*
+ * ESP-IDF SPI master backend of MCP2515_TRANSPORT. The device must be added
+ * with a queue_size of at least MCP2515_PIPELINE_DEPTH.
+ */
+MCP2515_TRANSPORT MCP2515_ESP_SPI_create(spi_device_handle_t spi);
+
+#endif
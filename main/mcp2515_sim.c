@@ -0,0 +1,550 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcp2515_sim.h"
+
+#define SIM_REG_MASK 0x7F
+
+// offsets inside a TX/RX buffer block (TXBnCTRL / RXBnCTRL at offset 0)
+#define SIM_BUF_SIDH 1
+#define SIM_BUF_D0   6
+#define SIM_BUF_END  0x0E
+
+static const uint8_t sim_txb_base[N_TXBUFFERS] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
+static const uint8_t sim_rxb_base[N_RXBUFFERS] = {MCP_RXB0CTRL, MCP_RXB1CTRL};
+static const uint8_t sim_filter_reg[6] = {MCP_RXF0SIDH, MCP_RXF1SIDH, MCP_RXF2SIDH,
+                                          MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
+static const CANINTF_t sim_txif[N_TXBUFFERS] = {CANINTF_TX0IF, CANINTF_TX1IF, CANINTF_TX2IF};
+static const CANINTF_t sim_rxif[N_RXBUFFERS] = {CANINTF_RX0IF, CANINTF_RX1IF};
+
+static uint8_t sim_mode(const MCP2515_SIM sim)
+{
+    return sim->regs[MCP_CANSTAT] & CANSTAT_OPMOD;
+}
+
+static bool sim_config_protected(const uint8_t addr)
+{
+    // filters, masks and CNF1-3 only accept writes in configuration mode
+    return (addr <= MCP_RXF2EID0)
+        || (addr >= MCP_RXF3SIDH && addr <= MCP_RXF5EID0)
+        || (addr >= MCP_RXM0SIDH && addr <= MCP_CNF1);
+}
+
+static bool sim_bit_modifiable(const uint8_t addr)
+{
+    switch (addr) {
+        case 0x0C: // BFPCTRL
+        case 0x0D: // TXRTSCTRL
+        case MCP_CANCTRL:
+        case MCP_CNF3:
+        case MCP_CNF2:
+        case MCP_CNF1:
+        case MCP_CANINTE:
+        case MCP_CANINTF:
+        case MCP_EFLG:
+        case MCP_TXB0CTRL:
+        case MCP_TXB1CTRL:
+        case MCP_TXB2CTRL:
+        case MCP_RXB0CTRL:
+        case MCP_RXB1CTRL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void sim_abort(MCP2515_SIM sim, const int n)
+{
+    uint8_t *ctrl = &sim->regs[sim_txb_base[n]];
+    if (*ctrl & TXB_TXREQ) {
+        *ctrl = (*ctrl & ~TXB_TXREQ) | TXB_ABTF;
+    }
+}
+
+static uint8_t sim_icod(const MCP2515_SIM sim)
+{
+    const uint8_t pending = sim->regs[MCP_CANINTE] & sim->regs[MCP_CANINTF];
+    static const struct { uint8_t flag; uint8_t icod; } order[] = {
+        {CANINTF_ERRIF, 1}, {CANINTF_WAKIF, 2}, {CANINTF_TX0IF, 3}, {CANINTF_TX1IF, 4},
+        {CANINTF_TX2IF, 5}, {CANINTF_RX0IF, 6}, {CANINTF_RX1IF, 7},
+    };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (pending & order[i].flag) {
+            return order[i].icod << 1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t sim_read(MCP2515_SIM sim, const uint8_t addr)
+{
+    const uint8_t reg = addr & SIM_REG_MASK;
+    if (reg == MCP_CANSTAT || (reg & 0x0F) == 0x0E) {
+        // CANSTAT is mirrored at xEh in every register row
+        return (sim->regs[MCP_CANSTAT] & CANSTAT_OPMOD) | sim_icod(sim);
+    }
+    if ((reg & 0x0F) == 0x0F) {
+        return sim->regs[MCP_CANCTRL];
+    }
+    return sim->regs[reg];
+}
+
+static void sim_write(MCP2515_SIM sim, const uint8_t addr, const uint8_t value)
+{
+    const uint8_t reg = addr & SIM_REG_MASK;
+
+    if (sim_config_protected(reg) && sim_mode(sim) != CANCTRL_REQOP_CONFIG) {
+        return;
+    }
+
+    switch (reg) {
+        case MCP_CANSTAT:
+        case MCP_TEC:
+        case MCP_REC:
+            return;
+
+        case MCP_CANCTRL:
+            sim->regs[MCP_CANCTRL] = value;
+            // the model switches mode immediately
+            sim->regs[MCP_CANSTAT] = (sim->regs[MCP_CANSTAT] & ~CANSTAT_OPMOD) | (value & CANCTRL_REQOP);
+            if (value & CANCTRL_ABAT) {
+                for (int n = 0; n < N_TXBUFFERS; n++) {
+                    sim_abort(sim, n);
+                }
+            }
+            return;
+
+        case MCP_EFLG:
+            // only RX0OVR/RX1OVR are writable, and only to clear them
+            sim->regs[MCP_EFLG] &= value | ~(EFLG_RX0OVR | EFLG_RX1OVR);
+            return;
+
+        case MCP_TXB0CTRL:
+        case MCP_TXB1CTRL:
+        case MCP_TXB2CTRL: {
+            const int n = (reg - MCP_TXB0CTRL) >> 4;
+            uint8_t *ctrl = &sim->regs[reg];
+            if ((value & TXB_TXREQ) && !(*ctrl & TXB_TXREQ)) {
+                *ctrl &= ~(TXB_ABTF | TXB_MLOA | TXB_TXERR);
+                *ctrl |= TXB_TXREQ;
+            } else if (!(value & TXB_TXREQ) && !(sim->on_bus & (1U << n))) {
+                sim_abort(sim, n);
+            }
+            *ctrl = (*ctrl & ~TXB_TXP) | (value & TXB_TXP);
+            return;
+        }
+
+        case MCP_RXB0CTRL:
+            sim->regs[reg] = (sim->regs[reg] & ~(RXBnCTRL_RXM_MASK | RXB0CTRL_BUKT))
+                           | (value & (RXBnCTRL_RXM_MASK | RXB0CTRL_BUKT));
+            return;
+
+        case MCP_RXB1CTRL:
+            sim->regs[reg] = (sim->regs[reg] & ~RXBnCTRL_RXM_MASK) | (value & RXBnCTRL_RXM_MASK);
+            return;
+
+        default:
+            break;
+    }
+
+    if (reg > MCP_RXB0CTRL) {
+        // receive buffers are read-only
+        return;
+    }
+    sim->regs[reg] = value;
+}
+
+static void sim_encode_rx(uint8_t *buf, const CAN_FRAME frame)
+{
+    const bool ext = (frame->can_id & CAN_EFF_FLAG) != 0;
+    const bool rtr = (frame->can_id & CAN_RTR_FLAG) != 0;
+    const uint8_t dlc = frame->can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->can_dlc;
+
+    if (ext) {
+        const uint32_t id = frame->can_id & CAN_EFF_MASK;
+        buf[0] = (uint8_t)(id >> 21);
+        buf[1] = (uint8_t)(((id >> 13) & 0xE0) | TXB_EXIDE_MASK | ((id >> 16) & 0x03));
+        buf[2] = (uint8_t)(id >> 8);
+        buf[3] = (uint8_t)id;
+        // extended remote frames report RTR in RXBnDLC
+        buf[4] = dlc | (rtr ? RTR_MASK : 0);
+    } else {
+        const uint32_t id = frame->can_id & CAN_SFF_MASK;
+        buf[0] = (uint8_t)(id >> 3);
+        // standard remote frames report SRR in RXBnSIDL
+        buf[1] = (uint8_t)(((id & 0x07) << 5) | (rtr ? RXBnSIDL_SRR : 0));
+        buf[2] = 0;
+        buf[3] = 0;
+        buf[4] = dlc;
+    }
+    memset(&buf[5], 0, CAN_MAX_DLEN);
+    memcpy(&buf[5], frame->data, dlc);
+}
+
+static void sim_decode_tx(const uint8_t *buf, const CAN_FRAME frame)
+{
+    uint32_t id = ((uint32_t)buf[0] << 3) | (buf[1] >> 5);
+    if (buf[1] & TXB_EXIDE_MASK) {
+        id = (id << 18) | ((uint32_t)(buf[1] & 0x03) << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+        id |= CAN_EFF_FLAG;
+    }
+    if (buf[4] & RTR_MASK) {
+        id |= CAN_RTR_FLAG;
+    }
+    frame->can_id = id;
+    frame->can_dlc = buf[4] & DLC_MASK;
+    if (frame->can_dlc > CAN_MAX_DLEN) {
+        frame->can_dlc = CAN_MAX_DLEN;
+    }
+    memcpy(frame->data, &buf[5], CAN_MAX_DLEN);
+}
+
+static uint32_t sim_id_bits(const uint8_t *r, const bool ext)
+{
+    uint32_t sid = ((uint32_t)r[0] << 3) | (r[1] >> 5);
+    if (!ext) {
+        return sid;
+    }
+    return (sid << 18) | ((uint32_t)(r[1] & 0x03) << 16) | ((uint32_t)r[2] << 8) | r[3];
+}
+
+static bool sim_filter_match(const MCP2515_SIM sim, const uint8_t mask_reg, const uint8_t filter_reg,
+                             const CAN_FRAME frame)
+{
+    const uint8_t *mask = &sim->regs[mask_reg];
+    const uint8_t *filter = &sim->regs[filter_reg];
+    const bool ext = (frame->can_id & CAN_EFF_FLAG) != 0;
+
+    if (((filter[1] & TXB_EXIDE_MASK) != 0) != ext) {
+        return false;
+    }
+    const uint32_t id = frame->can_id & (ext ? CAN_EFF_MASK : CAN_SFF_MASK);
+    const uint32_t m = sim_id_bits(mask, ext);
+    if ((id & m) != (sim_id_bits(filter, ext) & m)) {
+        return false;
+    }
+    if (!ext) {
+        // for standard frames the EID8/EID0 mask bits apply to the first two data bytes
+        const uint8_t d0 = frame->can_dlc > 0 ? frame->data[0] : 0;
+        const uint8_t d1 = frame->can_dlc > 1 ? frame->data[1] : 0;
+        if (((d0 ^ filter[2]) & mask[2]) || ((d1 ^ filter[3]) & mask[3])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// index of the filter that accepts the frame for this buffer, -1 if none
+static int sim_accept(const MCP2515_SIM sim, const int rxb, const CAN_FRAME frame)
+{
+    const uint8_t rxm = sim->regs[sim_rxb_base[rxb]] & RXBnCTRL_RXM_MASK;
+    const bool ext = (frame->can_id & CAN_EFF_FLAG) != 0;
+    const int first = (rxb == 0) ? 0 : 2;
+    const int last = (rxb == 0) ? 1 : 5;
+    const uint8_t mask_reg = (rxb == 0) ? MCP_RXM0SIDH : MCP_RXM1SIDH;
+
+    if (rxm == RXBnCTRL_RXM_MASK) {
+        // filters off, receive any message
+        return first;
+    }
+    if ((rxm == RXBnCTRL_RXM_STD && ext) || (rxm == RXBnCTRL_RXM_EXT && !ext)) {
+        return -1;
+    }
+    for (int f = first; f <= last; f++) {
+        if (sim_filter_match(sim, mask_reg, sim_filter_reg[f], frame)) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+static void sim_store(MCP2515_SIM sim, const int rxb, const int filhit, const CAN_FRAME frame)
+{
+    const uint8_t base = sim_rxb_base[rxb];
+    sim_encode_rx(&sim->regs[base + SIM_BUF_SIDH], frame);
+
+    uint8_t ctrl = sim->regs[base] & (RXBnCTRL_RXM_MASK | RXB0CTRL_BUKT);
+    if (frame->can_id & CAN_RTR_FLAG) {
+        ctrl |= RXBnCTRL_RTR;
+    }
+    if (rxb == 0) {
+        ctrl = (ctrl & ~0x03) | (filhit & RXB0CTRL_FILHIT_MASK);
+        if (ctrl & RXB0CTRL_BUKT) {
+            ctrl |= 0x02; // BUKT1 read-only copy
+        }
+    } else {
+        ctrl = (ctrl & ~RXB0CTRL_BUKT) | (filhit & RXB1CTRL_FILHIT_MASK);
+    }
+    sim->regs[base] = ctrl;
+    sim->regs[MCP_CANINTF] |= sim_rxif[rxb];
+    sim->frames_received++;
+}
+
+static void sim_overrun(MCP2515_SIM sim, const EFLG_t flag)
+{
+    sim->regs[MCP_EFLG] |= flag;
+    sim->regs[MCP_CANINTF] |= CANINTF_ERRIF;
+    sim->overruns++;
+}
+
+static bool sim_receive(MCP2515_SIM sim, const CAN_FRAME frame)
+{
+    const int hit0 = sim_accept(sim, 0, frame);
+    if (hit0 >= 0) {
+        if (!(sim->regs[MCP_CANINTF] & CANINTF_RX0IF)) {
+            sim_store(sim, 0, hit0, frame);
+            return true;
+        }
+        if (sim->regs[MCP_RXB0CTRL] & RXB0CTRL_BUKT) {
+            if (!(sim->regs[MCP_CANINTF] & CANINTF_RX1IF)) {
+                sim_store(sim, 1, hit0, frame);
+                return true;
+            }
+            sim_overrun(sim, EFLG_RX1OVR);
+            return false;
+        }
+        sim_overrun(sim, EFLG_RX0OVR);
+        return false;
+    }
+
+    const int hit1 = sim_accept(sim, 1, frame);
+    if (hit1 >= 0) {
+        if (!(sim->regs[MCP_CANINTF] & CANINTF_RX1IF)) {
+            sim_store(sim, 1, hit1, frame);
+            return true;
+        }
+        sim_overrun(sim, EFLG_RX1OVR);
+        return false;
+    }
+
+    sim->frames_rejected++;
+    return false;
+}
+
+static uint8_t sim_read_status(const MCP2515_SIM sim)
+{
+    const uint8_t intf = sim->regs[MCP_CANINTF];
+    uint8_t status = intf & (CANINTF_RX0IF | CANINTF_RX1IF);
+    const uint8_t reqbits[N_TXBUFFERS] = {STAT_TX0REQ, STAT_TX1REQ, STAT_TX2REQ};
+    const uint8_t ifbits[N_TXBUFFERS] = {STAT_TX0IF, STAT_TX1IF, STAT_TX2IF};
+    for (int n = 0; n < N_TXBUFFERS; n++) {
+        if (sim->regs[sim_txb_base[n]] & TXB_TXREQ) {
+            status |= reqbits[n];
+        }
+        if (intf & sim_txif[n]) {
+            status |= ifbits[n];
+        }
+    }
+    return status;
+}
+
+static uint8_t sim_rx_status(const MCP2515_SIM sim)
+{
+    const uint8_t intf = sim->regs[MCP_CANINTF];
+    uint8_t status = 0;
+    if (intf & CANINTF_RX0IF) status |= RXSTAT_RXB0;
+    if (intf & CANINTF_RX1IF) status |= RXSTAT_RXB1;
+    if (status == 0) {
+        return 0;
+    }
+
+    // frame type and filter hit describe RXB0 when both buffers are full
+    const int rxb = (intf & CANINTF_RX0IF) ? 0 : 1;
+    const uint8_t base = sim_rxb_base[rxb];
+    if (sim->regs[base + 2] & TXB_EXIDE_MASK) status |= RXSTAT_EXT;
+    if (sim->regs[base] & RXBnCTRL_RTR) status |= RXSTAT_RTR;
+    uint8_t filhit = sim->regs[base] & (rxb == 0 ? RXB0CTRL_FILHIT_MASK & 0x01 : RXB1CTRL_FILHIT_MASK);
+    if (rxb == 1 && filhit < 2) {
+        filhit += 6; // RXF0/RXF1 rolled over into RXB1
+    }
+    return status | filhit;
+}
+
+static ERROR_t MCP2515_SIM_transfer(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, bool polling)
+{
+    MCP2515_SIM sim = (MCP2515_SIM)ctx;
+    (void)polling;
+    if (len == 0) {
+        return ERROR_FAIL;
+    }
+    sim->transfers++;
+    if (rx != NULL) {
+        memset(rx, 0, len);
+    }
+
+    const uint8_t op = tx[0];
+    if (op == INSTRUCTION_RESET) {
+        MCP2515_SIM_reset(sim);
+    } else if (op == INSTRUCTION_READ && len >= 2) {
+        uint8_t addr = tx[1];
+        for (size_t i = 2; i < len; i++, addr++) {
+            const uint8_t value = sim_read(sim, addr);
+            if (rx != NULL) rx[i] = value;
+        }
+    } else if (op == INSTRUCTION_WRITE && len >= 2) {
+        uint8_t addr = tx[1];
+        for (size_t i = 2; i < len; i++, addr++) {
+            sim_write(sim, addr, tx[i]);
+        }
+    } else if (op == INSTRUCTION_BITMOD && len >= 4) {
+        const uint8_t reg = tx[1] & SIM_REG_MASK;
+        const uint8_t mask = sim_bit_modifiable(reg) ? tx[2] : 0xFF;
+        sim_write(sim, reg, (uint8_t)((sim_read(sim, reg) & ~mask) | (tx[3] & mask)));
+    } else if ((op & 0xF8) == INSTRUCTION_LOAD_TX0) {
+        const int n = (op >> 1) & 0x03;
+        if (n < N_TXBUFFERS) {
+            const uint8_t base = sim_txb_base[n];
+            uint8_t offset = (op & 0x01) ? SIM_BUF_D0 : SIM_BUF_SIDH;
+            for (size_t i = 1; i < len && offset < SIM_BUF_END; i++, offset++) {
+                sim->regs[base + offset] = tx[i];
+            }
+        }
+    } else if ((op & 0xF8) == 0x80) {
+        for (int n = 0; n < N_TXBUFFERS; n++) {
+            if (op & (1U << n)) {
+                sim_write(sim, sim_txb_base[n], sim->regs[sim_txb_base[n]] | TXB_TXREQ);
+            }
+        }
+    } else if ((op & 0xF9) == INSTRUCTION_READ_RX0) {
+        const int n = (op >> 2) & 0x01;
+        const uint8_t base = sim_rxb_base[n];
+        uint8_t offset = (op & 0x02) ? SIM_BUF_D0 : SIM_BUF_SIDH;
+        for (size_t i = 1; i < len && offset < SIM_BUF_END; i++, offset++) {
+            if (rx != NULL) rx[i] = sim->regs[base + offset];
+        }
+        // RXnIF is cleared when CS is raised after READ RX BUFFER
+        sim->regs[MCP_CANINTF] &= ~sim_rxif[n];
+    } else if (op == INSTRUCTION_READ_STATUS) {
+        const uint8_t status = sim_read_status(sim);
+        for (size_t i = 1; i < len; i++) {
+            if (rx != NULL) rx[i] = status;
+        }
+    } else if (op == INSTRUCTION_RX_STATUS) {
+        const uint8_t status = sim_rx_status(sim);
+        for (size_t i = 1; i < len; i++) {
+            if (rx != NULL) rx[i] = status;
+        }
+    }
+
+    if (sim->auto_transmit) {
+        while (MCP2515_SIM_transmitPending(sim)) {
+        }
+    }
+    return ERROR_OK;
+}
+
+static ERROR_t MCP2515_SIM_queue(void *ctx, const uint8_t *tx, uint8_t *rx, size_t len, void *user)
+{
+    MCP2515_SIM sim = (MCP2515_SIM)ctx;
+    if (sim->queued_count >= MCP2515_PIPELINE_DEPTH) {
+        return ERROR_FAIL;
+    }
+    ERROR_t ret = MCP2515_SIM_transfer(ctx, tx, rx, len, false);
+    if (ret != ERROR_OK) {
+        return ret;
+    }
+    sim->queued[(sim->queued_head + sim->queued_count) % MCP2515_PIPELINE_DEPTH] = user;
+    sim->queued_count++;
+    return ERROR_OK;
+}
+
+static ERROR_t MCP2515_SIM_getResult(void *ctx, void **user)
+{
+    MCP2515_SIM sim = (MCP2515_SIM)ctx;
+    if (sim->queued_count == 0) {
+        return ERROR_FAIL;
+    }
+    *user = sim->queued[sim->queued_head];
+    sim->queued_head = (sim->queued_head + 1) % MCP2515_PIPELINE_DEPTH;
+    sim->queued_count--;
+    return ERROR_OK;
+}
+
+MCP2515_SIM MCP2515_SIM_create(void)
+{
+    MCP2515_SIM sim = (MCP2515_SIM)calloc(1, sizeof(MCP2515_SIM_t));
+    if (sim == NULL) {
+        return NULL;
+    }
+    sim->auto_transmit = true;
+    sim->transport->ctx = sim;
+    sim->transport->transfer = MCP2515_SIM_transfer;
+    sim->transport->queue = MCP2515_SIM_queue;
+    sim->transport->get_result = MCP2515_SIM_getResult;
+    MCP2515_SIM_reset(sim);
+    return sim;
+}
+
+void MCP2515_SIM_destroy(MCP2515_SIM sim)
+{
+    free(sim);
+}
+
+void MCP2515_SIM_reset(MCP2515_SIM sim)
+{
+    // power-on state: configuration mode, CLKOUT enabled at Fosc/8
+    memset(sim->regs, 0, sizeof(sim->regs));
+    sim->regs[MCP_CANSTAT] = CANCTRL_REQOP_CONFIG;
+    sim->regs[MCP_CANCTRL] = CANCTRL_REQOP_CONFIG | CANCTRL_CLKEN | CANCTRL_CLKPRE;
+}
+
+MCP2515_TRANSPORT MCP2515_SIM_transport(MCP2515_SIM sim)
+{
+    return sim->transport;
+}
+
+void MCP2515_SIM_setBusTxCallback(MCP2515_SIM sim, MCP2515_SIM_BUS_TX_CB cb, void *arg)
+{
+    sim->bus_tx = cb;
+    sim->bus_tx_arg = arg;
+}
+
+bool MCP2515_SIM_inject(MCP2515_SIM sim, const CAN_FRAME frame)
+{
+    const uint8_t mode = sim_mode(sim);
+    if (mode != CANCTRL_REQOP_NORMAL && mode != CANCTRL_REQOP_LISTENONLY) {
+        // configuration, sleep and loopback modes ignore the bus
+        return false;
+    }
+    return sim_receive(sim, frame);
+}
+
+bool MCP2515_SIM_transmitPending(MCP2515_SIM sim)
+{
+    const uint8_t mode = sim_mode(sim);
+    if (mode != CANCTRL_REQOP_NORMAL && mode != CANCTRL_REQOP_LOOPBACK) {
+        return false;
+    }
+
+    // highest TXP wins, the higher buffer number wins a tie
+    int next = -1;
+    for (int n = N_TXBUFFERS - 1; n >= 0; n--) {
+        const uint8_t ctrl = sim->regs[sim_txb_base[n]];
+        if ((ctrl & TXB_TXREQ)
+            && (next < 0 || (ctrl & TXB_TXP) > (sim->regs[sim_txb_base[next]] & TXB_TXP))) {
+            next = n;
+        }
+    }
+    if (next < 0) {
+        return false;
+    }
+
+    const uint8_t base = sim_txb_base[next];
+    CAN_FRAME_t frame;
+    sim_decode_tx(&sim->regs[base + SIM_BUF_SIDH], &frame);
+    sim->regs[base] &= ~TXB_TXREQ;
+    sim->regs[MCP_CANINTF] |= sim_txif[next];
+    sim->frames_sent++;
+
+    if (mode == CANCTRL_REQOP_LOOPBACK) {
+        sim_receive(sim, &frame);
+    } else if (sim->bus_tx != NULL) {
+        sim->bus_tx(sim->bus_tx_arg, &frame);
+    }
+    return true;
+}
+
+bool MCP2515_SIM_interruptAsserted(MCP2515_SIM sim)
+{
+    return (sim->regs[MCP_CANINTE] & sim->regs[MCP_CANINTF]) != 0;
+}
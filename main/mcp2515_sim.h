@@ -0,0 +1,58 @@
+#ifndef _MCP2515_SIM_H_
+#define _MCP2515_SIM_H_
+
+#include "mcp2515.h"
+
+/*
+ * Register-level model of the MCP2515 behind an MCP2515_TRANSPORT, for host
+ * builds of the driver. It decodes every SPI instruction (READ, WRITE,
+ * BITMOD, LOAD TX, RTS, READ RX, READ STATUS, RX STATUS, RESET), applies
+ * acceptance masks/filters, RXB0->RXB1 rollover, CANINTF/EFLG semantics and
+ * loopback. Frames reach the model from a virtual bus via MCP2515_SIM_inject()
+ * and leave it through the bus TX callback.
+ *
+ * The model is not thread safe and has no bit timing: a requested mailbox is
+ * sent as soon as the transfer that set TXREQ completes (auto_transmit), or
+ * when MCP2515_SIM_transmitPending() is called. A mailbox marked in on_bus is
+ * taken to be mid-frame: clearing its TXREQ does not abort it, the test ends
+ * the frame by writing the outcome into regs.
+ */
+
+typedef void (*MCP2515_SIM_BUS_TX_CB)(void *arg, const CAN_FRAME frame);
+
+typedef struct MCP2515_SIM_s {
+	uint8_t regs[128];
+
+	bool auto_transmit;
+	uint8_t on_bus;             // bit n: TXBn is mid-frame, a TXREQ clear is ignored
+	MCP2515_SIM_BUS_TX_CB bus_tx;
+	void *bus_tx_arg;
+
+	// user pointers of queued transfers, returned in order by get_result
+	void *queued[MCP2515_PIPELINE_DEPTH];
+	uint8_t queued_head;
+	uint8_t queued_count;
+
+	uint32_t transfers;
+	uint32_t frames_sent;
+	uint32_t frames_received;
+	uint32_t frames_rejected;
+	uint32_t overruns;
+
+	MCP2515_TRANSPORT_t transport;
+} MCP2515_SIM_t[1], *MCP2515_SIM;
+
+MCP2515_SIM MCP2515_SIM_create(void);
+void MCP2515_SIM_destroy(MCP2515_SIM sim);
+void MCP2515_SIM_reset(MCP2515_SIM sim);
+MCP2515_TRANSPORT MCP2515_SIM_transport(MCP2515_SIM sim);
+void MCP2515_SIM_setBusTxCallback(MCP2515_SIM sim, MCP2515_SIM_BUS_TX_CB cb, void *arg);
+
+// deliver a frame from the virtual bus, returns true if a receive buffer took it
+bool MCP2515_SIM_inject(MCP2515_SIM sim, const CAN_FRAME frame);
+// send the highest-priority requested mailbox, returns false if none is pending
+bool MCP2515_SIM_transmitPending(MCP2515_SIM sim);
+// level of the INT pin (active while any enabled CANINTF flag is set)
+bool MCP2515_SIM_interruptAsserted(MCP2515_SIM sim);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcp2515_solver.h"
+
+// keys: both formats in the 29-bit register layout, bit 31 tags extended IDs
+#define SOLVER_ID_BITS   0x1FFFFFFFu
+#define SOLVER_SID_BITS  0x1FFC0000u
+#define SOLVER_EID_BITS  0x0003FFFFu
+#define SOLVER_EXT       0x80000000u
+
+typedef struct SOLVER_s {
+	const uint32_t *wanted;     // every wanted key, sorted
+	uint32_t n_wanted;
+	const uint32_t *traffic;    // listed unwanted keys
+	const float *traffic_rate;
+	uint32_t n_traffic;
+	double unlisted_rate;
+	uint32_t *values;           // scratch, n_wanted entries
+	uint32_t *trial;            // scratch, n_wanted entries
+	uint32_t *candidates;       // scratch, n_wanted + 29 entries
+} SOLVER_t;
+
+typedef struct SOLVER_GROUP_s {
+	uint32_t dont_care;         // bits left out of the mask
+	uint32_t n_values;
+	double cost;
+	uint32_t false_ids;
+	double false_rate;
+} SOLVER_GROUP_t;
+
+static uint32_t solverKey(const canid_t id)
+{
+    if (id & CAN_EFF_FLAG) {
+        return SOLVER_EXT | (id & CAN_EFF_MASK);
+    }
+    return (id & CAN_SFF_MASK) << 18;
+}
+
+// value a key is compared on: standard filters only look at the SID bits
+static uint32_t solverMasked(const uint32_t key, const uint32_t dont_care)
+{
+    if (key & SOLVER_EXT) {
+        return SOLVER_EXT | (key & SOLVER_ID_BITS & ~dont_care);
+    }
+    return key & SOLVER_SID_BITS & ~dont_care;
+}
+
+static uint32_t solverCubeBits(const uint32_t value, const uint32_t dont_care)
+{
+    return __builtin_popcount(dont_care & ((value & SOLVER_EXT) ? SOLVER_ID_BITS : SOLVER_SID_BITS));
+}
+
+static int solverCompare(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool solverContains(const uint32_t *sorted, const uint32_t n, const uint32_t key)
+{
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (sorted[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < n && sorted[lo] == key;
+}
+
+// distinct filter values of a group under dont_care, sorted into out
+static uint32_t solverValues(const uint32_t *keys, const uint32_t n, const uint32_t dont_care, uint32_t *out)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = solverMasked(keys[i], dont_care);
+    }
+    qsort(out, n, sizeof(uint32_t), solverCompare);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (unique == 0 || out[unique - 1] != out[i]) {
+            out[unique++] = out[i];
+        }
+    }
+    return unique;
+}
+
+// traffic admitted by the given filter values that is not wanted
+static void solverCost(const SOLVER_t *solver, const uint32_t *values, const uint32_t n_values,
+                       const uint32_t dont_care, SOLVER_GROUP_t *group)
+{
+    double admitted = 0;
+    for (uint32_t i = 0; i < n_values; i++) {
+        admitted += (double)(1UL << solverCubeBits(values[i], dont_care));
+    }
+    uint32_t wanted_in = 0;
+    for (uint32_t i = 0; i < solver->n_wanted; i++) {
+        wanted_in += solverContains(values, n_values, solverMasked(solver->wanted[i], dont_care));
+    }
+    uint32_t listed_in = 0;
+    double listed_rate = 0;
+    for (uint32_t i = 0; i < solver->n_traffic; i++) {
+        if (solverContains(values, n_values, solverMasked(solver->traffic[i], dont_care))) {
+            listed_in++;
+            listed_rate += solver->traffic_rate[i];
+        }
+    }
+    const double unlisted = admitted - wanted_in - listed_in;
+    group->dont_care = dont_care;
+    group->n_values = n_values;
+    group->false_ids = (uint32_t)(unlisted + listed_in);
+    group->false_rate = unlisted * solver->unlisted_rate + listed_rate;
+    // the ID count breaks ties when no rates are known
+    group->cost = group->false_rate + group->false_ids * 1e-9;
+}
+
+// widen the mask of one group until its keys fit in slots filters
+static void solverGroup(SOLVER_t *solver, const uint32_t *keys, const uint32_t n, const uint32_t slots,
+                        SOLVER_GROUP_t *group)
+{
+    uint32_t dont_care = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(keys[i] & SOLVER_EXT)) {
+            // a standard frame has no EID bits, and the chip would compare EID15..0 with its data
+            dont_care = SOLVER_EID_BITS;
+            break;
+        }
+    }
+    uint32_t n_values = solverValues(keys, n, dont_care, solver->values);
+    solverCost(solver, solver->values, n_values, dont_care, group);
+
+    while (n_values > slots) {
+        // candidate steps: free one more bit, or free what separates a value from its nearest neighbour
+        uint32_t *candidates = solver->candidates;
+        uint32_t n_candidates = 0;
+        for (uint32_t bit = 0; bit < 29; bit++) {
+            if (!(dont_care & (1UL << bit))) {
+                candidates[n_candidates++] = dont_care | (1UL << bit);
+            }
+        }
+        for (uint32_t i = 0; i < n_values; i++) {
+            uint32_t best_distance = 33;
+            uint32_t best_bits = 0;
+            for (uint32_t j = 0; j < n_values; j++) {
+                if (i == j || ((solver->values[i] ^ solver->values[j]) & SOLVER_EXT)) {
+                    continue;
+                }
+                const uint32_t bits = (solver->values[i] ^ solver->values[j]) & SOLVER_ID_BITS;
+                const uint32_t distance = __builtin_popcount(bits);
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best_bits = bits;
+                }
+            }
+            if (best_distance > 1 && best_distance < 33) {
+                candidates[n_candidates++] = dont_care | best_bits;
+            }
+        }
+
+        SOLVER_GROUP_t best;
+        double best_score = 0;
+        bool found = false;
+        for (uint32_t c = 0; c < n_candidates; c++) {
+            const uint32_t n_trial = solverValues(keys, n, candidates[c], solver->trial);
+            if (n_trial >= n_values) {
+                continue;
+            }
+            SOLVER_GROUP_t trial;
+            solverCost(solver, solver->trial, n_trial, candidates[c], &trial);
+            // extra cost per filter saved
+            const double score = (trial.cost - group->cost) / (n_values - n_trial);
+            if (!found || score < best_score) {
+                best = trial;
+                best_score = score;
+                found = true;
+            }
+        }
+        if (!found) {
+            // only a standard and an extended value left for a single filter, cannot happen with 2+ slots
+            group->cost = -1;
+            return;
+        }
+        *group = best;
+        dont_care = best.dont_care;
+        n_values = solverValues(keys, n, dont_care, solver->values);
+    }
+}
+
+static void solverFill(const uint32_t *values, const uint32_t n_values, const uint32_t first, const uint32_t slots,
+                       MCP2515_FILTER_PLAN_t *plan)
+{
+    for (uint32_t i = 0; i < slots; i++) {
+        // unused filters repeat a used one, which admits nothing new
+        const uint32_t value = values[i < n_values ? i : 0];
+        plan->filter_ext[first + i] = (value & SOLVER_EXT) != 0;
+        plan->filter[first + i] = (value & SOLVER_EXT) ? (value & SOLVER_ID_BITS) : (value >> 18);
+    }
+}
+
+// plan for one split: keys[0..split) on RXM0 and the rest on RXM1, or the other way round
+static double solverSplit(SOLVER_t *solver, const uint32_t *keys, const uint32_t n, const uint32_t split,
+                          const bool swap, MCP2515_FILTER_PLAN_t *plan)
+{
+    const uint32_t *part[2] = {keys, keys + split};
+    uint32_t count[2] = {split, n - split};
+    if (swap) {
+        part[0] = keys + split;
+        part[1] = keys;
+        count[0] = n - split;
+        count[1] = split;
+    }
+    const uint32_t slots[2] = {2, 4};
+    const uint32_t first[2] = {0, 2};
+    double cost = 0;
+    plan->false_ids = 0;
+    plan->false_rate = 0;
+    for (int g = 0; g < 2; g++) {
+        if (count[g] == 0) {
+            // nothing for this buffer: exact filters on a wanted ID admit nothing extra
+            plan->mask[g] = SOLVER_ID_BITS;
+            const uint32_t exact = part[1 - g][0];
+            solverFill(&exact, 1, first[g], slots[g], plan);
+            continue;
+        }
+        SOLVER_GROUP_t group;
+        solverGroup(solver, part[g], count[g], slots[g], &group);
+        if (group.cost < 0) {
+            return -1;
+        }
+        const uint32_t n_values = solverValues(part[g], count[g], group.dont_care, solver->values);
+        plan->mask[g] = SOLVER_ID_BITS & ~group.dont_care;
+        solverFill(solver->values, n_values, first[g], slots[g], plan);
+        plan->false_ids += group.false_ids;
+        plan->false_rate += group.false_rate;
+        cost += group.cost;
+    }
+    return cost;
+}
+
+ERROR_t MCP2515_solveFilters(const MCP2515_FILTER_ID_t ids[], const uint32_t count, const float unlisted_rate,
+                             MCP2515_FILTER_PLAN_t *plan)
+{
+    if (count == 0 || count > MCP2515_SOLVER_MAX_IDS || plan == NULL) {
+        return ERROR_FAIL;
+    }
+    uint32_t *wanted = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *traffic = (uint32_t *)malloc(count * sizeof(uint32_t));
+    float *traffic_rate = (float *)malloc(count * sizeof(float));
+    uint32_t *values = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *trial = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *candidates = (uint32_t *)malloc((count + 29) * sizeof(uint32_t));
+    ERROR_t rc = ERROR_FAIL;
+    if (wanted == NULL || traffic == NULL || traffic_rate == NULL || values == NULL || trial == NULL ||
+        candidates == NULL) {
+        goto out;
+    }
+
+    uint32_t n_wanted = 0;
+    uint32_t n_traffic = 0;
+    float wanted_rate = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i].wanted) {
+            wanted[n_wanted++] = solverKey(ids[i].id);
+            wanted_rate += ids[i].rate;
+        }
+    }
+    if (n_wanted == 0) {
+        goto out;
+    }
+    qsort(wanted, n_wanted, sizeof(uint32_t), solverCompare);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < n_wanted; i++) {
+        if (unique == 0 || wanted[unique - 1] != wanted[i]) {
+            wanted[unique++] = wanted[i];
+        }
+    }
+    n_wanted = unique;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!ids[i].wanted) {
+            const uint32_t key = solverKey(ids[i].id);
+            if (solverContains(wanted, n_wanted, key)) {
+                goto out;
+            }
+            traffic[n_traffic] = key;
+            traffic_rate[n_traffic++] = ids[i].rate;
+        }
+    }
+
+    SOLVER_t solver = {
+        .wanted = wanted,
+        .n_wanted = n_wanted,
+        .traffic = traffic,
+        .traffic_rate = traffic_rate,
+        .n_traffic = n_traffic,
+        .unlisted_rate = unlisted_rate,
+        .values = values,
+        .trial = trial,
+        .candidates = candidates,
+    };
+
+    // splits in key order: all on one mask, standard/extended apart, and evenly spaced cuts
+    uint32_t splits[12];
+    uint32_t n_splits = 0;
+    splits[n_splits++] = 0;
+    for (uint32_t i = 0; i < n_wanted; i++) {
+        if (wanted[i] & SOLVER_EXT) {
+            splits[n_splits++] = i;
+            break;
+        }
+    }
+    for (uint32_t i = 1; i < 8; i++) {
+        splits[n_splits++] = n_wanted * i / 8;
+    }
+
+    double best_cost = -1;
+    for (uint32_t s = 0; s < n_splits; s++) {
+        for (int swap = 0; swap < 2; swap++) {
+            MCP2515_FILTER_PLAN_t trial_plan;
+            const double cost = solverSplit(&solver, wanted, n_wanted, splits[s], swap, &trial_plan);
+            if (cost >= 0 && (best_cost < 0 || cost < best_cost)) {
+                best_cost = cost;
+                *plan = trial_plan;
+            }
+        }
+    }
+    if (best_cost >= 0) {
+        plan->expected_rate = wanted_rate + plan->false_rate;
+        rc = ERROR_OK;
+    }
+
+out:
+    free(wanted);
+    free(traffic);
+    free(traffic_rate);
+    free(values);
+    free(trial);
+    free(candidates);
+    return rc;
+}
+
+ERROR_t MCP2515_configFilterPlan(MCP2515_CONFIG config, const MCP2515_FILTER_PLAN_t *plan)
+{
+    const MASK_t masks[2] = {MASK0, MASK1};
+    const RXF_t filters[6] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
+    for (int i = 0; i < 2; i++) {
+        // written in the extended layout; a standard-only group has bits 17..0 clear anyway
+        if (MCP2515_configFilterMask(config, masks[i], true, plan->mask[i]) != ERROR_OK) {
+            return ERROR_FAIL;
+        }
+    }
+    for (int i = 0; i < 6; i++) {
+        if (MCP2515_configFilter(config, filters[i], plan->filter_ext[i], plan->filter[i]) != ERROR_OK) {
+            return ERROR_FAIL;
+        }
+    }
+    if (MCP2515_configRxBuffer(config, RXB0, RXBnCTRL_RXM_STDEXT, true) != ERROR_OK ||
+        MCP2515_configRxBuffer(config, RXB1, RXBnCTRL_RXM_STDEXT, false) != ERROR_OK) {
+        return ERROR_FAIL;
+    }
+    return ERROR_OK;
+}
@@ -0,0 +1,59 @@
+#ifndef _MCP2515_SOLVER_H_
+#define _MCP2515_SOLVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "can.h"
+#include "mcp2515.h"
+
+/*
+ * Mask/filter assignment for the MCP2515 acceptance stage. RXM0 serves RXF0-1
+ * (RXB0) and RXM1 serves RXF2-5 (RXB1); every wanted ID must pass one of the
+ * six filters, and the solver picks masks and filters that admit as little
+ * other traffic as it can. What still gets through is meant for the software
+ * filter (can_filter.h).
+ *
+ * Cost model: an unwanted ID admitted by the plan costs its rate if it is
+ * listed (wanted == false), or unlisted_rate otherwise. Wanted IDs' rates only
+ * feed the expected_rate estimate of the result.
+ *
+ * The search is greedy: for a given split of the wanted IDs between the two
+ * masks it widens the mask one step at a time, picking the cheapest step
+ * that merges filter values, until the values fit the filters; a handful of
+ * splits (by frame format and by ID order) are tried and the cheapest plan
+ * wins. Standard and extended IDs share a 29-bit layout with the 11 standard
+ * bits on top (bits 28..18), as in the MCP2515 registers. A mask serving a
+ * standard filter leaves the EID bits 17..0 clear, since the chip would
+ * compare EID15..0 against the first two data bytes.
+ *
+ * Portable C, no ESP-IDF calls, so it runs on the host as well.
+ */
+
+#define MCP2515_SOLVER_MAX_IDS 512
+
+typedef struct MCP2515_FILTER_ID_s {
+	canid_t id;                 // CAN_EFF_FLAG selects a 29-bit ID
+	float rate;                 // expected frames/s
+	bool wanted;                // false: known traffic the filters should keep out
+} MCP2515_FILTER_ID_t;
+
+typedef struct MCP2515_FILTER_PLAN_s {
+	uint32_t mask[2];           // RXM0, RXM1 in the 29-bit layout
+	uint32_t filter[6];         // RXF0-5, 11-bit or 29-bit ID as given to MCP2515_configFilter()
+	bool filter_ext[6];
+	uint32_t false_ids;         // unwanted IDs the plan admits
+	float false_rate;           // their expected frames/s
+	float expected_rate;        // wanted plus false frames/s reaching the receive buffers
+} MCP2515_FILTER_PLAN_t;
+
+/*
+ * ids holds wanted IDs and, optionally, known unwanted traffic, at most
+ * MCP2515_SOLVER_MAX_IDS entries. Fails if nothing is wanted or an ID is
+ * listed both as wanted and unwanted.
+ */
+ERROR_t MCP2515_solveFilters(const MCP2515_FILTER_ID_t ids[], const uint32_t count, const float unlisted_rate,
+                             MCP2515_FILTER_PLAN_t *plan);
+// stage the plan's masks and filters and turn filtering on for both receive buffers
+ERROR_t MCP2515_configFilterPlan(MCP2515_CONFIG config, const MCP2515_FILTER_PLAN_t *plan);
+
+#endif
@@ -0,0 +1,802 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mcp2515_txq.h"
+
+#define TAG_MCP2515_TXQ "MCP2515_TXQ"
+
+// identifier bits in the order they are sent: base ID, RTR/SRR, IDE, extension, RTR
+static uint32_t MCP2515_TXQ_key(const canid_t id)
+{
+    const uint32_t rtr = (id & CAN_RTR_FLAG) ? 1 : 0;
+    if (id & CAN_EFF_FLAG) {
+        const uint32_t eid = id & CAN_EFF_MASK;
+        return ((eid >> 18) << 21) | (1UL << 20) | (1UL << 19) | ((eid & 0x3FFFF) << 1) | rtr;
+    }
+    return ((id & CAN_SFF_MASK) << 21) | (rtr << 20);
+}
+
+static inline bool MCP2515_TXQ_before(const MCP2515_TXQ txq, const uint16_t a, const uint16_t b)
+{
+    const MCP2515_TXQ_ENTRY_t *ea = &txq->entries[a];
+    const MCP2515_TXQ_ENTRY_t *eb = &txq->entries[b];
+    return ea->key < eb->key || (ea->key == eb->key && (int32_t)(ea->seq - eb->seq) < 0);
+}
+
+static void MCP2515_TXQ_push(MCP2515_TXQ txq, const uint16_t idx)
+{
+    uint32_t i = txq->count++;
+    while (i > 0) {
+        const uint32_t parent = (i - 1) / 2;
+        if (!MCP2515_TXQ_before(txq, idx, txq->heap[parent])) {
+            break;
+        }
+        txq->heap[i] = txq->heap[parent];
+        i = parent;
+    }
+    txq->heap[i] = idx;
+    txq->stats.queued = txq->count;
+    if (txq->count > txq->stats.high_water) {
+        txq->stats.high_water = txq->count;
+    }
+}
+
+// place idx at hole i or below, the heap below i is valid
+static void MCP2515_TXQ_siftDown(MCP2515_TXQ txq, uint32_t i, const uint16_t idx)
+{
+    while (1) {
+        uint32_t child = 2 * i + 1;
+        if (child >= txq->count) {
+            break;
+        }
+        if (child + 1 < txq->count && MCP2515_TXQ_before(txq, txq->heap[child + 1], txq->heap[child])) {
+            child++;
+        }
+        if (!MCP2515_TXQ_before(txq, txq->heap[child], idx)) {
+            break;
+        }
+        txq->heap[i] = txq->heap[child];
+        i = child;
+    }
+    txq->heap[i] = idx;
+}
+
+static uint16_t MCP2515_TXQ_pop(MCP2515_TXQ txq)
+{
+    const uint16_t top = txq->heap[0];
+    const uint16_t last = txq->heap[--txq->count];
+    MCP2515_TXQ_siftDown(txq, 0, last);
+    txq->stats.queued = txq->count;
+    return top;
+}
+
+// the esp_timer task is shared, the SPI work and the callbacks belong to the queue's task
+static void MCP2515_TXQ_deadlineTimer(void *arg)
+{
+    xTaskNotifyGive(((MCP2515_TXQ)arg)->task);
+}
+
+static void MCP2515_TXQ_task(void *arg)
+{
+    MCP2515_TXQ txq = (MCP2515_TXQ)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        MCP2515_TXQ_expire(txq);
+    }
+}
+
+MCP2515_TXQ MCP2515_TXQ_create(const uint32_t capacity)
+{
+    if (capacity == 0 || capacity >= MCP2515_TXQ_NONE) {
+        return NULL;
+    }
+    MCP2515_TXQ txq = (MCP2515_TXQ)calloc(1, sizeof(MCP2515_TXQ_t));
+    if (txq == NULL) {
+        ESP_LOGE(TAG_MCP2515_TXQ, "Couldn't allocate the TX queue. (NULL pointer)");
+        return NULL;
+    }
+    txq->entries = (MCP2515_TXQ_ENTRY_t *)calloc(capacity, sizeof(MCP2515_TXQ_ENTRY_t));
+    txq->heap = (uint16_t *)calloc(capacity, sizeof(uint16_t));
+    txq->free_list = (uint16_t *)calloc(capacity, sizeof(uint16_t));
+    if (txq->entries == NULL || txq->heap == NULL || txq->free_list == NULL) {
+        ESP_LOGE(TAG_MCP2515_TXQ, "Couldn't allocate %lu entries. (NULL pointer)", (unsigned long)capacity);
+        MCP2515_TXQ_destroy(txq);
+        return NULL;
+    }
+    txq->capacity = capacity;
+    for (uint32_t i = 0; i < capacity; i++) {
+        txq->free_list[i] = (uint16_t)(capacity - 1 - i);
+    }
+    txq->free_count = capacity;
+    txq->space = xSemaphoreCreateCounting(capacity, capacity);
+    if (txq->space == NULL) {
+        ESP_LOGE(TAG_MCP2515_TXQ, "Couldn't create the free entry semaphore.");
+        MCP2515_TXQ_destroy(txq);
+        return NULL;
+    }
+    const esp_timer_create_args_t timer_args = {
+        .callback = MCP2515_TXQ_deadlineTimer,
+        .arg = txq,
+        .name = "mcp2515_txq",
+    };
+    if (esp_timer_create(&timer_args, &txq->deadline_timer) != ESP_OK) {
+        ESP_LOGE(TAG_MCP2515_TXQ, "Couldn't create the deadline timer.");
+        txq->deadline_timer = NULL;
+        MCP2515_TXQ_destroy(txq);
+        return NULL;
+    }
+    if (xTaskCreatePinnedToCore(MCP2515_TXQ_task, "mcp2515_txq", MCP2515_TXQ_TASK_STACK, txq,
+                                MCP2515_TXQ_TASK_PRIORITY, &txq->task, tskNO_AFFINITY) != pdPASS) {
+        ESP_LOGE(TAG_MCP2515_TXQ, "Couldn't create the queue task.");
+        txq->task = NULL;
+        MCP2515_TXQ_destroy(txq);
+        return NULL;
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        txq->mailbox[i] = MCP2515_TXQ_NONE;
+        txq->txp[i] = 0xFF;
+    }
+    txq->done_head = MCP2515_TXQ_NONE;
+    return txq;
+}
+
+void MCP2515_TXQ_destroy(MCP2515_TXQ txq)
+{
+    if (txq == NULL) {
+        return;
+    }
+    if (txq->deadline_timer != NULL) {
+        esp_timer_stop(txq->deadline_timer);
+        esp_timer_delete(txq->deadline_timer);
+    }
+    if (txq->task != NULL) {
+        // inside the session the task is idle or waiting for it, never halfway through an expiry
+        const bool locked = (MCP2515_beginSession() == ERROR_OK);
+        vTaskDelete(txq->task);
+        if (locked) {
+            MCP2515_endSession();
+        }
+    }
+    free(txq->entries);
+    free(txq->heap);
+    free(txq->free_list);
+    if (txq->space != NULL) {
+        vSemaphoreDelete(txq->space);
+    }
+    free(txq);
+}
+
+// what the chip gave up on, from TXBnCTRL of a mailbox that ended without TXnIF
+static MCP2515_TX_RESULT_t MCP2515_TXQ_failure(const int mb)
+{
+    const uint8_t ctrl = MCP2515_readRegisterSync(MCP2515_Object->TXB_ptr[mb].CTRL);
+    if (ctrl & TXB_ABTF) {
+        return MCP2515_TX_ABORTED;
+    }
+    if (ctrl & TXB_MLOA) {
+        return MCP2515_TX_LOST_ARBITRATION;
+    }
+    return MCP2515_TX_BUS_ERROR;
+}
+
+static void MCP2515_TXQ_recordMiss(MCP2515_TXQ txq, const canid_t can_id)
+{
+    MCP2515_TXQ_MISS_t *misses = txq->stats.misses;
+    for (int i = 0; i < MCP2515_TXQ_MISS_IDS; i++) {
+        if (misses[i].count == 0) {
+            misses[i].can_id = can_id;
+        }
+        if (misses[i].can_id == can_id) {
+            misses[i].count++;
+            return;
+        }
+    }
+    txq->stats.miss_other++;
+}
+
+// records the outcome; the entry is freed and reported by MCP2515_TXQ_flush()
+static void MCP2515_TXQ_finish(MCP2515_TXQ txq, const uint16_t idx, const MCP2515_TX_RESULT_t result)
+{
+    MCP2515_TXQ_ENTRY_t *entry = &txq->entries[idx];
+    const int64_t now_us = esp_timer_get_time();
+    if (result == MCP2515_TX_DONE) {
+        MCP2515_TXQ_CLASS_STATS_t *cls = &txq->stats.classes[entry->key >> 29];
+        const uint32_t wait_us = (uint32_t)(entry->loaded_us - entry->queued_us);
+        const uint32_t total_us = (uint32_t)(now_us - entry->queued_us);
+        cls->sent++;
+        if (wait_us > cls->max_wait_us) {
+            cls->max_wait_us = wait_us;
+        }
+        if (total_us > cls->max_total_us) {
+            cls->max_total_us = total_us;
+        }
+        txq->stats.sent++;
+        if (entry->deadline_us != 0 && now_us > entry->deadline_us) {
+            // the abort lost the race, the frame went out stale
+            txq->stats.late++;
+            MCP2515_TXQ_recordMiss(txq, entry->frame.can_id);
+        }
+    } else if (result == MCP2515_TX_EXPIRED) {
+        txq->stats.expired++;
+        MCP2515_TXQ_recordMiss(txq, entry->frame.can_id);
+    } else {
+        txq->stats.failed++;
+    }
+    if (entry->deadline_us != 0) {
+        txq->deadlines--;
+    }
+
+    entry->result = result;
+    entry->done_us = now_us;
+    entry->next = MCP2515_TXQ_NONE;
+    if (txq->done_head == MCP2515_TXQ_NONE) {
+        txq->done_head = idx;
+    } else {
+        txq->entries[txq->done_tail].next = idx;
+    }
+    txq->done_tail = idx;
+}
+
+// frees finished entries and runs their callbacks, which may submit again
+static void MCP2515_TXQ_flush(MCP2515_TXQ txq)
+{
+    while (txq->done_head != MCP2515_TXQ_NONE) {
+        const uint16_t idx = txq->done_head;
+        const MCP2515_TXQ_ENTRY_t *entry = &txq->entries[idx];
+        txq->done_head = entry->next;
+
+        const MCP2515_TX_CALLBACK callback = entry->callback;
+        const MCP2515_TX_EVENT_t event = {
+            .handle = entry->seq,
+            .result = entry->result,
+            .can_id = entry->frame.can_id,
+            .queued_us = entry->queued_us,
+            .done_us = entry->done_us,
+            .user = entry->user,
+        };
+        txq->free_list[txq->free_count++] = idx;
+        xSemaphoreGive(txq->space);
+        if (callback != NULL) {
+            callback(&event);
+        }
+    }
+}
+
+// TXP by rank among the loaded frames, rewritten only where the rank changed
+static void MCP2515_TXQ_assignTxp(MCP2515_TXQ txq)
+{
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (txq->mailbox[i] == MCP2515_TXQ_NONE) {
+            continue;
+        }
+        uint8_t rank = 0;
+        for (int j = 0; j < N_TXBUFFERS; j++) {
+            if (j != i && txq->mailbox[j] != MCP2515_TXQ_NONE
+                && MCP2515_TXQ_before(txq, txq->mailbox[j], txq->mailbox[i])) {
+                rank++;
+            }
+        }
+        const uint8_t txp = (uint8_t)(3 - rank);
+        if (txq->txp[i] != txp) {
+            // TXP of a pending mailbox is re-read before every arbitration
+            MCP2515_modifyRegister(MCP2515_Object->TXB_ptr[i].CTRL, TXB_TXP, txp);
+            txq->txp[i] = txp;
+        }
+    }
+}
+
+// the mailbox is started later by MCP2515_TXQ_kick(), together with the others loaded in the same pump
+static bool MCP2515_TXQ_load(MCP2515_TXQ txq, const int mb, const uint16_t idx)
+{
+    txq->mailbox[mb] = idx;
+    // TXP has to be in place before REQUEST TO SEND
+    MCP2515_TXQ_assignTxp(txq);
+    txq->entries[idx].loaded_us = esp_timer_get_time();
+    if (MCP2515_loadMessage((TXBn_t)mb, &txq->entries[idx].frame) != ERROR_OK) {
+        txq->mailbox[mb] = MCP2515_TXQ_NONE;
+        MCP2515_TXQ_push(txq, idx);
+        return false;
+    }
+    txq->unsent |= (uint8_t)(1U << mb);
+    return true;
+}
+
+// one RTS for every mailbox loaded since the last kick
+static void MCP2515_TXQ_kick(MCP2515_TXQ txq)
+{
+    if (txq->unsent == 0) {
+        return;
+    }
+    if (MCP2515_requestToSend(txq->unsent) != ERROR_OK) {
+        // never started, back into the heap
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            if (txq->unsent & (1U << i)) {
+                MCP2515_TXQ_push(txq, txq->mailbox[i]);
+                txq->mailbox[i] = MCP2515_TXQ_NONE;
+            }
+        }
+    }
+    txq->unsent = 0;
+}
+
+/*
+ * Outcome of a mailbox that has left the bus, stat is READ STATUS taken after
+ * its TXREQ cleared. TXnIF means sent, ABTF means the abort took; without
+ * either the chip gave up on its own (one-shot mode). A frame aborted to make
+ * room goes back into the heap, an expired one is dropped.
+ */
+static void MCP2515_TXQ_release(MCP2515_TXQ txq, const int mb, const uint8_t stat)
+{
+    const uint8_t bit = (uint8_t)(1U << mb);
+    const uint16_t idx = txq->mailbox[mb];
+    const bool swapped = (txq->aborting & bit) != 0;
+    const bool expired = (txq->expiring & bit) != 0;
+    txq->mailbox[mb] = MCP2515_TXQ_NONE;
+    txq->aborting &= ~bit;
+    txq->expiring &= ~bit;
+    if (stat & (STAT_TX0IF << (2 * mb))) {
+        if (swapped) {
+            // the abort came too late, the frame had already won the bus
+            txq->stats.swap_late++;
+        }
+        MCP2515_TXQ_finish(txq, idx, MCP2515_TX_DONE);
+        return;
+    }
+    const MCP2515_TX_RESULT_t result = MCP2515_TXQ_failure(mb);
+    if (result != MCP2515_TX_ABORTED) {
+        MCP2515_TXQ_finish(txq, idx, result);
+    } else if (expired) {
+        MCP2515_TXQ_finish(txq, idx, MCP2515_TX_EXPIRED);
+    } else if (swapped) {
+        // back in the heap with its old sequence number, it keeps its place
+        MCP2515_TXQ_push(txq, idx);
+        txq->stats.swaps++;
+    } else {
+        MCP2515_TXQ_finish(txq, idx, MCP2515_TX_ABORTED);
+    }
+}
+
+// only the installed queue may load, abort or poll the mailboxes, any other one keeps its frames in the heap
+static inline bool MCP2515_TXQ_installed(const MCP2515_TXQ txq)
+{
+    return MCP2515_Object != NULL && MCP2515_Object->txq == txq;
+}
+
+// one frame time at the configured bitrate
+static uint32_t MCP2515_TXQ_frameUs(void)
+{
+    const uint32_t bitrate = MCP2515_Object->bitrate;
+    if (bitrate == 0) {
+        return MCP2515_TXQ_ABORT_WAIT_US;
+    }
+    return (uint32_t)((MCP2515_TXQ_FRAME_BITS * 1000000ULL + bitrate - 1) / bitrate);
+}
+
+// an aborted mailbox whose TXREQ has cleared, no TXnIF service will come for it unless it was sent
+static void MCP2515_TXQ_reclaim(MCP2515_TXQ txq, const int mb)
+{
+    const uint8_t stat = MCP2515_getStatus();
+    MCP2515_Object->tx_busy &= ~(1U << mb);
+    if (stat & (STAT_TX0IF << (2 * mb))) {
+        MCP2515_clearInterruptFlags(CANINTF_TX0IF << mb);
+    }
+    MCP2515_TXQ_release(txq, mb, stat);
+}
+
+/*
+ * Clear TXREQ of mailbox mb and wait up to a frame time (at most
+ * MCP2515_TXQ_ABORT_SPIN_MAX_US) for the outcome. If the frame is still on
+ * the bus the mailbox stays marked and MCP2515_TXQ_poll() settles it later:
+ * an abort that ends in ABTF raises no TXnIF.
+ */
+static bool MCP2515_TXQ_abort(MCP2515_TXQ txq, const int mb, const bool expired)
+{
+    const REGISTER_t ctrl_reg = MCP2515_Object->TXB_ptr[mb].CTRL;
+    const uint8_t bit = (uint8_t)(1U << mb);
+    MCP2515_modifyRegister(ctrl_reg, TXB_TXREQ, 0);
+    if (expired) {
+        txq->expiring |= bit;
+    } else {
+        txq->aborting |= bit;
+    }
+
+    const uint32_t frame_us = MCP2515_TXQ_frameUs();
+    const int64_t wait_us = frame_us < MCP2515_TXQ_ABORT_SPIN_MAX_US ? frame_us : MCP2515_TXQ_ABORT_SPIN_MAX_US;
+    const int64_t start_us = esp_timer_get_time();
+    uint8_t ctrl;
+    do {
+        ctrl = MCP2515_readRegisterSync(ctrl_reg);
+    } while ((ctrl & TXB_TXREQ) && esp_timer_get_time() - start_us < wait_us);
+    if (ctrl & TXB_TXREQ) {
+        return false;
+    }
+    MCP2515_TXQ_reclaim(txq, mb);
+    return true;
+}
+
+// settle aborts that outlasted MCP2515_TXQ_abort(), one TXBnCTRL read per pending mailbox
+static void MCP2515_TXQ_poll(MCP2515_TXQ txq)
+{
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (((txq->aborting | txq->expiring) & (1U << i))
+            && !(MCP2515_readRegisterSync(MCP2515_Object->TXB_ptr[i].CTRL) & TXB_TXREQ)) {
+            MCP2515_TXQ_reclaim(txq, i);
+        }
+    }
+}
+
+static inline bool MCP2515_TXQ_expired(const MCP2515_TXQ txq, const uint16_t idx, const int64_t now_us)
+{
+    const int64_t deadline_us = txq->entries[idx].deadline_us;
+    return deadline_us != 0 && deadline_us <= now_us;
+}
+
+// drop expired frames from the heap and abort expired mailboxes
+static void MCP2515_TXQ_expireDue(MCP2515_TXQ txq, const int64_t now_us)
+{
+    if (txq->deadlines == 0) {
+        return;
+    }
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < txq->count; i++) {
+        const uint16_t idx = txq->heap[i];
+        if (MCP2515_TXQ_expired(txq, idx, now_us)) {
+            MCP2515_TXQ_finish(txq, idx, MCP2515_TX_EXPIRED);
+        } else {
+            txq->heap[kept++] = idx;
+        }
+    }
+    if (kept != txq->count) {
+        txq->count = kept;
+        for (uint32_t i = kept / 2; i-- > 0;) {
+            MCP2515_TXQ_siftDown(txq, i, txq->heap[i]);
+        }
+        txq->stats.queued = kept;
+    }
+    if (!MCP2515_TXQ_installed(txq)) {
+        return;
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        const uint16_t idx = txq->mailbox[i];
+        // a mailbox being swapped out is requeued and dropped from the heap next time
+        if (idx != MCP2515_TXQ_NONE && !((txq->aborting | txq->expiring) & (1U << i))
+            && MCP2515_TXQ_expired(txq, idx, now_us)) {
+            MCP2515_TXQ_abort(txq, i, true);
+        }
+    }
+}
+
+// earliest deadline still pending, 0 if none
+static int64_t MCP2515_TXQ_nextDeadline(const MCP2515_TXQ txq)
+{
+    int64_t next_us = 0;
+    for (uint32_t i = 0; i < txq->count; i++) {
+        const int64_t deadline_us = txq->entries[txq->heap[i]].deadline_us;
+        if (deadline_us != 0 && (next_us == 0 || deadline_us < next_us)) {
+            next_us = deadline_us;
+        }
+    }
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (txq->mailbox[i] == MCP2515_TXQ_NONE || (txq->expiring & (1U << i))) {
+            continue;
+        }
+        const int64_t deadline_us = txq->entries[txq->mailbox[i]].deadline_us;
+        if (deadline_us != 0 && (next_us == 0 || deadline_us < next_us)) {
+            next_us = deadline_us;
+        }
+    }
+    return next_us;
+}
+
+// the timer catches deadlines that pass while nothing else happens, e.g. a frame retrying on a busy bus
+static void MCP2515_TXQ_arm(MCP2515_TXQ txq)
+{
+    int64_t next_us = (txq->deadlines > 0) ? MCP2515_TXQ_nextDeadline(txq) : 0;
+    if ((txq->aborting | txq->expiring) != 0 && MCP2515_TXQ_installed(txq)) {
+        // a pending abort is looked at again after another frame time
+        const int64_t poll_us = esp_timer_get_time() + MCP2515_TXQ_frameUs();
+        if (next_us == 0 || poll_us < next_us) {
+            next_us = poll_us;
+        }
+    }
+    if (next_us == txq->armed_us) {
+        return;
+    }
+    esp_timer_stop(txq->deadline_timer);
+    txq->armed_us = next_us;
+    if (next_us != 0) {
+        const int64_t delay_us = next_us - esp_timer_get_time();
+        esp_timer_start_once(txq->deadline_timer, delay_us > 0 ? (uint64_t)delay_us : 1);
+    }
+}
+
+static void MCP2515_TXQ_pump(MCP2515_TXQ txq)
+{
+    while (txq->count > 0) {
+        int free_mb = -1;
+        int worst = -1;
+        for (int i = 0; i < N_TXBUFFERS; i++) {
+            if (txq->mailbox[i] == MCP2515_TXQ_NONE) {
+                // a mailbox filled by a direct send before the queue was installed is not ours
+                if (free_mb < 0 && !(MCP2515_Object->tx_busy & (1U << i))) {
+                    free_mb = i;
+                }
+            } else if (!((txq->aborting | txq->expiring) & (1U << i))
+                       && (worst < 0 || MCP2515_TXQ_before(txq, txq->mailbox[worst], txq->mailbox[i]))) {
+                worst = i;
+            }
+        }
+        if (free_mb < 0) {
+            if (worst < 0 || txq->aborting != 0
+                || !MCP2515_TXQ_before(txq, txq->heap[0], txq->mailbox[worst])) {
+                break;
+            }
+            // the abort tells sent from aborted by ABTF, which needs TXREQ to have been set
+            MCP2515_TXQ_kick(txq);
+            if (!MCP2515_TXQ_abort(txq, worst, false)) {
+                break;
+            }
+            continue;
+        }
+        if (!MCP2515_TXQ_load(txq, free_mb, MCP2515_TXQ_pop(txq))) {
+            break;
+        }
+    }
+    MCP2515_TXQ_kick(txq);
+}
+
+// end of every queue operation: finish pending aborts, drop what expired, refill the mailboxes, report, rearm
+static void MCP2515_TXQ_settle(MCP2515_TXQ txq)
+{
+    const bool installed = MCP2515_TXQ_installed(txq);
+    if (installed) {
+        MCP2515_TXQ_poll(txq);
+    }
+    MCP2515_TXQ_expireDue(txq, esp_timer_get_time());
+    if (installed) {
+        MCP2515_TXQ_pump(txq);
+    }
+    MCP2515_TXQ_flush(txq);
+    MCP2515_TXQ_arm(txq);
+}
+
+// takes an entry reserved on txq->space, inside a session
+static MCP2515_TX_HANDLE MCP2515_TXQ_add(MCP2515_TXQ txq, const CAN_FRAME frame, const int64_t deadline_us,
+                                         MCP2515_TX_CALLBACK callback, void *user)
+{
+    const uint16_t idx = txq->free_list[--txq->free_count];
+    MCP2515_TXQ_ENTRY_t *entry = &txq->entries[idx];
+    entry->frame = *frame;
+    entry->callback = callback;
+    entry->user = user;
+    entry->key = MCP2515_TXQ_key(frame->can_id);
+    // 0 is not a valid handle
+    if (txq->seq == 0) {
+        txq->seq++;
+    }
+    entry->seq = txq->seq++;
+    entry->queued_us = esp_timer_get_time();
+    entry->deadline_us = deadline_us;
+    if (deadline_us != 0) {
+        txq->deadlines++;
+    }
+    MCP2515_TXQ_push(txq, idx);
+    txq->stats.submitted++;
+    return entry->seq;
+}
+
+static ERROR_t MCP2515_TXQ_enqueue(MCP2515_TXQ txq, const CAN_FRAME frame, const int64_t deadline_us,
+                                   const TickType_t wait, MCP2515_TX_CALLBACK callback, void *user,
+                                   MCP2515_TX_HANDLE *handle)
+{
+    if (frame->can_dlc > CAN_MAX_DLEN) {
+        return ERROR_FAILTX;
+    }
+    // reserve an entry before the session, completions need the session to free one
+    const bool reserved = (xSemaphoreTake(txq->space, wait) == pdTRUE);
+    if (MCP2515_beginSession() != ERROR_OK) {
+        if (reserved) {
+            xSemaphoreGive(txq->space);
+        }
+        return ERROR_FAIL;
+    }
+    if (!reserved || txq->free_count == 0) {
+        txq->stats.full++;
+        MCP2515_endSession();
+        if (reserved) {
+            xSemaphoreGive(txq->space);
+        }
+        return ERROR_ALLTXBUSY;
+    }
+    *handle = MCP2515_TXQ_add(txq, frame, deadline_us, callback, user);
+    MCP2515_TXQ_settle(txq);
+    MCP2515_endSession();
+    return ERROR_OK;
+}
+
+ERROR_t MCP2515_TXQ_submit(MCP2515_TXQ txq, const CAN_FRAME frame)
+{
+    MCP2515_TX_HANDLE handle;
+    return MCP2515_TXQ_enqueue(txq, frame, 0, 0, NULL, NULL, &handle);
+}
+
+MCP2515_TX_HANDLE MCP2515_TXQ_submitAsync(MCP2515_TXQ txq, const CAN_FRAME frame, const TickType_t wait,
+                                          MCP2515_TX_CALLBACK callback, void *user)
+{
+    return MCP2515_TXQ_submitDeadline(txq, frame, 0, wait, callback, user);
+}
+
+MCP2515_TX_HANDLE MCP2515_TXQ_submitDeadline(MCP2515_TXQ txq, const CAN_FRAME frame, const int64_t deadline_us,
+                                             const TickType_t wait, MCP2515_TX_CALLBACK callback, void *user)
+{
+    MCP2515_TX_HANDLE handle = 0;
+    if (MCP2515_TXQ_enqueue(txq, frame, deadline_us, wait, callback, user, &handle) != ERROR_OK) {
+        return 0;
+    }
+    return handle;
+}
+
+uint32_t MCP2515_TXQ_submitBatch(MCP2515_TXQ txq, CAN_FRAME_t frames[], const uint32_t n)
+{
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return 0;
+    }
+    uint32_t accepted = 0;
+    while (accepted < n && frames[accepted].can_dlc <= CAN_MAX_DLEN) {
+        if (txq->free_count == 0 || xSemaphoreTake(txq->space, 0) != pdTRUE) {
+            txq->stats.full++;
+            break;
+        }
+        MCP2515_TXQ_add(txq, &frames[accepted], 0, NULL, NULL);
+        accepted++;
+    }
+    // the whole batch is in the heap before the first mailbox is loaded
+    MCP2515_TXQ_settle(txq);
+    MCP2515_endSession();
+    return accepted;
+}
+
+void MCP2515_TXQ_service(MCP2515_TXQ txq)
+{
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return;
+    }
+    // a fresh READ STATUS instead of the caller's CANINTF snapshot: a mailbox may
+    // have been refilled since, and TXREQ tells a finished mailbox from a busy one
+    const uint8_t stat = MCP2515_getStatus();
+    uint8_t done = 0;
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (stat & MCP2515_Object->TXB_ptr[i].STAT_TXREQ) {
+            continue;
+        }
+        const bool sent = (stat & (STAT_TX0IF << (2 * i))) != 0;
+        if (sent) {
+            done |= (uint8_t)(CANINTF_TX0IF << i);
+        }
+        if (txq->mailbox[i] != MCP2515_TXQ_NONE) {
+            MCP2515_TXQ_release(txq, i, stat);
+        }
+    }
+    // every mailbox without TXREQ is free, including ones loaded before the queue
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        if (!(stat & MCP2515_Object->TXB_ptr[i].STAT_TXREQ)) {
+            MCP2515_Object->tx_busy &= ~(1U << i);
+        }
+    }
+    if (done != 0) {
+        MCP2515_clearInterruptFlags(done);
+    }
+    // refill first so the bus stays busy, then report; callbacks see a settled queue
+    MCP2515_TXQ_settle(txq);
+    MCP2515_endSession();
+}
+
+void MCP2515_TXQ_expire(MCP2515_TXQ txq)
+{
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return;
+    }
+    // the timer has fired, whatever it was armed for
+    txq->armed_us = 0;
+    MCP2515_TXQ_settle(txq);
+    MCP2515_endSession();
+}
+
+void MCP2515_TXQ_attach(MCP2515_TXQ txq)
+{
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return;
+    }
+    txq->armed_us = 0;
+    MCP2515_TXQ_settle(txq);
+    MCP2515_endSession();
+}
+
+void MCP2515_TXQ_detach(MCP2515_TXQ txq)
+{
+    if (MCP2515_beginSession() != ERROR_OK) {
+        return;
+    }
+    // every loaded frame goes back into the heap unless it is sent or expired meanwhile
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        const uint8_t bit = (uint8_t)(1U << i);
+        if (txq->mailbox[i] != MCP2515_TXQ_NONE && !((txq->aborting | txq->expiring) & bit)) {
+            MCP2515_modifyRegister(MCP2515_Object->TXB_ptr[i].CTRL, TXB_TXREQ, 0);
+            txq->aborting |= bit;
+        }
+    }
+    // a full frame time, not capped: the next queue must find the mailboxes free
+    const uint32_t frame_us = MCP2515_TXQ_frameUs();
+    const int64_t start_us = esp_timer_get_time();
+    while ((txq->aborting | txq->expiring) != 0 && esp_timer_get_time() - start_us < frame_us) {
+        MCP2515_TXQ_poll(txq);
+    }
+    if ((txq->aborting | txq->expiring) != 0) {
+        ESP_LOGW(TAG_MCP2515_TXQ, "mailboxes 0x%X still on the bus, settled when the queue is installed again",
+                 (unsigned)(txq->aborting | txq->expiring));
+    }
+    MCP2515_TXQ_flush(txq);
+    MCP2515_TXQ_arm(txq);
+    MCP2515_endSession();
+}
+
+uint32_t MCP2515_TXQ_pending(const MCP2515_TXQ txq)
+{
+    uint32_t pending = txq->count;
+    for (int i = 0; i < N_TXBUFFERS; i++) {
+        pending += (txq->mailbox[i] != MCP2515_TXQ_NONE);
+    }
+    return pending;
+}
+
+void MCP2515_TXQ_getStats(MCP2515_TXQ txq, MCP2515_TXQ_STATS_t *stats)
+{
+    const bool locked = (MCP2515_beginSession() == ERROR_OK);
+    *stats = txq->stats;
+    if (locked) {
+        MCP2515_endSession();
+    }
+}
+
+void MCP2515_TXQ_resetStats(MCP2515_TXQ txq)
+{
+    const bool locked = (MCP2515_beginSession() == ERROR_OK);
+    memset(&txq->stats, 0, sizeof(txq->stats));
+    txq->stats.queued = txq->count;
+    txq->stats.high_water = txq->count;
+    if (locked) {
+        MCP2515_endSession();
+    }
+}
+
+void MCP2515_TXQ_logStats(MCP2515_TXQ txq, const char *tag)
+{
+    MCP2515_TXQ_STATS_t stats;
+    MCP2515_TXQ_getStats(txq, &stats);
+    ESP_LOGI(tag, "TX queue: %lu submitted, %lu sent, %lu failed, %lu full, %lu swaps (%lu late), %lu queued (max %lu)",
+             (unsigned long)stats.submitted, (unsigned long)stats.sent, (unsigned long)stats.failed,
+             (unsigned long)stats.full, (unsigned long)stats.swaps, (unsigned long)stats.swap_late,
+             (unsigned long)stats.queued, (unsigned long)stats.high_water);
+    if (stats.expired != 0 || stats.late != 0) {
+        ESP_LOGI(tag, "  deadline misses: %lu expired, %lu sent late",
+                 (unsigned long)stats.expired, (unsigned long)stats.late);
+        for (int i = 0; i < MCP2515_TXQ_MISS_IDS && stats.misses[i].count != 0; i++) {
+            ESP_LOGI(tag, "    ID 0x%08lX: %lu", (unsigned long)stats.misses[i].can_id,
+                     (unsigned long)stats.misses[i].count);
+        }
+        if (stats.miss_other != 0) {
+            ESP_LOGI(tag, "    other IDs: %lu", (unsigned long)stats.miss_other);
+        }
+    }
+    for (int i = 0; i < MCP2515_TXQ_CLASSES; i++) {
+        const MCP2515_TXQ_CLASS_STATS_t *cls = &stats.classes[i];
+        if (cls->sent == 0) {
+            continue;
+        }
+        ESP_LOGI(tag, "  IDs 0x%03X-0x%03X: %lu sent, worst wait %lu us, worst total %lu us",
+                 i << 8, (i << 8) | 0xFF, (unsigned long)cls->sent,
+                 (unsigned long)cls->max_wait_us, (unsigned long)cls->max_total_us);
+    }
+}
@@ -0,0 +1,198 @@
+#ifndef _MCP2515_TXQ_H_
+#define _MCP2515_TXQ_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "mcp2515.h"
+
+/*
+ * Driver-owned transmit queue. Submitted frames wait in a min-heap ordered the
+ * way CAN arbitration orders them (base ID, then standard before extended,
+ * then data before remote; submission order among equal IDs), and the three
+ * most urgent ones sit in the mailboxes. TXP is assigned by rank, 3 for the
+ * most urgent loaded frame, so the chip sends them in heap order as well.
+ *
+ * When a frame more urgent than every loaded one arrives and no mailbox is
+ * free, the least urgent mailbox is aborted (TXREQ cleared) and its frame goes
+ * back into the heap, unless it had already won the bus. Completions are taken
+ * from READ STATUS when the driver sees TXnIF, so the queue needs all three
+ * TX interrupts; MCP2515_setTxQueue() enables them. An abort is waited for
+ * up to one frame time at the configured bitrate. One ending in ABTF raises
+ * no TXnIF, so an abort still pending after that is re-read on every queue
+ * operation and by the queue's timer until it settles.
+ *
+ * Mailboxes filled in one pass are loaded first and started together with a
+ * single RTS instruction, so a burst reaches the bus back to back.
+ *
+ * Once installed, MCP2515_sendMessageAfterCtrlCheck() and MCP2515_sendBatch()
+ * submit to the queue.
+ * All queue state is touched inside a driver session. Only the installed
+ * queue loads, aborts or polls the mailboxes; any other queue still accepts
+ * frames and expires them, but keeps them in its heap until it is installed
+ * again. MCP2515_setTxQueue() hands the mailboxes over: the outgoing queue's
+ * loaded frames are aborted back into its heap.
+ *
+ * MCP2515_TXQ_submitAsync() returns a handle and reports the outcome of the
+ * frame through a callback once the chip is done with it. Outcomes are
+ * reported at the end of whichever queue operation found them, inside the
+ * driver session, so the callback runs in the task that services TXnIF, in
+ * the queue's own task (deadlines, pending aborts) or in a task submitting
+ * frames. It may submit the next frame with no wait but must not block. A
+ * producer that finds the queue full can wait for room instead of spinning on
+ * ERROR_ALLTXBUSY.
+ *
+ * MCP2515_TXQ_submitDeadline() gives a frame an absolute deadline on the
+ * esp_timer clock. A frame still queued at its deadline is dropped, a loaded
+ * one has its mailbox aborted (TXREQ cleared, not ABAT, which would abort the
+ * fresh frames in the other mailboxes too); either way it completes with
+ * MCP2515_TX_EXPIRED and the mailbox is free for newer data. Deadlines are
+ * checked on every queue operation and by a one-shot esp_timer armed for the
+ * earliest one, so a frame retrying on a busy bus is caught as well. The timer
+ * only wakes the queue's task, which does the SPI work, so the shared
+ * esp_timer task never waits for the driver. Misses are counted per ID.
+ * Together with one-shot mode (MCP2515_setOneShotMode) no frame reaches the
+ * bus much later than its deadline.
+ */
+
+// priority classes for the latency report: the top three bits of the base ID
+#define MCP2515_TXQ_CLASSES 8
+#define MCP2515_TXQ_NONE 0xFFFF
+// longest frame on the bus with stuffing, an abort settles within one frame time
+#define MCP2515_TXQ_FRAME_BITS 160
+// frame time while the bitrate is unknown, 160 bits at 500 kbit/s
+#define MCP2515_TXQ_ABORT_WAIT_US 400
+// an abort is busy-waited for at most this long, on slower buses the timer picks it up
+#define MCP2515_TXQ_ABORT_SPIN_MAX_US 1000
+// the queue's task runs expiries and re-polls, and the callbacks they complete
+#define MCP2515_TXQ_TASK_PRIORITY (configMAX_PRIORITIES - 3)
+#define MCP2515_TXQ_TASK_STACK 4096
+
+// submission handle, never 0
+typedef uint32_t MCP2515_TX_HANDLE;
+
+typedef enum {
+	MCP2515_TX_DONE = 0,            // sent and acknowledged (TXnIF)
+	MCP2515_TX_LOST_ARBITRATION,    // given up after losing arbitration (MLOA), one-shot mode
+	MCP2515_TX_BUS_ERROR,           // given up after a bus error (TXERR), one-shot mode
+	MCP2515_TX_ABORTED,             // aborted (ABTF) by ABAT or a TXREQ clear outside the queue
+	MCP2515_TX_EXPIRED              // deadline passed: dropped from the queue or its mailbox aborted
+} MCP2515_TX_RESULT_t;
+
+typedef struct MCP2515_TX_EVENT_s {
+	MCP2515_TX_HANDLE handle;
+	MCP2515_TX_RESULT_t result;
+	canid_t can_id;
+	int64_t queued_us;
+	int64_t done_us;            // when the driver saw the outcome
+	void *user;
+} MCP2515_TX_EVENT_t;
+
+typedef void (*MCP2515_TX_CALLBACK)(const MCP2515_TX_EVENT_t *event);
+
+typedef struct MCP2515_TXQ_ENTRY_s {
+	CAN_FRAME_t frame;
+	MCP2515_TX_CALLBACK callback;
+	void *user;
+	uint32_t key;               // arbitration order, lower wins
+	uint32_t seq;               // submission order among equal keys, also the handle
+	int64_t queued_us;
+	int64_t loaded_us;
+	int64_t deadline_us;        // 0 for none
+	int64_t done_us;
+	MCP2515_TX_RESULT_t result;
+	uint16_t next;              // finished list, reported once the queue is settled
+} MCP2515_TXQ_ENTRY_t;
+
+typedef struct MCP2515_TXQ_CLASS_STATS_s {
+	uint32_t sent;
+	uint32_t max_wait_us;       // submit to mailbox load
+	uint32_t max_total_us;      // submit to completion seen by the driver
+} MCP2515_TXQ_CLASS_STATS_t;
+
+// deadline misses are counted for the first IDs that miss one
+#define MCP2515_TXQ_MISS_IDS 16
+
+typedef struct MCP2515_TXQ_MISS_s {
+	canid_t can_id;
+	uint32_t count;
+} MCP2515_TXQ_MISS_t;
+
+typedef struct MCP2515_TXQ_STATS_s {
+	uint32_t submitted;
+	uint32_t sent;
+	uint32_t full;              // submissions refused because the queue was full
+	uint32_t failed;            // frames the chip gave up on (one-shot mode, external abort)
+	uint32_t swaps;             // mailboxes aborted to make room for a more urgent frame or another queue
+	uint32_t swap_late;         // aborts that came too late, the frame was sent anyway
+	uint32_t queued;            // frames waiting in the heap
+	uint32_t high_water;
+	uint32_t expired;           // frames dropped or aborted at their deadline
+	uint32_t late;              // frames sent after their deadline, the abort came too late
+	MCP2515_TXQ_MISS_t misses[MCP2515_TXQ_MISS_IDS];  // expired + late by ID
+	uint32_t miss_other;        // misses of IDs beyond the table
+	MCP2515_TXQ_CLASS_STATS_t classes[MCP2515_TXQ_CLASSES];
+} MCP2515_TXQ_STATS_t;
+
+typedef struct MCP2515_TXQ_s {
+	MCP2515_TXQ_ENTRY_t *entries;
+	uint16_t *heap;             // entry indices, min-heap on (key, seq)
+	uint16_t *free_list;
+	uint32_t capacity;
+	uint32_t count;             // entries in the heap
+	uint32_t free_count;
+	uint32_t seq;
+	// counts free entries, lets a producer sleep until a completion makes room
+	SemaphoreHandle_t space;
+
+	uint16_t mailbox[N_TXBUFFERS];  // entry loaded in each mailbox, MCP2515_TXQ_NONE if free
+	uint8_t txp[N_TXBUFFERS];       // TXP last written to each mailbox
+	uint8_t aborting;               // mailboxes whose abort is still pending on the bus
+	uint8_t unsent;                 // mailboxes loaded by the current pump, not yet started
+	uint8_t expiring;               // mailboxes aborted at their deadline, still pending on the bus
+	uint16_t done_head;             // finished entries not reported yet
+	uint16_t done_tail;
+
+	uint32_t deadlines;             // entries queued or loaded with a deadline
+	esp_timer_handle_t deadline_timer;
+	int64_t armed_us;               // deadline or re-poll the timer is set for, 0 if stopped
+	TaskHandle_t task;              // woken by the timer, runs MCP2515_TXQ_expire()
+
+	MCP2515_TXQ_STATS_t stats;
+} MCP2515_TXQ_t[1];
+
+// capacity below 0xFFFF, returns NULL when out of memory
+MCP2515_TXQ MCP2515_TXQ_create(const uint32_t capacity);
+// must not be installed in the driver any more
+void MCP2515_TXQ_destroy(MCP2515_TXQ txq);
+
+// ERROR_ALLTXBUSY when the queue is full
+ERROR_t MCP2515_TXQ_submit(MCP2515_TXQ txq, const CAN_FRAME frame);
+// waits up to wait ticks for room, returns 0 if there was none; callback may be NULL
+MCP2515_TX_HANDLE MCP2515_TXQ_submitAsync(MCP2515_TXQ txq, const CAN_FRAME frame, const TickType_t wait,
+                                          MCP2515_TX_CALLBACK callback, void *user);
+/*
+ * As MCP2515_TXQ_submitAsync(), the frame expires at deadline_us (esp_timer
+ * clock, 0 for none) if it has not been sent by then.
+ */
+MCP2515_TX_HANDLE MCP2515_TXQ_submitDeadline(MCP2515_TXQ txq, const CAN_FRAME frame, const int64_t deadline_us,
+                                             const TickType_t wait, MCP2515_TX_CALLBACK callback, void *user);
+// queues frames in order until the queue is full, returns how many were taken
+uint32_t MCP2515_TXQ_submitBatch(MCP2515_TXQ txq, CAN_FRAME_t frames[], const uint32_t n);
+// hand the mailboxes over, called by MCP2515_setTxQueue() before another queue is installed
+void MCP2515_TXQ_detach(MCP2515_TXQ txq);
+// start what is waiting, called by MCP2515_setTxQueue() once the queue is installed
+void MCP2515_TXQ_attach(MCP2515_TXQ txq);
+// collect completed mailboxes and refill them, called by MCP2515_txCompleted()
+void MCP2515_TXQ_service(MCP2515_TXQ txq);
+// drop and abort what has expired, settle pending aborts; run by the queue's task when the timer fires
+void MCP2515_TXQ_expire(MCP2515_TXQ txq);
+// frames queued or loaded
+uint32_t MCP2515_TXQ_pending(const MCP2515_TXQ txq);
+
+void MCP2515_TXQ_getStats(MCP2515_TXQ txq, MCP2515_TXQ_STATS_t *stats);
+void MCP2515_TXQ_resetStats(MCP2515_TXQ txq);
+void MCP2515_TXQ_logStats(MCP2515_TXQ txq, const char *tag);
+
+#endif